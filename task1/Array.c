@@ -1,189 +1,259 @@
 #include "Array.h"
 #include "StrLib.h"
+#include "IntParser.h"
+#include "Sort.h"
+#include "RunFile.h"
+#include "Trace.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-#define MERGE_SORT 1
-#define HEAP_SORT 2
-#define SORT_ALORITHM HEAP_SORT
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 /**
-\brief  Функция считывает числа из файла, генерируя массив
+\brief  Функция считывает числа из диапазона файла, генерируя массив
 \param  [in]  filename  имя файла из которого будем читать 
-\param  [in,out] retunredArraySize указатель на память куда
-                                   будем записывать размер
-                                   считанного массива
-\retun  Указатель на сгенерированный массив
-\note   В случае неудачной попытки будет возвращен NULL
+\param  [in]  range     диапазон файла, который нужно разобрать
+\param  [in]  readMode  способ чтения файла
+\param  [in,out] result  структура, в которую будут записаны
+                         массив, его размер и статистика разбора
+\return true в случае успеха, false иначе
+\note   Текст разбирается за один проход функцией parseIntegers(),
+        которая пишет числа сразу в итоговый массив. В режиме
+        READ_MMAP разбор идет прямо по отображенному файлу.
 */
-static int* readArrayFromFile(const char* filename, int* retunredArraySize)
+static bool readArrayFromFile(const char* filename, const struct FileRange* range,
+                              enum ReadMode readMode, struct Array* result)
 {
-    if(!retunredArraySize)
+    if(!result)
     {
-        printf("Error: you should alloc memory for retunredArraySize variable\n");
-        return NULL;
+        printf("Error: you should alloc memory for result variable\n");
+        return false;
     }
-    int* array = NULL;
-    char* rawData = NULL;
-    int size = async_readFullFile(filename, &rawData);
-    if (size == STANDART_ERROR_CODE)
+    struct FileView view = {NULL, 0, 0};
+    int err = STANDART_ERROR_CODE;
+    traceBegin("read");
+    if(readMode == READ_MMAP)
+        err = mapFileRange(filename, range->offset, range->length, &view);
+    else
     {
-        printf("Error: cant read file!\n");
-        if(rawData)free(rawData);
-        return NULL;
+        long size = async_readFileRange(filename, range->offset, range->length, &view.data);
+        if(size != STANDART_ERROR_CODE)
+        {
+            view.size = size;
+            err = 0;
+        }
     }
-
-    int arraySize = 0;
-    bool wasSpace = 0;
-    bool isSpace = 0;
-    for(int i = 0; rawData[i]; i++)
+    traceEnd("read");
+    if (err == STANDART_ERROR_CODE)
     {
-        isSpace = strchr(" \t\n",rawData[i]);
-        arraySize += isSpace && !wasSpace;
-        wasSpace = isSpace;
-    };
-
+        printf("Error: cant read file!\n");
+        releaseFileView(&view);
+        return false;
+    }
 
-    bool isLastDigit = !strchr(" \t\n",rawData[size-1]);
-    arraySize += isLastDigit;
-    if(!isLastDigit)
-        rawData[size-1] = 0;
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-    array = (int*)calloc(arraySize,sizeof(int));
+    int* array = (int*)malloc(intParserCapacity(view.size) * sizeof(int));
     if(!array)
     {
         printf("Error: Cant allocate memory for array of integers!\n");
-        if(rawData)free(rawData);
-        return NULL;
+        releaseFileView(&view);
+        return false;
     }
+    traceBegin("parse");
+    size_t arraySize = parseIntegers(view.data, view.data + view.size, array);
+    traceEnd("parse");
 
-    int offset = 0;
-    for(int i = 0; i< arraySize;i++)
-    {
-        #define IS_DIGIT_CHARACTER\
-            (rawData[offset] == '-' || ('0' <= rawData[offset] && rawData[offset] <= '9'))
-        while( !IS_DIGIT_CHARACTER ) offset++;
-        sscanf(&rawData[offset], "%d", &array[i]);
-        while(  IS_DIGIT_CHARACTER ) offset++;
-        #undef IS_DIGIT_CHARACTER
-    }
+    // отдаем неиспользованный хвост оценки сверху
+    int* shrunk = (int*)realloc(array, (arraySize ? arraySize : 1) * sizeof(int));
+    if(shrunk)
+        array = shrunk;
 
-    if(rawData)free(rawData);
-    *retunredArraySize = arraySize;
-    return array;
-}
+    clock_gettime(CLOCK_MONOTONIC, &stop);
 
+    result->data = array;
+    result->size = arraySize;
+    result->parsedBytes = view.size;
+    result->parseTime = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9;
+    releaseFileView(&view);
+    return true;
+}
 
-#if SORT_ALORITHM == MERGE_SORT
 
-/// реализация сортировки слиянием
-static void merge(int* array, int l, int m, int r)
+/**
+\brief  Функция потоково считывает числа из диапазона файла кусками
+\param  [in]  filename   имя файла из которого будем читать
+\param  [in]  range      диапазон файла, который нужно разобрать
+\param  [in]  chunkSize  размер куска в байтах
+\param  [in,out] result  структура, в которую будут записаны
+                         массив, его размер и статистика разбора
+\return true в случае успеха, false иначе
+\note   Пока разбирается один кусок, следующий уже читается, а
+        числа дописываются в конец растущего массива. Поэтому кроме
+        самого массива в памяти находятся только два куска текста.
+*/
+static bool readArrayStreaming(const char* filename, const struct FileRange* range,
+                               size_t chunkSize, struct Array* result)
 {
-    int n1 = m - l + 1;
-    int n2 = r - m;
-    int Left[n1];
-    int Right[n2];
-    for(int i = 0; i<n1;i++)
-        Left[i] = array[l+i];
-    for(int i=0;i<n2;i++)
-        Right[i] = array[m+1+i];
-    
-    int i = 0;
-    int j = 0;
-    int k = l;
-    while(i<n1 && j<n2)
+    if(!result)
     {
-        if(Left[i] <= Right[j])
-            array[k++] = Left[i++];
-        else
-            array[k++] = Right[j++];
+        printf("Error: you should alloc memory for result variable\n");
+        return false;
+    }
+    struct ChunkReader reader;
+    if(chunkReaderOpenRange(&reader, filename, chunkSize, range->offset, range->length) == STANDART_ERROR_CODE)
+    {
+        printf("Error: cant read file!\n");
+        return false;
     }
 
-    while(i < n1)
-        array[k++] = Left[i++];
-    while(j < n2)
-        array[k++] = Right[j++];
-}
-
-static void mergeSort(int* array, int l, int r)
-{
-    if(l>=r)
-        return;
-    int m = l + (r-l) / 2;
-    mergeSort(array,l,m);
-    mergeSort(array,m+1,r);
-    merge(array,l,m,r);
-}
-
-#endif
+    size_t capacity = intParserCapacity(chunkSize + CHUNK_HEADROOM);
+    size_t size = 0;
+    size_t parsedBytes = 0;
+    double parseTime = 0;
+    int* array = (int*)malloc(capacity * sizeof(int));
 
-#if SORT_ALORITHM == HEAP_SORT
+    const char* tail = NULL;
+    size_t tailLen = 0;
+    bool isOk = array != NULL;
+    while(isOk)
+    {
+        char* chunk = NULL;
+        traceBegin("read");
+        long len = chunkReaderNext(&reader, &chunk, tail, tailLen);
+        traceEnd("read");
+        if(len == STANDART_ERROR_CODE)
+        {
+            printf("Error: cant read file!\n");
+            isOk = false;
+            break;
+        }
+        bool isLast = len == 0;
+        if(isLast)
+        {
+            //разбираем хвост последнего куска
+            chunk = (char*)tail;
+            len = tailLen;
+        }
 
-///реализация сортировки кучей
-static void heapify(int* array, int n, int i)
-{
-    int largest = i;
-    int l = (i << 1) + 1;
-    int r = l + 1; 
+        struct timespec start, stop;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if(size + intParserCapacity(len) > capacity)
+        {
+            while(size + intParserCapacity(len) > capacity)
+                capacity *= 2;
+            int* grown = (int*)realloc(array, capacity * sizeof(int));
+            if(!grown)
+            {
+                printf("Error: Cant allocate memory for array of integers!\n");
+                isOk = false;
+                break;
+            }
+            array = grown;
+        }
+        traceBegin("parse");
+        if(isLast)
+            size += parseIntegers(chunk, chunk + len, array + size);
+        else
+            size += parseIntegersChunk(chunk, chunk + len, array + size, &tail);
+        traceEnd("parse");
+        tailLen = chunk + len - tail;
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        parseTime += (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9;
 
-    if(l < n) largest = array[l] > array[largest] ? l : largest; 
-    if(r < n) largest = array[r] > array[largest] ? r : largest; 
+        if(isLast)
+            break;
+        parsedBytes += len - tailLen;
+    }
+    parsedBytes += tailLen;
+    chunkReaderClose(&reader);
 
-    if(largest != i)
+    if(!isOk)
     {
-        array[i] ^= array[largest];
-        array[largest] ^= array[i];
-        array[i] ^= array[largest];
-
-        heapify(array, n, largest);
+        if(array)free(array);
+        else printf("Error: Cant allocate memory for array of integers!\n");
+        return false;
     }
+
+    // отдаем неиспользованный запас
+    int* shrunk = (int*)realloc(array, (size ? size : 1) * sizeof(int));
+    if(shrunk)
+        array = shrunk;
+
+    result->data = array;
+    result->size = size;
+    result->parsedBytes = parsedBytes;
+    result->parseTime = parseTime;
+    return true;
 }
 
-static void heapSort(int* array, int n)
+
+/**
+\brief  Функция считывает числа из двоичного файла формата RunFile
+\param  [in]  filename  имя файла из которого будем читать
+\param  [in,out] result  структура, в которую будут записаны
+                         массив, его размер и статистика разбора
+\return true в случае успеха, false иначе
+\note   Текст здесь не разбирается вовсе: сырые числа копируются,
+        сжатые распаковываются блоками. Если в заголовке стоит флаг
+        RUN_FILE_SORTED, то массив помечается отсортированным.
+*/
+static bool readArrayFromRunFile(const char* filename, struct Array* result)
 {
-    for(int i = (n>>1) - 1; i>= 0;i--)
-        heapify(array, n, i);
+    struct RunFile file;
+    if(runFileOpen(filename, &file) == STANDART_ERROR_CODE)
+        return false;
 
-    for(int i = n -1; i > 0; i--)
-    {
-        array[0] ^= array[i];
-        array[i] ^= array[0];
-        array[0] ^= array[i];
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-        heapify(array, i, 0);
+    int* array = (int*)malloc((file.count ? file.count : 1) * sizeof(int));
+    if(!array)
+    {
+        printf("Error: Cant allocate memory for array of integers!\n");
+        runFileClose(&file);
+        return false;
     }
-}
+    traceBegin("parse");
+    size_t size = runFileDecode(&file, array);
+    traceEnd("parse");
+    if(size != file.count)
+    {
+        printf("Error: binary run file `%s` is truncated\n", filename);
+        free(array);
+        runFileClose(&file);
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
 
-#endif
+    result->data = array;
+    result->size = size;
+    result->isSorted = file.flags & RUN_FILE_SORTED;
+    result->parsedBytes = file.mapSize;
+    result->parseTime = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9;
+    runFileClose(&file);
+    return true;
+}
 
 
 /**
     \brief  Функция сортирует массив целых чисел
-    \param  [in]  array  указатель на массив
-    \param  [in]  size   размер массива
+    \param  [in,out]  array      массив, в поле plan записывается
+                                 выбранный алгоритм
+    \param  [in]      algorithm  алгоритм сортировки
 */
-static void arraySorter(int* array, int size)
+static void arraySorter(struct Array* array, enum SortAlgorithm algorithm)
 {
-    if(!array)
+    if(!array->data)
     {
         printf("Error: invalid ptr to array\n");
         return;
     }
-    if(size < 0)
-    {
-        printf("Error: array size must be non-negative number\n");
-        return;
-    }
-    if(size == 1)
-        return;
-    
-    #if SORT_ALORITHM == MERGE_SORT
-        mergeSort(array, 0, size - 1);
-    #else 
-        heapSort(array, size);
-    #endif
+    sortIntegersPlanned(array->data, array->size, algorithm, &array->plan);
 }
 
 /**
@@ -191,48 +261,184 @@ static void arraySorter(int* array, int size)
     \param  [in]  array  указатель на массив
     \param  [in]  size   размер массива
 */
-void arrayPrinter(int* array, int size)
+void arrayPrinter(int* array, size_t size)
 {
     if(!array)
     {
         printf("Error: invalid ptr to array\n");
         return;
     }
-    if(size < 0)
-    {
-        printf("Error: array size must be non-negative number\n");
-        return;
-    }
-    for(int i = 0 ; i< size; i++)
+    for(size_t i = 0 ; i< size; i++)
         printf("%d ",array[i]);
 }
 
 
+/**
+    \brief  Функция считывает массив из диапазона файла любым из
+            способов чтения.
+    \return true в случае успеха, false иначе
+    \note   Двоичный файл не делится на диапазоны и читается целиком.
+*/
+static bool loadArrayFromFileRange(const char* filename, const struct FileRange* range,
+                                   const struct SortConfig* config, struct Array* result)
+{
+    if(range->offset == 0 && isRunFile(filename))
+        return readArrayFromRunFile(filename, result);
+    if(config->readMode == READ_STREAM)
+        return readArrayStreaming(filename, range, config->chunkSize, result);
+    return readArrayFromFile(filename, range, config->readMode, result);
+}
+
 /**
     \brief  Функция сортирует массив целых чисел, считанный из файла
     \param  [in]  filename  имя файла из которого считывается массив
+    \param  [in]  config    параметры чтения и сортировки
+    \return Возвращается структура типа Array
+    \note   В случае возникновения ошибки поле data возвращаемой
+            структуры будет равно NULL
+*/
+struct Array sortArrayFromFile(const char* filename, const struct SortConfig* config)
+{
+    struct FileRange wholeFile = {0, TO_END_OF_FILE};
+    return sortArrayFromFileRange(filename, &wholeFile, config);
+}
+
+/**
+    \brief  Функция сортирует массив целых чисел, считанный из
+            диапазона файла
+    \param  [in]  filename  имя файла из которого считывается массив
+    \param  [in]  range     диапазон, полученный от splitFileIntoRanges()
+    \param  [in]  config    параметры чтения и сортировки
     \return Возвращается структура типа Array
     \note   В случае возникновения ошибки поле data возвращаемой
             структуры будет равно NULL
 */
-struct Array sortArrayFromFile(const char* filename)
+struct Array sortArrayFromFileRange(const char* filename, const struct FileRange* range,
+                                    const struct SortConfig* config)
 {
     struct Array result;
-    result.size = 0;
-    result.data = NULL;
+    memset(&result, 0, sizeof(result));
     
-    if(!filename)
+    if(!filename || !range || !config)
     {
-        printf("Error: filename string contain null ptr.\n");
+        printf("Error: filename, range or config contain null ptr.\n");
         return result;
     }
 
-    result.data = readArrayFromFile(filename, &result.size);
-    if(!result.data)
+    if(!loadArrayFromFileRange(filename, range, config, &result))
     {
         printf("Error: Cant read array from file\n");
         return result;
     }
-    arraySorter(result.data, result.size);    
+    //отсортированный двоичный файл повторно не сортируем
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    traceBegin("sort");
+    if(!result.isSorted)
+        arraySorter(&result, config->algorithm);
+    traceEnd("sort");
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    result.sortTime = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9;
+    return result;
+}
+
+/**
+    \brief  Функция считывает массив из файла без сортировки.
+    \param  [in]  filename  имя текстового или двоичного файла
+    \param  [in]  config    параметры чтения
+    \return Возвращается структура типа Array; поле isSorted равно
+            true, только если файл помечен как отсортированный.
+    \note   В случае возникновения ошибки поле data возвращаемой
+            структуры будет равно NULL
+*/
+struct Array loadArrayFromFile(const char* filename, const struct SortConfig* config)
+{
+    struct Array result;
+    memset(&result, 0, sizeof(result));
+    struct FileRange wholeFile = {0, TO_END_OF_FILE};
+    if(!filename || !config || !loadArrayFromFileRange(filename, &wholeFile, config, &result))
+        printf("Error: Cant read array from file\n");
     return result;
 }
+
+
+/**
+    \brief  Функция ищет первый байт, начиная с offset, который
+            разделяет числа и не является знаком '-'.
+    \return Смещение найденного байта или fileSize, если до конца
+            файла такого байта нет.
+    \note   Граница, поставленная на такой байт, не разрезает ни одно
+            число и не отрывает от числа его знак.
+*/
+static size_t findRangeBoundary(int fd, size_t offset, size_t fileSize)
+{
+    char buffer[4096];
+    while(offset < fileSize)
+    {
+        ssize_t nRead = pread(fd, buffer, sizeof(buffer), offset);
+        if(nRead <= 0)
+            return fileSize;
+        for(ssize_t i = 0; i < nRead; i++)
+        {
+            unsigned char ch = buffer[i];
+            if(ch != '-' && (unsigned char)(ch - '0') >= 10)
+                return offset + i;
+        }
+        offset += nRead;
+    }
+    return fileSize;
+}
+
+/**
+    \brief  Функция делит файл на диапазоны примерно равной длины,
+            границы которых проходят по разделителям чисел.
+    \param  [in]   filename  имя файла
+    \param  [in]   fileSize  размер файла в байтах
+    \param  [in]   nParts    желаемое число диапазонов
+    \param  [out]  ranges    массив, вмещающий nParts диапазонов
+    \return Количество получившихся диапазонов, не больше nParts.
+    \note   Каждое число целиком попадает ровно в один диапазон,
+            поэтому диапазоны можно разбирать и сортировать независимо,
+            а затем слить полученные массивы. Если файл не удалось
+            открыть, то возвращается один диапазон на весь файл.
+*/
+size_t splitFileIntoRanges(const char* filename, size_t fileSize, size_t nParts, struct FileRange* ranges)
+{
+    if(!ranges || !nParts)
+        return 0;
+    int fd = nParts > 1 && !isRunFile(filename) ? open(filename, O_RDONLY) : -1;
+    if(fd == -1)
+    {
+        ranges[0].offset = 0;
+        ranges[0].length = TO_END_OF_FILE;
+        return 1;
+    }
+
+    size_t nRanges = 0;
+    size_t begin = 0;
+    for(size_t part = 1; part <= nParts && begin < fileSize; part++)
+    {
+        size_t end = fileSize;
+        if(part < nParts)
+        {
+            size_t target = fileSize / nParts * part;
+            end = findRangeBoundary(fd, target > begin ? target : begin, fileSize);
+        }
+        if(end == begin)
+            continue;
+        ranges[nRanges].offset = begin;
+        ranges[nRanges].length = end - begin;
+        nRanges++;
+        begin = end;
+    }
+    close(fd);
+
+    if(!nRanges)
+    {
+        ranges[0].offset = 0;
+        ranges[0].length = TO_END_OF_FILE;
+        nRanges = 1;
+    }
+    ranges[nRanges - 1].length = TO_END_OF_FILE;
+    return nRanges;
+}
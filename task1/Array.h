@@ -1,13 +1,48 @@
 #pragma once
 #include <stdbool.h>
+#include <stddef.h>
+#include "Sort.h"
 
 struct Array
 {
-    int size;
+    size_t size;
     int* data;
     bool isSorted;
+    size_t parsedBytes;
+    double parseTime;
+    double sortTime;
+    struct SortPlan plan;   ///< как сортировался массив
+};
+
+/// способ, которым содержимое файла попадает в память
+enum ReadMode
+{
+    READ_MMAP,  ///< отображение файла в память, разбор на месте
+    READ_AIO,   ///< копирование файла в кучу через aio_read()
+    READ_STREAM ///< чтение кусками по chunkSize байт с разбором на лету
+};
+
+struct SortConfig
+{
+    enum ReadMode readMode;
+    size_t chunkSize;
+    enum SortAlgorithm algorithm;
+    size_t splitSize;   ///< минимальный размер части, на которые делится большой файл
+    size_t memoryBudget;///< память на внешнюю сортировку, 0 - сортировка целиком в памяти
+    const char* tempDir;///< каталог для временных файлов внешней сортировки
+};
+
+/// часть файла, которая разбирается и сортируется отдельной задачей
+struct FileRange
+{
+    size_t offset;
+    size_t length;      ///< длина в байтах или TO_END_OF_FILE
 };
 
 
-struct Array sortArrayFromFile(const char* filename);
-void arrayPrinter(int* array, int size);
\ No newline at end of file
+struct Array sortArrayFromFile(const char* filename, const struct SortConfig* config);
+struct Array sortArrayFromFileRange(const char* filename, const struct FileRange* range,
+                                    const struct SortConfig* config);
+struct Array loadArrayFromFile(const char* filename, const struct SortConfig* config);
+size_t splitFileIntoRanges(const char* filename, size_t fileSize, size_t nParts, struct FileRange* ranges);
+void arrayPrinter(int* array, size_t size);
\ No newline at end of file
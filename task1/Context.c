@@ -0,0 +1,188 @@
+#include "Context.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define handle_error_rude(msg) \
+    do { perror(msg); exit(EXIT_FAILURE); } while (0)
+
+//==================================================================================================
+
+//                               запасной путь через ucontext
+
+//==================================================================================================
+
+
+void ucontextInit(struct ExecutionContext* context, void* stack, size_t stackSize, ContextEntry entry, int arg)
+{
+    if(getcontext(&context->ucontext) == -1)
+        handle_error_rude("getcontext");
+    context->ucontext.uc_stack.ss_sp = stack;
+    context->ucontext.uc_stack.ss_size = stackSize;
+    context->ucontext.uc_stack.ss_flags = 0;
+    context->ucontext.uc_link = NULL;
+    makecontext(&context->ucontext, (void (*)())entry, 1, arg);
+}
+
+void ucontextSwitch(struct ExecutionContext* from, struct ExecutionContext* to)
+{
+    if(swapcontext(&from->ucontext, &to->ucontext) == -1)
+        handle_error_rude("swapcontext");
+}
+
+//==================================================================================================
+//==================================================================================================
+
+
+
+
+
+
+//==================================================================================================
+
+//                               ассемблерное переключение
+
+//==================================================================================================
+
+#if CONTEXT_HAS_ASM
+
+/*
+    asmContextSwitch(save, load) кладет на текущий стек сохраняемые
+    регистры, записывает указатель стека в *save, берет новый из *load,
+    снимает со стека регистры нового контекста и возвращается уже по
+    его адресу возврата.
+
+    Новый стек подготавливается asmContextInit() так, будто на нем
+    уже вызывали asmContextSwitch(): адрес возврата указывает на
+    contextTrampoline, а в сохраненных регистрах лежат entry и arg.
+*/
+
+#if defined(__x86_64__)
+
+// rbp, rbx, r12-r15, а также управляющие слова SSE и x87
+#define SAVED_FRAME_SIZE (8 * 8)
+
+__asm__(
+    ".text\n"
+    ".globl asmContextSwitch\n"
+    ".type asmContextSwitch, @function\n"
+    ".p2align 4\n"
+    "asmContextSwitch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq (%rsi), %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size asmContextSwitch, .-asmContextSwitch\n"
+
+    ".type contextTrampoline, @function\n"
+    ".p2align 4\n"
+    "contextTrampoline:\n"
+    "    movl %r13d, %edi\n"
+    "    callq *%r12\n"
+    "    ud2\n"
+    ".size contextTrampoline, .-contextTrampoline\n"
+);
+
+#elif defined(__aarch64__)
+
+// x19-x28, x29, x30 и младшие половины d8-d15
+#define SAVED_FRAME_SIZE 176
+
+__asm__(
+    ".text\n"
+    ".globl asmContextSwitch\n"
+    ".type asmContextSwitch, %function\n"
+    ".p2align 4\n"
+    "asmContextSwitch:\n"
+    "    sub sp, sp, #176\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mov x9, sp\n"
+    "    str x9, [x0]\n"
+    "    ldr x9, [x1]\n"
+    "    mov sp, x9\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #176\n"
+    "    ret\n"
+    ".size asmContextSwitch, .-asmContextSwitch\n"
+
+    ".type contextTrampoline, %function\n"
+    ".p2align 4\n"
+    "contextTrampoline:\n"
+    "    mov w0, w20\n"
+    "    blr x19\n"
+    "    brk #0\n"
+    ".size contextTrampoline, .-contextTrampoline\n"
+);
+
+#endif
+
+void contextTrampoline();
+
+/**
+    \brief  Функция готовит стек нового контекста для asmContextSwitch().
+    \note   Вершина стека выравнивается на 16 байт, как того требует
+            соглашение о вызовах обеих архитектур.
+*/
+void asmContextInit(struct ExecutionContext* context, void* stack, size_t stackSize, ContextEntry entry, int arg)
+{
+    uintptr_t top = ((uintptr_t)stack + stackSize) & ~(uintptr_t)15;
+    uint64_t* frame = (uint64_t*)(top - SAVED_FRAME_SIZE);
+    memset(frame, 0, SAVED_FRAME_SIZE);
+#if defined(__x86_64__)
+    // снизу вверх: mxcsr и fpucw, r15, r14, r13, r12, rbx, rbp, адрес возврата
+    uint32_t mxcsr;
+    uint16_t fpucw;
+    __asm__ volatile("stmxcsr %0" : "=m"(mxcsr));
+    __asm__ volatile("fnstcw %0" : "=m"(fpucw));
+    frame[0] = mxcsr | (uint64_t)fpucw << 32;
+    frame[3] = (uint64_t)(uint32_t)arg;      // r13
+    frame[4] = (uint64_t)(uintptr_t)entry;   // r12
+    frame[7] = (uint64_t)(uintptr_t)contextTrampoline;
+#else
+    frame[0] = (uint64_t)(uintptr_t)entry;   // x19
+    frame[1] = (uint64_t)(uint32_t)arg;      // x20
+    frame[11] = (uint64_t)(uintptr_t)contextTrampoline;  // x30
+#endif
+    context->stackPointer = frame;
+}
+
+#endif
+
+//==================================================================================================
+//==================================================================================================
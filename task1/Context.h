@@ -0,0 +1,88 @@
+#pragma once
+#include <stddef.h>
+#include <ucontext.h>
+
+/*
+    Переключение контекстов исполнения для корутин.
+
+    На x86-64 и aarch64 контекст переключается ассемблерной функцией,
+    которая сохраняет на стеке только регистры, которые по соглашению
+    о вызовах обязана сохранить вызываемая функция, и меняет указатель
+    стека. Маску сигналов она не трогает, поэтому в отличие от
+    swapcontext() не делает ни одного системного вызова.
+
+    На остальных архитектурах, или если собрать с -DCONTEXT_USE_UCONTEXT,
+    используется запасной путь через getcontext()/swapcontext().
+*/
+
+#if (defined(__x86_64__) || defined(__aarch64__)) && !defined(CONTEXT_USE_UCONTEXT)
+    #define CONTEXT_HAS_ASM 1
+#else
+    #define CONTEXT_HAS_ASM 0
+#endif
+
+/// функция, с которой начинается исполнение нового контекста; возвращаться из нее нельзя
+typedef void (*ContextEntry)(int arg);
+
+struct ExecutionContext
+{
+    union
+    {
+        void* stackPointer;     ///< ассемблерный путь: вершина стека с сохраненными регистрами
+        ucontext_t ucontext;    ///< запасной путь
+    };
+};
+
+void ucontextInit(struct ExecutionContext* context, void* stack, size_t stackSize, ContextEntry entry, int arg);
+void ucontextSwitch(struct ExecutionContext* from, struct ExecutionContext* to);
+
+#if CONTEXT_HAS_ASM
+void asmContextInit(struct ExecutionContext* context, void* stack, size_t stackSize, ContextEntry entry, int arg);
+void asmContextSwitch(void** saveStackPointer, void* const* loadStackPointer);
+#endif
+
+/**
+    \brief  Функция готовит контекст, который при первом переключении
+            на него вызовет entry(arg) на стеке stack.
+    \note   Контекст, из которого переключаются впервые (например,
+            планировщик), инициализировать не нужно: он заполняется
+            при переключении.
+*/
+static inline void contextInit(struct ExecutionContext* context, void* stack, size_t stackSize,
+                               ContextEntry entry, int arg)
+{
+#if CONTEXT_HAS_ASM
+    asmContextInit(context, stack, stackSize, entry, arg);
+#else
+    ucontextInit(context, stack, stackSize, entry, arg);
+#endif
+}
+
+/**
+    \brief  Функция сохраняет текущий контекст в from и продолжает
+            исполнение контекста to.
+    \note   Маска сигналов сохраняется и восстанавливается только
+            запасным путем.
+*/
+static inline void contextSwitch(struct ExecutionContext* from, struct ExecutionContext* to)
+{
+#if CONTEXT_HAS_ASM
+    asmContextSwitch(&from->stackPointer, &to->stackPointer);
+#else
+    ucontextSwitch(from, to);
+#endif
+}
+
+/**
+    \brief  Функция возвращает название используемого способа переключения.
+*/
+static inline const char* contextBackendName()
+{
+#if CONTEXT_HAS_ASM && defined(__x86_64__)
+    return "asm-x86_64";
+#elif CONTEXT_HAS_ASM
+    return "asm-aarch64";
+#else
+    return "ucontext";
+#endif
+}
@@ -0,0 +1,1560 @@
+#define _GNU_SOURCE
+#include "Coroutine.h"
+#include "Context.h"
+#include "Trace.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <ucontext.h>
+#include <assert.h>
+
+// период тика таймера в микросекундах процессорного времени потока
+#define TICK_US 500
+// за столько микросекунд должна успеть поработать каждая готовая корутина исполнителя
+#define TARGET_LATENCY_US 20000
+// границы кванта в микросекундах
+#define MIN_QUANTUM_US 1000
+#define MAX_QUANTUM_US 10000
+// сколько спит исполнитель без работы, прежде чем снова поискать ее у соседей
+#define IDLE_WAIT_US 1000
+// сколько корутин исполнитель может украсть за один раз
+#define MAX_STEAL 64
+
+#define KB * 1024
+#define MB * 1024 KB
+#define STACK_SIZE 1 MB
+// самая маленькая страница среди поддерживаемых архитектур
+#define MIN_PAGE_SIZE 4 KB
+// столько свободных стеков пул держит для повторного использования
+#define STACK_POOL_SIZE 64
+// стек для обработчика SIGSEGV, на котором сообщается о переполнении
+#define SIGNAL_STACK_SIZE 64 KB
+
+#define handle_error_rude(msg) \
+    do { perror(msg); exit(EXIT_FAILURE); } while (0)
+
+/*
+    M:N планировщик корутин.
+
+    Корутины исполняются пулом потоков-исполнителей. У каждого
+    исполнителя своя очередь готовых корутин, а его планировщик
+    работает прямо на стеке потока: он берет корутину из очереди,
+    переключается на нее и получает управление обратно, когда корутина
+    вытеснена таймером, ушла ждать чтения или завершилась. Вытесненная
+    корутина возвращается в очередь только после того, как ее контекст
+    полностью сохранен, поэтому ее можно безопасно отдать другому потоку.
+
+    Стек корутине выдается при первом запуске и возвращается в пул,
+    когда она завершится, поэтому стеки есть только у начатых корутин.
+    Стеки отображаются через mmap() без резервирования памяти: память
+    под страницу выделяется, когда стек дорастет до нее. Снизу у стека
+    защитная страница, обращение к которой ловится обработчиком SIGSEGV
+    и сообщается как переполнение стека.
+
+    Исполнитель, у которого закончилась работа, забирает половину
+    очереди у одного из соседей. Корутины, ждущие чтения, остаются у
+    того исполнителя, на котором уснули, и возвращаются в его очередь,
+    когда чтение завершится.
+
+    У каждого исполнителя свой таймер, который присылает SIGALRM только
+    его потоку. Таймер идет по процессорному времени потока, поэтому
+    время, проведенное в ожидании, не тратит квант корутины. Таймер
+    заводится один раз на все время работы исполнителя и тикает каждые
+    TICK_US; корутина вытесняется, когда истекают тики ее кванта. Квант
+    тем короче, чем длиннее очередь исполнителя: все готовые корутины
+    должны успеть поработать за TARGET_LATENCY_US. Пока работает
+    планировщик, сигнал заблокирован.
+
+    Корутина, которой нужно дождаться WaitGroup или Channel, не
+    встает в очередь ожидания сама: она передает планировщику функцию,
+    и тот вызывает ее уже после того, как контекст корутины сохранен.
+    Функция под блокировкой объекта еще раз проверяет условие и либо
+    ставит корутину в очередь ожидания объекта, либо сразу возвращает
+    ее в очередь исполнителя. Поэтому разбудить корутину раньше, чем
+    она уснула, нельзя.
+*/
+
+//==================================================================================================
+
+//                               функции для работы с корутинами
+
+//==================================================================================================
+
+
+/// состояние корутины с точки зрения планировщика
+enum CoroutineState
+{
+    COROUTINE_RUNNABLE,    ///< может исполняться
+    COROUTINE_WAITING_IO,  ///< ждет завершения асинхронного чтения
+    COROUTINE_PARKED,      ///< спит на WaitGroup или Channel
+    COROUTINE_FINISHED     ///< функция корутины завершилась
+};
+
+struct CoroutineControl
+{
+    CoroutineFunction function;
+    void* arg;
+    enum CoroutineState state;
+    const struct aiocb* waitingFor;
+    int lastWorker;                     ///< исполнитель, на котором корутина работала последней
+    void* stack;                        ///< выдается при первом запуске
+    size_t workSize;                    ///< оценка объема работы для SCHEDULE_SHORTEST_FIRST
+    int priority;                       ///< приоритет для SCHEDULE_PRIORITY
+    size_t parkedAt;                    ///< когда корутина встала в очередь или уснула, нс
+    bool (*parkCommit)(int id, void* object);   ///< решает, уснуть ли корутине на объекте
+    void* parkObject;
+    int nextWaiter;                     ///< следующая в CoroutineWaitQueue или -1
+};
+
+/// очередь готовых к исполнению корутин, кольцевой буфер на nContexts элементов
+struct RunQueue
+{
+    pthread_mutex_t lock;
+    int* items;
+    int head;
+    int size;
+};
+
+struct Worker
+{
+    int id;
+    pthread_t thread;
+    struct ExecutionContext schedulerContext;
+    struct RunQueue queue;
+    int current;                        ///< исполняемая корутина или -1
+    volatile sig_atomic_t isSwitching;
+    timer_t timer;
+    volatile sig_atomic_t ticksLeft;    ///< сколько тиков осталось от кванта текущей корутины
+    volatile sig_atomic_t preemptOff;   ///< глубина вложенности coroutinePreemptOff()
+    size_t switchStart;                 ///< когда началось текущее переключение, нс
+
+    size_t cpuTime;                     ///< процессорное время потока исполнителя, мкс
+    size_t coroutineTime;               ///< из него на исполнение корутин, мкс
+    size_t nTicks;
+    size_t nPreemptions;
+
+    int* waiting;                       ///< корутины, ждущие чтения
+    const struct aiocb** pendingIo;     ///< их незавершенные операции
+    int nWaiting;
+};
+
+static int nContexts = 0;
+static int nWorkers = 0;
+static atomic_int nFinished = 0;
+static atomic_int nIdleWorkers = 0;
+
+static struct ExecutionContext* myContexts = NULL;
+static struct CoroutineControl* controls = NULL;
+static struct SchedulerInfo* contextTimeInfo = NULL;
+static struct Worker* workers = NULL;
+static struct RuntimeInfo runtimeInfo;
+static struct timespec runStart;
+
+static pthread_mutex_t idleLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idleCond = PTHREAD_COND_INITIALIZER;
+
+static sigset_t set;
+
+static __thread struct Worker* currentWorker = NULL;
+
+/**
+    \brief  Функция возвращает исполнителя текущего потока.
+    \note   Функция не встраивается: после переключения корутина может
+            продолжить работу в другом потоке, а адрес TLS-переменной
+            компилятор вправе вычислить один раз на всю функцию.
+*/
+__attribute__((noinline)) static struct Worker* getCurrentWorker()
+{
+    return currentWorker;
+}
+
+/**
+    \brief  Функция возвращает процессорное время текущего потока
+            в микросекундах.
+*/
+static size_t threadTimeUs()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+
+/**
+    \brief  Функция возвращает монотонное время в наносекундах.
+*/
+static size_t monotonicNs()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+/**
+    \brief  Функция учитывает задержку переключения, которое
+            начал worker->switchStart.
+    \param  [in]  id  корутина, на которую или с которой переключались
+*/
+static void countSwitchLatency(struct Worker* worker, int id)
+{
+    contextTimeInfo[id].switchLatency += monotonicNs() - worker->switchStart;
+    contextTimeInfo[id].nSwitches++;
+}
+
+/**
+    \brief  Функция добавляет запуск корутины длиной time мкс
+            в гистограмму ее квантов.
+*/
+static void countSlice(int id, size_t time)
+{
+    int bucket = 0;
+    while(time && bucket < SLICE_HISTOGRAM_BUCKETS - 1)
+    {
+        time >>= 1;
+        bucket++;
+    }
+    contextTimeInfo[id].sliceHistogram[bucket]++;
+}
+
+/**
+    \brief  Функция сохраняет контекст текущей корутины и
+            передает управление планировщику ее исполнителя.
+    \param  [in]  id  номер текущей корутины
+    \note   Вызывается с заблокированным SIGALRM, и планировщик
+            работает с ним же. Флаг isSwitching остается поднятым, пока
+            корутина не продолжит исполнение: на запасном пути
+            swapcontext() снимает блокировку сигнала раньше, чем
+            переключает стек, и пришедший в этот момент тик должен
+            быть пропущен. Продолжить исполнение корутина может уже
+            на другом исполнителе.
+*/
+static void enterScheduler(int id)
+{
+    struct Worker* worker = getCurrentWorker();
+    worker->isSwitching = 1;
+    worker->switchStart = monotonicNs();
+    contextSwitch(&myContexts[id], &worker->schedulerContext);
+    worker = getCurrentWorker();
+    countSwitchLatency(worker, id);
+    worker->isSwitching = 0;
+}
+
+/**
+    \brief  Точка входа всех корутин.
+    \param  [in]  id  номер корутины
+    \note   Планировщик переключается на корутину с заблокированным
+            SIGALRM, поэтому при первом запуске сигнал разблокируется
+            здесь. Вытесненная корутина получает маску обратно при
+            выходе из обработчика сигнала. После завершения функции
+            корутины управление передается планировщику исполнителя.
+*/
+static void coroutineEntry(int id)
+{
+    countSwitchLatency(getCurrentWorker(), id);
+    getCurrentWorker()->isSwitching = 0;
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+    controls[id].function(id, controls[id].arg);
+
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    controls[id].state = COROUTINE_FINISHED;
+    struct Worker* worker = getCurrentWorker();
+    worker->isSwitching = 1;
+    worker->switchStart = monotonicNs();
+    contextSwitch(&myContexts[id], &worker->schedulerContext);
+}
+
+//==================================================================================================
+//==================================================================================================
+
+
+
+
+
+
+//==================================================================================================
+
+//                               пул стеков
+
+//==================================================================================================
+
+
+static pthread_mutex_t stackPoolLock = PTHREAD_MUTEX_INITIALIZER;
+static void* stackPool[STACK_POOL_SIZE];
+static int nPooledStacks = 0;
+static int nStacksInUse = 0;
+static int peakStacksInUse = 0;
+// размер страницы, узнается в allocateMemoryForCoroutine(); под каждым стеком лежит
+// одна защитная страница
+static size_t pageSize = MIN_PAGE_SIZE;
+
+/**
+    \brief  Функция выдает стек размера STACK_SIZE.
+    \return Нижняя граница стека, над защитной страницей.
+    \note   Стек берется из пула, а если пул пуст, то отображается
+            новый. Память под страницы стека не резервируется и не
+            выделяется, пока к ним не обратятся.
+*/
+static void* acquireStack()
+{
+    void* stack = NULL;
+    pthread_mutex_lock(&stackPoolLock);
+    if(nPooledStacks)
+        stack = stackPool[--nPooledStacks];
+    if(++nStacksInUse > peakStacksInUse)
+        peakStacksInUse = nStacksInUse;
+    pthread_mutex_unlock(&stackPoolLock);
+    if(stack)
+        return stack;
+
+    char* base = (char*)mmap(NULL, pageSize + STACK_SIZE, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if(base == MAP_FAILED)
+        handle_error_rude("Cant map memory for coroutine stack.");
+    if(mprotect(base, pageSize, PROT_NONE) == -1)
+        handle_error_rude("Cant protect coroutine stack guard page.");
+    return base + pageSize;
+}
+
+/**
+    \brief  Функция возвращает, на сколько байт стек вырос от вершины.
+    \note   Глубина считается по страницам, которые ядро успело выделить.
+            mincore() отмечает настоящие страницы, поэтому их размер
+            берется у системы, а вектор рассчитан на самые маленькие.
+*/
+static size_t stackHighWater(void* stack)
+{
+    unsigned char resident[STACK_SIZE / (MIN_PAGE_SIZE)];
+    if(mincore(stack, STACK_SIZE, resident) == -1)
+        return 0;
+    for(size_t page = 0; page < STACK_SIZE / pageSize; page++)
+        if(resident[page] & 1)
+            return STACK_SIZE - page * pageSize;
+    return 0;
+}
+
+/**
+    \brief  Функция возвращает стек завершившейся корутины в пул.
+    \note   Страницы стека отдаются ядру, поэтому пул не держит
+            лишнюю память, а следующая корутина начинает с чистого
+            стека и ее глубина считается заново.
+*/
+static void releaseStack(void* stack)
+{
+    madvise(stack, STACK_SIZE, MADV_DONTNEED);
+    pthread_mutex_lock(&stackPoolLock);
+    nStacksInUse--;
+    if(nPooledStacks < STACK_POOL_SIZE)
+    {
+        stackPool[nPooledStacks++] = stack;
+        stack = NULL;
+    }
+    pthread_mutex_unlock(&stackPoolLock);
+    if(stack)
+        munmap((char*)stack - pageSize, pageSize + STACK_SIZE);
+}
+
+/**
+    \brief  Функция освобождает все стеки пула.
+*/
+static void drainStackPool()
+{
+    pthread_mutex_lock(&stackPoolLock);
+    while(nPooledStacks)
+        munmap((char*)stackPool[--nPooledStacks] - pageSize, pageSize + STACK_SIZE);
+    pthread_mutex_unlock(&stackPoolLock);
+}
+
+/**
+    \brief  Обработчик SIGSEGV, который отличает переполнение стека
+            корутины от прочих ошибок.
+    \note   Работает на отдельном стеке исполнителя: на стеке корутины
+            места уже нет. Обработчик ставится с SA_RESETHAND, поэтому
+            если адрес не попал в защитную страницу текущей корутины,
+            то повторная ошибка завершит программу как раньше.
+*/
+static void segfault_handler(int signo, siginfo_t* info, void* old_context)
+{
+    (void)signo;
+    (void)old_context;
+    struct Worker* worker = currentWorker;
+    if(worker && worker->current != -1 && controls[worker->current].stack)
+    {
+        char* guard = (char*)controls[worker->current].stack - pageSize;
+        char* address = (char*)info->si_addr;
+        if(address >= guard && address < guard + pageSize)
+        {
+            static const char message[] = "Error: coroutine stack overflow\n";
+            write(STDERR_FILENO, message, sizeof(message) - 1);
+            abort();
+        }
+    }
+}
+
+//==================================================================================================
+//==================================================================================================
+
+
+/**
+    \brief  Функция создает корутину с заданным id.
+    \param  [in]  id        номер корутины
+    \param  [in]  function  функция, которую выполнит корутина
+    \param  [in]  arg       аргумент, который получит функция
+*/
+void createCoroutine(int id, CoroutineFunction function, void* arg)
+{
+    controls[id].function = function;
+    controls[id].arg = arg;
+    controls[id].state = COROUTINE_RUNNABLE;
+    controls[id].waitingFor = NULL;
+    controls[id].workSize = 0;
+    controls[id].priority = 0;
+    controls[id].stack = NULL;
+}
+
+
+/**
+    \brief  Функция сообщает планировщику, сколько работы у корутины
+            и какой у нее приоритет.
+    \param  [in]  id        номер корутины
+    \param  [in]  workSize  оценка объема работы, например размер файла
+    \param  [in]  priority  статический приоритет, меньшее значение раньше
+    \note   Вызывается после createCoroutine(). Подсказки учитываются
+            только политиками, которым они нужны.
+*/
+void setCoroutineHints(int id, size_t workSize, int priority)
+{
+    controls[id].workSize = workSize;
+    controls[id].priority = priority;
+}
+
+
+#define Assert_memory_allocator(ptr)\
+    assert(ptr);\
+    if(!ptr)\
+        handle_error_rude("Cant allocate memory for coroutine.");
+
+/**
+    \brief  Функция выделяет память, которая использутеся
+            для работы корутин.
+    \param  [in]  nCount  число корутин
+*/
+void allocateMemoryForCoroutine(int nCount)
+{
+    if(myContexts) return;
+    long systemPageSize = sysconf(_SC_PAGESIZE);
+    if(systemPageSize >= MIN_PAGE_SIZE && STACK_SIZE % systemPageSize == 0)
+        pageSize = systemPageSize;
+    nContexts = nCount;
+    myContexts = (struct ExecutionContext*)calloc(nContexts,sizeof(struct ExecutionContext));
+    Assert_memory_allocator(myContexts);
+    controls = (struct CoroutineControl*)calloc(nContexts,sizeof(struct CoroutineControl));
+    Assert_memory_allocator(controls);
+    contextTimeInfo = (struct SchedulerInfo*)calloc(nContexts, sizeof(struct SchedulerInfo));
+    Assert_memory_allocator(contextTimeInfo);
+}
+
+/**
+    \brief  Функция освобождает память, которая выделялась
+            для корутин.
+    \param  [in]  nCount  число корутин
+*/
+void cleanMemoryForCoroutine(int nCount)
+{
+    if(controls)
+    for(int i = 0; i < nCount; i++)
+    {
+        if(controls[i].stack) releaseStack(controls[i].stack);
+        controls[i].stack = NULL;
+    }
+    drainStackPool();
+    if(myContexts) free(myContexts);
+    if(controls) free(controls);
+    if(contextTimeInfo) free(contextTimeInfo);
+    myContexts = NULL;
+    controls = NULL;
+    contextTimeInfo = NULL;
+}
+
+/**
+    \brief  Функция возвращает статистику работы корутины.
+    \param  [in]  id  номер корутины
+    \note   Статистика копится за все время работы корутины,
+            на каких бы исполнителях она ни работала.
+*/
+const struct SchedulerInfo* getSchedulerInfo(int id)
+{
+    return &contextTimeInfo[id];
+}
+
+//==================================================================================================
+//==================================================================================================
+
+
+
+
+
+
+//==================================================================================================
+
+//                               очереди исполнителей
+
+//==================================================================================================
+
+
+/*
+    Политика планирования - это правило, по которому исполнитель
+    выбирает следующую корутину из своей очереди. Оно задается
+    функцией isBefore(a, b), которая говорит, нужно ли запустить
+    корутину a раньше b. Для round-robin функции нет, и очередь
+    работает как обычная FIFO. Иначе очередь просматривается целиком:
+    в ней не больше корутин, чем у исполнителя, а выбор делается раз
+    в квант.
+*/
+
+typedef bool (*RunsBefore)(int a, int b);
+
+static bool shortestFirst(int a, int b)
+{
+    return controls[a].workSize < controls[b].workSize;
+}
+
+static bool leastTimeFirst(int a, int b)
+{
+    return contextTimeInfo[a].totalWakingTime < contextTimeInfo[b].totalWakingTime;
+}
+
+static bool priorityFirst(int a, int b)
+{
+    return controls[a].priority < controls[b].priority;
+}
+
+static const char* policyNames[] = {"rr", "sff", "least-time", "priority"};
+static const RunsBefore policyRules[] = {NULL, shortestFirst, leastTimeFirst, priorityFirst};
+
+static enum SchedulingPolicy policy = SCHEDULE_ROUND_ROBIN;
+
+/**
+    \brief  Функция выбирает политику планирования для следующих
+            запусков runCoroutines().
+*/
+void setSchedulingPolicy(enum SchedulingPolicy newPolicy)
+{
+    policy = newPolicy;
+}
+
+/**
+    \brief  Функция переводит имя политики в SchedulingPolicy.
+    \param  [in]   name    "rr", "sff", "least-time" или "priority"
+    \param  [out]  parsed  политика
+    \return true, если имя известно, false иначе.
+*/
+bool parseSchedulingPolicy(const char* name, enum SchedulingPolicy* parsed)
+{
+    for(unsigned i = 0; i < sizeof(policyNames) / sizeof(policyNames[0]); i++)
+        if(!strcmp(name, policyNames[i]))
+        {
+            *parsed = (enum SchedulingPolicy)i;
+            return true;
+        }
+    return false;
+}
+
+const char* schedulingPolicyName(enum SchedulingPolicy value)
+{
+    return policyNames[value];
+}
+
+
+static void runQueueInit(struct RunQueue* queue)
+{
+    pthread_mutex_init(&queue->lock, NULL);
+    queue->items = (int*)calloc(nContexts, sizeof(int));
+    Assert_memory_allocator(queue->items);
+    queue->head = 0;
+    queue->size = 0;
+}
+
+static void runQueueDestroy(struct RunQueue* queue)
+{
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->items);
+    queue->items = NULL;
+}
+
+/**
+    \brief  Функция будит один из простаивающих исполнителей,
+            чтобы он забрал появившуюся работу.
+*/
+static void wakeUpIdleWorker()
+{
+    if(!atomic_load(&nIdleWorkers))
+        return;
+    pthread_mutex_lock(&idleLock);
+    pthread_cond_signal(&idleCond);
+    pthread_mutex_unlock(&idleLock);
+}
+
+/**
+    \brief  Функция ставит корутину в конец очереди исполнителя.
+*/
+static void runQueuePush(struct Worker* worker, int id)
+{
+    struct RunQueue* queue = &worker->queue;
+    pthread_mutex_lock(&queue->lock);
+    queue->items[(queue->head + queue->size) % nContexts] = id;
+    queue->size++;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+    \brief  Функция достает из очереди исполнителя корутину, которую
+            политика планирования велит запустить первой.
+    \return Номер корутины или -1, если очередь пуста.
+    \note   При равенстве берется корутина, стоящая ближе к началу
+            очереди, а порядок остальных не меняется.
+*/
+static int runQueuePop(struct Worker* worker)
+{
+    struct RunQueue* queue = &worker->queue;
+    RunsBefore isBefore = policyRules[policy];
+    int id = -1;
+    pthread_mutex_lock(&queue->lock);
+    if(queue->size)
+    {
+        int best = 0;
+        if(isBefore)
+            for(int i = 1; i < queue->size; i++)
+                if(isBefore(queue->items[(queue->head + i) % nContexts],
+                            queue->items[(queue->head + best) % nContexts]))
+                    best = i;
+        id = queue->items[(queue->head + best) % nContexts];
+        if(best == 0)
+            queue->head = (queue->head + 1) % nContexts;
+        else
+            for(int i = best; i + 1 < queue->size; i++)
+                queue->items[(queue->head + i) % nContexts] = queue->items[(queue->head + i + 1) % nContexts];
+        queue->size--;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return id;
+}
+
+/**
+    \brief  Функция забирает у первого соседа с непустой очередью
+            половину его корутин.
+    \return Номер корутины, которую можно исполнять сразу,
+            или -1, если красть нечего.
+    \note   Забираются корутины из конца очереди жертвы, то есть
+            те, которые у нее дольше всего не получили бы процессор.
+*/
+static int stealWork(struct Worker* thief)
+{
+    for(int step = 1; step < nWorkers; step++)
+    {
+        struct Worker* victim = &workers[(thief->id + step) % nWorkers];
+        int stolen[MAX_STEAL];
+        int nStolen = 0;
+
+        pthread_mutex_lock(&victim->queue.lock);
+        int nToSteal = (victim->queue.size + 1) / 2;
+        if(nToSteal > MAX_STEAL)
+            nToSteal = MAX_STEAL;
+        while(nStolen < nToSteal)
+        {
+            victim->queue.size--;
+            stolen[nStolen++] = victim->queue.items[(victim->queue.head + victim->queue.size) % nContexts];
+        }
+        pthread_mutex_unlock(&victim->queue.lock);
+
+        if(!nStolen)
+            continue;
+        for(int i = 1; i < nStolen; i++)
+            runQueuePush(thief, stolen[i]);
+        return stolen[0];
+    }
+    return -1;
+}
+
+//==================================================================================================
+//==================================================================================================
+
+
+
+
+
+
+//==================================================================================================
+
+//                               планировщик и установка таймера
+
+//==================================================================================================
+
+
+/**
+    \brief  Функция заводит периодический таймер исполнителя.
+    \note   Таймер заводится один раз: между корутинами его не
+            останавливают, тики во время работы планировщика просто
+            ждут, пока сигнал разблокируют.
+*/
+static void timer_on(struct Worker* worker)
+{
+    struct itimerspec timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_nsec = TICK_US * 1000;
+    timer.it_value = timer.it_interval;
+    if (timer_settime(worker->timer, 0, &timer, NULL)) perror("timer_settime");
+}
+
+/**
+    \brief  Функция создает таймер, который присылает SIGALRM
+            только потоку данного исполнителя.
+    \note   Таймер считает процессорное время вызывающего потока.
+*/
+static void timer_create_for_thread(struct Worker* worker)
+{
+    struct sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGALRM;
+    event._sigev_un._tid = syscall(SYS_gettid);
+    if(timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &worker->timer))
+        handle_error_rude("timer_create");
+}
+
+
+/**
+    \brief  Функция выбирает квант для корутины, которую исполнитель
+            сейчас запустит.
+    \return Длина кванта в тиках таймера.
+    \note   Чем больше корутин ждет в очереди, тем короче квант, но не
+            короче MIN_QUANTUM_US. Если очередь пуста, то корутину
+            незачем часто прерывать, и квант максимальный.
+*/
+static int quantumTicks(struct Worker* worker)
+{
+    pthread_mutex_lock(&worker->queue.lock);
+    int nQueued = worker->queue.size;
+    pthread_mutex_unlock(&worker->queue.lock);
+
+    int quantum = TARGET_LATENCY_US / (nQueued + 1);
+    if(quantum < MIN_QUANTUM_US)
+        quantum = MIN_QUANTUM_US;
+    if(quantum > MAX_QUANTUM_US)
+        quantum = MAX_QUANTUM_US;
+    return quantum / TICK_US;
+}
+
+/**
+    \brief  Функция возвращает в очередь исполнителя корутины,
+            чтение которых завершилось.
+*/
+static void wakeUpFinishedIo(struct Worker* worker)
+{
+    int nWaiting = 0;
+    for(int i = 0; i < worker->nWaiting; i++)
+    {
+        int id = worker->waiting[i];
+        if(aio_error(controls[id].waitingFor) == EINPROGRESS)
+        {
+            worker->waiting[nWaiting] = id;
+            worker->pendingIo[nWaiting] = controls[id].waitingFor;
+            nWaiting++;
+            continue;
+        }
+        size_t now = monotonicNs();
+        contextTimeInfo[id].ioWaitTime += (now - controls[id].parkedAt) / 1000;
+        controls[id].parkedAt = now;
+        controls[id].state = COROUTINE_RUNNABLE;
+        controls[id].waitingFor = NULL;
+        runQueuePush(worker, id);
+    }
+    worker->nWaiting = nWaiting;
+}
+
+/**
+    \brief  Функция усыпляет исполнитель, которому нечего делать.
+    \note   Если у исполнителя есть корутины, ждущие чтения, то он
+            спит в aio_suspend(), иначе - на условной переменной.
+            Сон ограничен IDLE_WAIT_US, после чего исполнитель снова
+            пробует украсть работу у соседей.
+*/
+static void waitForWork(struct Worker* worker)
+{
+    if(worker->nWaiting)
+    {
+        struct timespec timeout = {0, IDLE_WAIT_US * 1000};
+        if(aio_suspend(worker->pendingIo, worker->nWaiting, &timeout) == -1 &&
+           errno != EINTR && errno != EAGAIN)
+            handle_error_rude("aio_suspend");
+        return;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += IDLE_WAIT_US * 1000;
+    if(deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&idleLock);
+    atomic_fetch_add(&nIdleWorkers, 1);
+    if(atomic_load(&nFinished) < nContexts)
+        pthread_cond_timedwait(&idleCond, &idleLock, &deadline);
+    atomic_fetch_sub(&nIdleWorkers, 1);
+    pthread_mutex_unlock(&idleLock);
+}
+
+/**
+    \brief  Функция выбирает следующую корутину для исполнителя.
+    \return Номер выбранной корутины или -1, если все корутины
+            завершились.
+    \note   Сначала берется корутина из своей очереди, затем
+            крадется работа у соседей, и только потом исполнитель
+            засыпает.
+*/
+static int pickNextCoroutine(struct Worker* worker)
+{
+    for(;;)
+    {
+        if(atomic_load(&nFinished) == nContexts)
+            return -1;
+        wakeUpFinishedIo(worker);
+        int id = runQueuePop(worker);
+        if(id == -1)
+            id = stealWork(worker);
+        if(id != -1)
+            return id;
+        waitForWork(worker);
+    }
+}
+
+/**
+    \brief  Функция разбирается с корутиной, которая только что
+            вернула управление планировщику.
+*/
+static void onCoroutineSwitchedOut(struct Worker* worker, int id)
+{
+    switch(controls[id].state)
+    {
+        case COROUTINE_RUNNABLE:
+            contextTimeInfo[id].swapTimes++;
+            controls[id].parkedAt = monotonicNs();
+            runQueuePush(worker, id);
+            wakeUpIdleWorker();
+            break;
+        case COROUTINE_WAITING_IO:
+            contextTimeInfo[id].swapTimes++;
+            controls[id].parkedAt = monotonicNs();
+            worker->waiting[worker->nWaiting++] = id;
+            break;
+        case COROUTINE_PARKED:
+            contextTimeInfo[id].swapTimes++;
+            controls[id].parkedAt = monotonicNs();
+            if(!controls[id].parkCommit(id, controls[id].parkObject))
+            {
+                controls[id].state = COROUTINE_RUNNABLE;
+                runQueuePush(worker, id);
+            }
+            break;
+        case COROUTINE_FINISHED:
+        {
+            contextTimeInfo[id].stackHighWater = stackHighWater(controls[id].stack);
+            releaseStack(controls[id].stack);
+            controls[id].stack = NULL;
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            contextTimeInfo[id].finishTime = (now.tv_sec - runStart.tv_sec) * 1000000 +
+                                             (now.tv_nsec - runStart.tv_nsec) / 1000;
+            if(atomic_fetch_add(&nFinished, 1) + 1 == nContexts)
+            {
+                pthread_mutex_lock(&idleLock);
+                pthread_cond_broadcast(&idleCond);
+                pthread_mutex_unlock(&idleLock);
+            }
+            break;
+        }
+    }
+}
+
+/**
+    \brief    Планировщик корутин одного исполнителя.
+    \details  Планировщик работает на стеке потока исполнителя и
+              получает управление, когда у корутины истекает квант,
+              а также тогда, когда корутина уходит ждать чтения или
+              завершается. Процессорное время, которое потратила
+              корутина, добавляется в ее статистику, а все остальное
+              время потока считается накладными расходами планировщика.
+              Задержка переключения меряется от его начала до первой
+              инструкции на другой стороне и в нее попадает только
+              сохранение и восстановление контекста.
+*/
+static void* scheduler(void* arg)
+{
+    struct Worker* worker = (struct Worker*)arg;
+    currentWorker = worker;
+    traceThreadName("worker", worker->id);
+    timer_create_for_thread(worker);
+    timer_on(worker);
+
+    //отдельный стек для обработчика SIGSEGV
+    stack_t signalStack;
+    signalStack.ss_sp = malloc(SIGNAL_STACK_SIZE);
+    signalStack.ss_size = SIGNAL_STACK_SIZE;
+    signalStack.ss_flags = 0;
+    if(!signalStack.ss_sp || sigaltstack(&signalStack, NULL) == -1)
+        handle_error_rude("Cant set signal stack.");
+
+    int id;
+    while((id = pickNextCoroutine(worker)) != -1)
+    {
+        if(controls[id].lastWorker != worker->id)
+            contextTimeInfo[id].migrations++;
+        controls[id].lastWorker = worker->id;
+        if(!controls[id].stack)
+        {
+            controls[id].stack = acquireStack();
+            contextInit(&myContexts[id], controls[id].stack, STACK_SIZE, coroutineEntry, id);
+        }
+
+        worker->current = id;
+        worker->ticksLeft = quantumTicks(worker);
+        worker->isSwitching = 1;
+        size_t start = threadTimeUs();
+        size_t dispatchedAt = monotonicNs();
+        worker->switchStart = dispatchedAt;
+        contextTimeInfo[id].queueWaitTime += (dispatchedAt - controls[id].parkedAt) / 1000;
+        contextSwitch(&worker->schedulerContext, &myContexts[id]);
+        countSwitchLatency(worker, id);
+        traceSlice("run", id, dispatchedAt);
+        size_t time = threadTimeUs() - start;
+        countSlice(id, time);
+        contextTimeInfo[id].totalWakingTime += time;
+        worker->coroutineTime += time;
+        worker->current = -1;
+
+        onCoroutineSwitchedOut(worker, id);
+    }
+
+    timer_delete(worker->timer);
+    signalStack.ss_flags = SS_DISABLE;
+    sigaltstack(&signalStack, NULL);
+    free(signalStack.ss_sp);
+    worker->cpuTime = threadTimeUs();
+    return NULL;
+}
+
+
+// границы кода самой программы, их расставляет компоновщик
+extern char __executable_start[];
+extern char etext[];
+
+/**
+    \brief  Функция проверяет, можно ли вытеснить корутину в той
+            точке, где ее прервал сигнал.
+    \return true, если корутина прервана в коде программы.
+    \note   Внутри libc корутину не вытесняем: malloc(), stdio и
+            pthread держат блокировки, привязанные к потоку, и другая
+            корутина того же исполнителя заблокировала бы на них весь
+            поток. Квант к этому моменту уже истек, поэтому корутина
+            вытесняется на первом тике после выхода из библиотеки.
+*/
+static bool isSafePoint(void* context)
+{
+    const ucontext_t* interrupted = (const ucontext_t*)context;
+#if defined(__x86_64__)
+    const char* pc = (const char*)interrupted->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+    const char* pc = (const char*)interrupted->uc_mcontext.pc;
+#else
+    const char* pc = __executable_start;
+#endif
+    return pc >= __executable_start && pc < etext;
+}
+
+/**
+    \brief  Обработчик таймера, вызывающий планировщик.
+    \note   Корутина вытесняется только на последнем тике своего
+            кванта и только в безопасной точке. Ядро проверяет таймеры процессорного времени не
+            чаще раза в тик системного таймера, поэтому один сигнал
+            может принести несколько тиков: пропущенные лежат в
+            si_overrun. Тик, пришедший во время переключения или когда
+            исполнитель не исполняет корутину, пропускается.
+*/
+static void timer_interrupt(int j, siginfo_t *si, void *old_context)
+{
+    (void)j;
+    struct Worker* worker = getCurrentWorker();
+    if(!worker)
+        return;
+    int nTicks = 1 + (si && si->si_overrun > 0 ? si->si_overrun : 0);
+    worker->nTicks += nTicks;
+    if(worker->current == -1 || worker->isSwitching)
+        return;
+    worker->ticksLeft -= nTicks;
+    if(worker->ticksLeft > 0 || worker->preemptOff || !isSafePoint(old_context))
+        return;
+    worker->nPreemptions++;
+    traceInstant("preempt", worker->current);
+    enterScheduler(worker->current);
+}
+
+/**
+    \brief  Функция запрещает вытеснять текущую корутину до парного
+            вызова coroutinePreemptOn().
+    \note   Нужна вокруг блокировок, которые корутины берут друг у
+            друга: корутина, вытесненная с захваченным мьютексом,
+            заблокировала бы поток следующей корутины, пришедшей за
+            ним же. Ждать чтения внутри такого участка нельзя. Вне
+            корутины функция ничего не делает.
+*/
+void coroutinePreemptOff()
+{
+    struct Worker* worker = getCurrentWorker();
+    if(worker && worker->current != -1)
+        worker->preemptOff++;
+}
+
+/**
+    \brief  Функция снова разрешает вытеснять текущую корутину.
+*/
+void coroutinePreemptOn()
+{
+    struct Worker* worker = getCurrentWorker();
+    if(worker && worker->current != -1)
+        worker->preemptOff--;
+}
+
+/**
+    \brief  Функция усыпляет текущую корутину до тех пор, пока
+            не завершится асинхронная операция.
+    \param  [in]  aiocb  операция, запущенная через aio_read()
+    \note   Пока корутина спит, ее исполнитель отдает время другим
+            корутинам. Если функция вызвана не из корутины, то
+            поток просто ждет в aio_suspend().
+*/
+void coroutineWaitForIo(const struct aiocb* aiocb)
+{
+    struct Worker* worker = getCurrentWorker();
+    if(!worker || worker->current == -1)
+    {
+        while(aio_error(aiocb) == EINPROGRESS)
+            aio_suspend(&aiocb, 1, NULL);
+        return;
+    }
+
+    if(aio_error(aiocb) != EINPROGRESS)
+        return;
+    traceBegin("io wait");
+    sigset_t oldSet;
+    pthread_sigmask(SIG_BLOCK, &set, &oldSet);
+    while(aio_error(aiocb) == EINPROGRESS)
+    {
+        int id = getCurrentWorker()->current;
+        controls[id].state = COROUTINE_WAITING_IO;
+        controls[id].waitingFor = aiocb;
+        enterScheduler(id);
+    }
+    pthread_sigmask(SIG_SETMASK, &oldSet, NULL);
+    traceEnd("io wait");
+}
+
+/**
+    \brief  Функция устанавливает обработчик для таймера
+*/
+static void setup_signals(void)
+{
+    struct sigaction act;
+
+    act.sa_sigaction = timer_interrupt;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = SA_RESTART | SA_SIGINFO;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGALRM);
+
+    if(sigaction(SIGALRM, &act, NULL) != 0)
+        handle_error_rude("Signal handler");
+
+    act.sa_sigaction = segfault_handler;
+    act.sa_flags = SA_ONSTACK | SA_SIGINFO | SA_RESETHAND;
+    if(sigaction(SIGSEGV, &act, NULL) != 0)
+        handle_error_rude("Signal handler");
+}
+
+/**
+    \brief  Функция запускает корутины на пуле потоков и возвращает
+            управление, когда все они завершатся.
+    \param  [in]  nThreads  число потоков-исполнителей, если 0, то
+                            по числу доступных процессоров
+*/
+void runCoroutines(int nThreads)
+{
+    startCoroutines(nThreads);
+    joinCoroutines();
+}
+
+/**
+    \brief  Функция запускает корутины на пуле потоков и сразу
+            возвращает управление.
+    \param  [in]  nThreads  число потоков-исполнителей, если 0, то
+                            по числу доступных процессоров
+    \note   Корутины изначально раздаются исполнителям по кругу.
+            Потоки создаются с заблокированным SIGALRM: сигнал
+            разблокирован только пока исполняется корутина. Каждому
+            вызову должен соответствовать joinCoroutines().
+*/
+void startCoroutines(int nThreads)
+{
+    if(nContexts == 0)
+        return;
+    if(nThreads <= 0)
+        nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(nThreads > nContexts)
+        nThreads = nContexts;
+    if(nThreads <= 0)
+        nThreads = 1;
+    setup_signals();
+
+    nWorkers = nThreads;
+    atomic_store(&nFinished, 0);
+    workers = (struct Worker*)calloc(nWorkers, sizeof(struct Worker));
+    Assert_memory_allocator(workers);
+    for(int i = 0; i < nWorkers; i++)
+    {
+        workers[i].id = i;
+        workers[i].current = -1;
+        runQueueInit(&workers[i].queue);
+        workers[i].waiting = (int*)calloc(nContexts, sizeof(int));
+        Assert_memory_allocator(workers[i].waiting);
+        workers[i].pendingIo = (const struct aiocb**)calloc(nContexts, sizeof(struct aiocb*));
+        Assert_memory_allocator(workers[i].pendingIo);
+    }
+    peakStacksInUse = 0;
+    clock_gettime(CLOCK_MONOTONIC, &runStart);
+    for(int i = 0; i < nContexts; i++)
+    {
+        controls[i].lastWorker = i % nWorkers;
+        controls[i].parkedAt = monotonicNs();
+        runQueuePush(&workers[i % nWorkers], i);
+    }
+
+    sigset_t oldSet;
+    pthread_sigmask(SIG_BLOCK, &set, &oldSet);
+    for(int i = 0; i < nWorkers; i++)
+        if(pthread_create(&workers[i].thread, NULL, scheduler, &workers[i]))
+            handle_error_rude("pthread_create");
+    pthread_sigmask(SIG_SETMASK, &oldSet, NULL);
+}
+
+/**
+    \brief  Функция дожидается завершения всех корутин, запущенных
+            startCoroutines(), и собирает статистику исполнителей.
+*/
+void joinCoroutines()
+{
+    if(!workers)
+        return;
+    for(int i = 0; i < nWorkers; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    memset(&runtimeInfo, 0, sizeof(runtimeInfo));
+    runtimeInfo.nWorkers = nWorkers;
+    runtimeInfo.peakStacks = peakStacksInUse;
+    runtimeInfo.policy = policy;
+    for(int i = 0; i < nWorkers; i++)
+    {
+        runtimeInfo.workerCpuTime += workers[i].cpuTime;
+        runtimeInfo.coroutineCpuTime += workers[i].coroutineTime;
+        runtimeInfo.nTicks += workers[i].nTicks;
+        runtimeInfo.nPreemptions += workers[i].nPreemptions;
+    }
+    runtimeInfo.firstResultTime = contextTimeInfo[0].finishTime;
+    for(int i = 0; i < nContexts; i++)
+    {
+        if(contextTimeInfo[i].finishTime < runtimeInfo.firstResultTime)
+            runtimeInfo.firstResultTime = contextTimeInfo[i].finishTime;
+        if(contextTimeInfo[i].finishTime > runtimeInfo.makespan)
+            runtimeInfo.makespan = contextTimeInfo[i].finishTime;
+    }
+
+    for(int i = 0; i < nWorkers; i++)
+    {
+        runQueueDestroy(&workers[i].queue);
+        free(workers[i].waiting);
+        free(workers[i].pendingIo);
+    }
+    free(workers);
+    workers = NULL;
+}
+
+/**
+    \brief  Функция возвращает статистику исполнителей за последний
+            вызов runCoroutines().
+*/
+const struct RuntimeInfo* getRuntimeInfo()
+{
+    return &runtimeInfo;
+}
+
+/**
+    \brief  Функция возвращает номер исполняемой корутины или -1,
+            если ее вызвали не из корутины.
+*/
+int getCurrentCoroutine()
+{
+    struct Worker* worker = getCurrentWorker();
+    return worker ? worker->current : -1;
+}
+
+
+
+//==================================================================================================
+
+//                               синхронизация корутин и потоков
+
+//==================================================================================================
+
+
+static void futexWait(atomic_int* address, int expected)
+{
+    syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futexWakeAll(atomic_int* address)
+{
+    syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static void waitQueueInit(struct CoroutineWaitQueue* queue)
+{
+    queue->head = -1;
+    queue->tail = -1;
+}
+
+static void waitQueuePush(struct CoroutineWaitQueue* queue, int id)
+{
+    controls[id].nextWaiter = -1;
+    if(queue->tail == -1)
+        queue->head = id;
+    else
+        controls[queue->tail].nextWaiter = id;
+    queue->tail = id;
+}
+
+static int waitQueuePop(struct CoroutineWaitQueue* queue)
+{
+    int id = queue->head;
+    if(id == -1)
+        return -1;
+    queue->head = controls[id].nextWaiter;
+    if(queue->head == -1)
+        queue->tail = -1;
+    return id;
+}
+
+/**
+    \brief  Функция проверяет, исполняется ли вызывающий код в корутине.
+*/
+static bool isInCoroutine()
+{
+    struct Worker* worker = getCurrentWorker();
+    return worker && worker->current != -1;
+}
+
+/**
+    \brief  Функция возвращает уснувшую корутину в очередь исполнителя,
+            на котором она работала последней.
+    \note   Вызывается после того, как корутину достали из очереди
+            ожидания, и не под блокировкой объекта.
+*/
+static void wakeUpParked(int id)
+{
+    controls[id].parkedAt = monotonicNs();
+    controls[id].state = COROUTINE_RUNNABLE;
+    runQueuePush(&workers[controls[id].lastWorker], id);
+    wakeUpIdleWorker();
+}
+
+/**
+    \brief  Функция усыпляет текущую корутину на объекте.
+    \param  [in]  commit  вызывается планировщиком после сохранения
+                          контекста; возвращает true, если корутина
+                          поставлена в очередь ожидания объекта, и false,
+                          если ждать уже не нужно
+    \note   После пробуждения условие нужно проверить заново: пока
+            корутина стояла в очереди исполнителя, его могли изменить.
+*/
+static void parkCurrent(bool (*commit)(int id, void* object), void* object)
+{
+    sigset_t oldSet;
+    pthread_sigmask(SIG_BLOCK, &set, &oldSet);
+    int id = getCurrentWorker()->current;
+    controls[id].parkCommit = commit;
+    controls[id].parkObject = object;
+    controls[id].state = COROUTINE_PARKED;
+    enterScheduler(id);
+    pthread_sigmask(SIG_SETMASK, &oldSet, NULL);
+}
+
+
+/**
+    \brief  Функция готовит WaitGroup с count незавершенными задачами.
+*/
+void waitGroupInit(struct WaitGroup* group, int count)
+{
+    pthread_mutex_init(&group->lock, NULL);
+    atomic_init(&group->count, count);
+    waitQueueInit(&group->waiters);
+}
+
+/**
+    \brief  Функция меняет число незавершенных задач на delta.
+    \note   Когда счетчик обнуляется, просыпаются все ждущие.
+*/
+void waitGroupAdd(struct WaitGroup* group, int delta)
+{
+    if(atomic_fetch_add(&group->count, delta) + delta != 0)
+        return;
+    coroutinePreemptOff();
+    pthread_mutex_lock(&group->lock);
+    struct CoroutineWaitQueue waiters = group->waiters;
+    waitQueueInit(&group->waiters);
+    pthread_mutex_unlock(&group->lock);
+    int id;
+    while((id = waitQueuePop(&waiters)) != -1)
+        wakeUpParked(id);
+    coroutinePreemptOn();
+    futexWakeAll(&group->count);
+}
+
+/**
+    \brief  Функция отмечает, что одна задача завершилась.
+*/
+void waitGroupDone(struct WaitGroup* group)
+{
+    waitGroupAdd(group, -1);
+}
+
+static bool waitGroupCommit(int id, void* object)
+{
+    struct WaitGroup* group = (struct WaitGroup*)object;
+    pthread_mutex_lock(&group->lock);
+    bool isWaiting = atomic_load(&group->count) != 0;
+    if(isWaiting)
+        waitQueuePush(&group->waiters, id);
+    pthread_mutex_unlock(&group->lock);
+    return isWaiting;
+}
+
+/**
+    \brief  Функция ждет, пока счетчик WaitGroup не обнулится.
+    \note   Поток спит на futex, корутина отдает исполнителя другим.
+*/
+void waitGroupWait(struct WaitGroup* group)
+{
+    int count;
+    while((count = atomic_load(&group->count)) != 0)
+    {
+        if(isInCoroutine())
+            parkCurrent(waitGroupCommit, group);
+        else
+            futexWait(&group->count, count);
+    }
+}
+
+void waitGroupDestroy(struct WaitGroup* group)
+{
+    pthread_mutex_destroy(&group->lock);
+}
+
+
+/**
+    \brief  Функция готовит канал на capacity элементов по elementSize байт.
+    \return true в случае успеха, false иначе.
+*/
+bool channelInit(struct Channel* channel, size_t elementSize, size_t capacity)
+{
+    memset(channel, 0, sizeof(struct Channel));
+    if(!elementSize || !capacity)
+        return false;
+    channel->buffer = (char*)malloc(elementSize * capacity);
+    if(!channel->buffer)
+        return false;
+    pthread_mutex_init(&channel->lock, NULL);
+    channel->elementSize = elementSize;
+    channel->capacity = capacity;
+    atomic_init(&channel->version, 0);
+    atomic_init(&channel->nSleepingThreads, 0);
+    waitQueueInit(&channel->senders);
+    waitQueueInit(&channel->receivers);
+    return true;
+}
+
+/**
+    \brief  Функция будит после изменения канала по одной корутине из
+            queue и все ждущие потоки.
+    \param  [in]  id  корутина, которую вернула waitQueuePop(), или -1
+*/
+static void channelWakeUp(struct Channel* channel, int id)
+{
+    if(id != -1)
+        wakeUpParked(id);
+    if(atomic_load(&channel->nSleepingThreads))
+        futexWakeAll(&channel->version);
+}
+
+/**
+    \brief  Функция усыпляет на канале вызывающий поток или корутину.
+    \param  [in]  commit  проверка для корутины, см. parkCurrent()
+    \note   Вызывается под блокировкой канала и снимает ее. Поток
+            засыпает, только если версия канала не изменилась с тех
+            пор, как он проверил условие.
+*/
+static void channelWait(struct Channel* channel, bool (*commit)(int id, void* object))
+{
+    if(isInCoroutine())
+    {
+        pthread_mutex_unlock(&channel->lock);
+        coroutinePreemptOn();
+        parkCurrent(commit, channel);
+        return;
+    }
+    int version = atomic_load(&channel->version);
+    atomic_fetch_add(&channel->nSleepingThreads, 1);
+    pthread_mutex_unlock(&channel->lock);
+    futexWait(&channel->version, version);
+    atomic_fetch_sub(&channel->nSleepingThreads, 1);
+}
+
+static bool channelSendCommit(int id, void* object)
+{
+    struct Channel* channel = (struct Channel*)object;
+    pthread_mutex_lock(&channel->lock);
+    bool isWaiting = channel->size == channel->capacity && !channel->isClosed;
+    if(isWaiting)
+        waitQueuePush(&channel->senders, id);
+    pthread_mutex_unlock(&channel->lock);
+    return isWaiting;
+}
+
+static bool channelReceiveCommit(int id, void* object)
+{
+    struct Channel* channel = (struct Channel*)object;
+    pthread_mutex_lock(&channel->lock);
+    bool isWaiting = channel->size == 0 && !channel->isClosed;
+    if(isWaiting)
+        waitQueuePush(&channel->receivers, id);
+    pthread_mutex_unlock(&channel->lock);
+    return isWaiting;
+}
+
+/**
+    \brief  Функция кладет в канал копию element.
+    \return true в случае успеха, false, если канал закрыт.
+    \note   Если канал полон, то вызывающий ждет, пока место не
+            освободится.
+*/
+bool channelSend(struct Channel* channel, const void* element)
+{
+    for(;;)
+    {
+        coroutinePreemptOff();
+        pthread_mutex_lock(&channel->lock);
+        if(channel->isClosed || channel->size < channel->capacity)
+        {
+            bool isSent = !channel->isClosed;
+            int receiver = -1;
+            if(isSent)
+            {
+                size_t tail = (channel->head + channel->size) % channel->capacity;
+                memcpy(channel->buffer + tail * channel->elementSize, element, channel->elementSize);
+                channel->size++;
+                atomic_fetch_add(&channel->version, 1);
+                receiver = waitQueuePop(&channel->receivers);
+            }
+            pthread_mutex_unlock(&channel->lock);
+            if(isSent)
+                channelWakeUp(channel, receiver);
+            coroutinePreemptOn();
+            return isSent;
+        }
+        channelWait(channel, channelSendCommit);
+    }
+}
+
+/**
+    \brief  Функция достает из канала самый старый элемент в element.
+    \return true в случае успеха, false, если канал закрыт и пуст.
+    \note   Если канал пуст, то вызывающий ждет, пока в нем что-нибудь
+            не появится или пока его не закроют.
+*/
+bool channelReceive(struct Channel* channel, void* element)
+{
+    for(;;)
+    {
+        coroutinePreemptOff();
+        pthread_mutex_lock(&channel->lock);
+        if(channel->isClosed || channel->size)
+        {
+            bool isReceived = channel->size != 0;
+            int sender = -1;
+            if(isReceived)
+            {
+                memcpy(element, channel->buffer + channel->head * channel->elementSize, channel->elementSize);
+                channel->head = (channel->head + 1) % channel->capacity;
+                channel->size--;
+                atomic_fetch_add(&channel->version, 1);
+                sender = waitQueuePop(&channel->senders);
+            }
+            pthread_mutex_unlock(&channel->lock);
+            if(isReceived)
+                channelWakeUp(channel, sender);
+            coroutinePreemptOn();
+            return isReceived;
+        }
+        channelWait(channel, channelReceiveCommit);
+    }
+}
+
+/**
+    \brief  Функция закрывает канал: отправка после этого не удается, а
+            прием возвращает оставшиеся элементы, после чего тоже не
+            удается. Просыпаются все ждущие.
+*/
+void channelClose(struct Channel* channel)
+{
+    coroutinePreemptOff();
+    pthread_mutex_lock(&channel->lock);
+    channel->isClosed = true;
+    atomic_fetch_add(&channel->version, 1);
+    struct CoroutineWaitQueue senders = channel->senders;
+    struct CoroutineWaitQueue receivers = channel->receivers;
+    waitQueueInit(&channel->senders);
+    waitQueueInit(&channel->receivers);
+    pthread_mutex_unlock(&channel->lock);
+    int id;
+    while((id = waitQueuePop(&senders)) != -1)
+        wakeUpParked(id);
+    while((id = waitQueuePop(&receivers)) != -1)
+        wakeUpParked(id);
+    coroutinePreemptOn();
+    futexWakeAll(&channel->version);
+}
+
+void channelDestroy(struct Channel* channel)
+{
+    pthread_mutex_destroy(&channel->lock);
+    free(channel->buffer);
+    channel->buffer = NULL;
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <aio.h>
+
+/// число корзин гистограммы длин квантов: <1 мкс, [1, 2), [2, 4), ... мкс, последняя не ограничена сверху
+#define SLICE_HISTOGRAM_BUCKETS 16
+
+struct SchedulerInfo
+{
+    size_t swapTimes;
+    size_t totalWakingTime;
+    size_t migrations;
+    size_t finishTime;          ///< когда корутина завершилась, мкс от начала runCoroutines()
+    size_t stackHighWater;      ///< наибольшая глубина стека корутины в байтах
+    size_t ioWaitTime;          ///< сколько корутина ждала чтения, мкс реального времени
+    size_t queueWaitTime;       ///< сколько готовая корутина простояла в очереди, мкс
+    size_t switchLatency;       ///< суммарная задержка переключений на корутину и с нее, нс
+    size_t nSwitches;           ///< сколько переключений вошло в switchLatency
+    size_t sliceHistogram[SLICE_HISTOGRAM_BUCKETS]; ///< процессорное время одного запуска корутины
+};
+
+/// порядок, в котором исполнитель берет корутины из своей очереди
+enum SchedulingPolicy
+{
+    SCHEDULE_ROUND_ROBIN,       ///< по очереди
+    SCHEDULE_SHORTEST_FIRST,    ///< сначала корутины с наименьшим объемом работы
+    SCHEDULE_LEAST_TIME,        ///< сначала корутины, которые меньше всех проработали
+    SCHEDULE_PRIORITY           ///< по статическому приоритету, меньшее значение раньше
+};
+
+/// статистика исполнителей за последний runCoroutines()
+struct RuntimeInfo
+{
+    int nWorkers;
+    size_t workerCpuTime;       ///< процессорное время всех исполнителей, мкс
+    size_t coroutineCpuTime;    ///< из него на исполнение корутин, мкс
+    size_t nTicks;              ///< сколько тиков таймера пришло
+    size_t nPreemptions;        ///< сколько раз корутины вытеснены по истечении кванта
+    size_t firstResultTime;     ///< когда завершилась первая корутина, мкс
+    size_t makespan;            ///< когда завершилась последняя корутина, мкс
+    int peakStacks;             ///< наибольшее число одновременно выданных стеков
+    enum SchedulingPolicy policy;
+};
+
+typedef void (*CoroutineFunction)(int id, void* arg);
+
+/// корутины, уснувшие на объекте синхронизации; связаны через свои управляющие блоки
+struct CoroutineWaitQueue
+{
+    int head;
+    int tail;
+};
+
+/**
+    Счетчик незавершенных задач. Ждать его обнуления можно и из
+    корутины, и из обычного потока: корутина уступает исполнителя
+    другим, а поток спит на futex и не тратит процессор.
+*/
+struct WaitGroup
+{
+    pthread_mutex_t lock;
+    atomic_int count;
+    struct CoroutineWaitQueue waiters;
+};
+
+/**
+    Ограниченная очередь элементов фиксированного размера для передачи
+    результатов между корутинами и потоками. Отправка в полный канал и
+    прием из пустого усыпляют вызывающего так же, как WaitGroup.
+*/
+struct Channel
+{
+    pthread_mutex_t lock;
+    char* buffer;
+    size_t elementSize;
+    size_t capacity;
+    size_t head;
+    size_t size;
+    bool isClosed;
+    atomic_int version;                 ///< растет при каждом изменении, на нем спят потоки
+    atomic_int nSleepingThreads;        ///< будить потоки нужно, только если они есть
+    struct CoroutineWaitQueue senders;
+    struct CoroutineWaitQueue receivers;
+};
+
+void allocateMemoryForCoroutine(int nCount);
+void createCoroutine(int id, CoroutineFunction function, void* arg);
+void setCoroutineHints(int id, size_t workSize, int priority);
+void setSchedulingPolicy(enum SchedulingPolicy policy);
+bool parseSchedulingPolicy(const char* name, enum SchedulingPolicy* policy);
+const char* schedulingPolicyName(enum SchedulingPolicy policy);
+void runCoroutines(int nThreads);
+void startCoroutines(int nThreads);
+void joinCoroutines();
+void cleanMemoryForCoroutine(int nCount);
+const struct SchedulerInfo* getSchedulerInfo(int id);
+void coroutineWaitForIo(const struct aiocb* aiocb);
+void coroutinePreemptOff();
+void coroutinePreemptOn();
+const struct RuntimeInfo* getRuntimeInfo();
+int getCurrentCoroutine();
+
+void waitGroupInit(struct WaitGroup* group, int count);
+void waitGroupAdd(struct WaitGroup* group, int delta);
+void waitGroupDone(struct WaitGroup* group);
+void waitGroupWait(struct WaitGroup* group);
+void waitGroupDestroy(struct WaitGroup* group);
+
+bool channelInit(struct Channel* channel, size_t elementSize, size_t capacity);
+bool channelSend(struct Channel* channel, const void* element);
+bool channelReceive(struct Channel* channel, void* element);
+void channelClose(struct Channel* channel);
+void channelDestroy(struct Channel* channel);
@@ -0,0 +1,758 @@
+#include "External.h"
+#include "StrLib.h"
+#include "IntParser.h"
+#include "Merge.h"
+#include "Sort.h"
+#include "Coroutine.h"
+#include "RunFile.h"
+#include "Trace.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <aio.h>
+#include <time.h>
+#include <pthread.h>
+
+#define KB * 1024
+
+// размер блока, которым читаются и пишутся временные серии
+#define RUN_BLOCK_SIZE 256 KB
+// больше серий за раз не сливаем, чтобы не упереться в лимит дескрипторов
+#define MAX_FAN_IN 512
+// меньше памяти на одну корутину не выделяем, даже если бюджет мал
+#define MIN_PRODUCER_BUDGET 64 KB
+
+/*
+    Внешняя сортировка для входов, которые не помещаются в память.
+
+    Фаза 1 (корутины). Каждая корутина потоково читает свой диапазон
+    файла и разбирает числа в одну из двух половин своей доли бюджета.
+    Заполненная половина сортируется и целиком отдается aio_write()
+    во временный файл, а разбор тем временем продолжается во вторую
+    половину. Пока запись не завершилась, корутина, которой нужна
+    занятая половина, спит в coroutineWaitForIo() и отдает процессор
+    остальным корутинам.
+
+    Фаза 2. Серии сливаются деревом проигравших по fanIn штук за раз,
+    пока их не останется не больше fanIn; последний проход пишет
+    сразу в выходной текстовый файл. Каждая серия читается блоками
+    RUN_BLOCK_SIZE: пока дерево разбирает один блок, следующий уже
+    читается во второй буфер.
+
+    Серии хранятся как сырые массивы int в порядке байт машины.
+*/
+
+/// временный файл с отсортированной серией
+struct RunInfo
+{
+    char* path;
+    size_t count;
+};
+
+static struct SortConfig config;
+static size_t producerBudget = 0;
+
+static pthread_mutex_t runsLock = PTHREAD_MUTEX_INITIALIZER;
+static struct RunInfo* runs = NULL;
+static size_t nRuns = 0;
+static size_t runsCapacity = 0;
+
+static struct ExternalSortInfo info;
+
+
+//==================================================================================================
+
+//                               запись и чтение временных серий
+
+//==================================================================================================
+
+
+/// запись серии через aio_write(), пока идет запись, вызывающий может работать дальше
+struct RunWriter
+{
+    int fd;
+    off_t offset;
+    bool inFlight;
+    bool isFailed;
+    struct aiocb aiocb;
+    struct RunInfo run;
+};
+
+/**
+    \brief  Функция дожидается завершения записи, начатой runWriterSubmit().
+    \note   Если aio_write() записал не все, то остаток дописывается
+            следующим запросом.
+*/
+static void runWriterWait(struct RunWriter* writer)
+{
+    while(writer->inFlight)
+    {
+        coroutineWaitForIo(&writer->aiocb);
+        ssize_t nWritten = aio_return(&writer->aiocb);
+        writer->inFlight = false;
+        if(nWritten <= 0)
+        {
+            writer->isFailed = true;
+            return;
+        }
+        writer->offset += nWritten;
+        if((size_t)nWritten == writer->aiocb.aio_nbytes)
+            return;
+        writer->aiocb.aio_buf = (char*)writer->aiocb.aio_buf + nWritten;
+        writer->aiocb.aio_nbytes -= nWritten;
+        writer->aiocb.aio_offset = writer->offset;
+        if(aio_write(&writer->aiocb) == -1)
+        {
+            writer->isFailed = true;
+            return;
+        }
+        writer->inFlight = true;
+    }
+}
+
+/**
+    \brief  Функция создает временный файл для новой серии.
+    \return В случае успеха возвращается 0, иначе константа -1.
+*/
+static int runWriterOpen(struct RunWriter* writer)
+{
+    memset(writer, 0, sizeof(struct RunWriter));
+    size_t length = strlen(config.tempDir) + sizeof("/sorter-run-XXXXXX");
+    writer->run.path = (char*)malloc(length);
+    if(!writer->run.path)
+        return STANDART_ERROR_CODE;
+    snprintf(writer->run.path, length, "%s/sorter-run-XXXXXX", config.tempDir);
+    writer->fd = mkstemp(writer->run.path);
+    if(writer->fd == -1)
+    {
+        printf("Error: cant create temporary file in `%s`\n", config.tempDir);
+        free(writer->run.path);
+        writer->run.path = NULL;
+        return STANDART_ERROR_CODE;
+    }
+    return 0;
+}
+
+/**
+    \brief  Функция начинает запись count чисел в конец серии.
+    \note   Массив data должен жить до следующего вызова
+            runWriterSubmit() или runWriterClose().
+*/
+static void runWriterSubmit(struct RunWriter* writer, const int* data, size_t count)
+{
+    runWriterWait(writer);
+    if(writer->isFailed || !count)
+        return;
+    memset(&writer->aiocb, 0, sizeof(struct aiocb));
+    writer->aiocb.aio_fildes = writer->fd;
+    writer->aiocb.aio_buf = (void*)data;
+    writer->aiocb.aio_nbytes = count * sizeof(int);
+    writer->aiocb.aio_offset = writer->offset;
+    if(aio_write(&writer->aiocb) == -1)
+    {
+        writer->isFailed = true;
+        return;
+    }
+    writer->inFlight = true;
+    writer->run.count += count;
+}
+
+/**
+    \brief  Функция дожидается записи, закрывает файл и регистрирует
+            серию для слияния.
+    \return В случае успеха возвращается 0, иначе константа -1.
+*/
+static int runWriterClose(struct RunWriter* writer)
+{
+    runWriterWait(writer);
+    if(close(writer->fd) == -1)
+        writer->isFailed = true;
+    if(writer->isFailed)
+    {
+        printf("Error: cant write temporary file `%s`\n", writer->run.path);
+        unlink(writer->run.path);
+        free(writer->run.path);
+        return STANDART_ERROR_CODE;
+    }
+
+    coroutinePreemptOff();
+    pthread_mutex_lock(&runsLock);
+    if(nRuns == runsCapacity)
+    {
+        size_t capacity = runsCapacity ? 2 * runsCapacity : 64;
+        struct RunInfo* grown = (struct RunInfo*)realloc(runs, capacity * sizeof(struct RunInfo));
+        if(!grown)
+        {
+            pthread_mutex_unlock(&runsLock);
+            coroutinePreemptOn();
+            unlink(writer->run.path);
+            free(writer->run.path);
+            return STANDART_ERROR_CODE;
+        }
+        runs = grown;
+        runsCapacity = capacity;
+    }
+    runs[nRuns++] = writer->run;
+    info.spilledBytes += writer->offset;
+    pthread_mutex_unlock(&runsLock);
+    coroutinePreemptOn();
+    return 0;
+}
+
+
+/// чтение серии блоками: пока один блок разбирается, следующий читается
+struct RunReader
+{
+    int fd;
+    off_t offset;
+    size_t blockInts;
+    int* blocks[2];
+    int reading;        ///< номер блока, в который идет чтение
+    struct aiocb aiocb;
+};
+
+static void runReaderSubmit(struct RunReader* reader)
+{
+    memset(&reader->aiocb, 0, sizeof(struct aiocb));
+    reader->aiocb.aio_fildes = reader->fd;
+    reader->aiocb.aio_buf = reader->blocks[reader->reading];
+    reader->aiocb.aio_nbytes = reader->blockInts * sizeof(int);
+    reader->aiocb.aio_offset = reader->offset;
+    if(aio_read(&reader->aiocb) == -1)
+        reader->aiocb.aio_buf = NULL;
+}
+
+static int runReaderOpen(struct RunReader* reader, const struct RunInfo* run, size_t blockInts)
+{
+    memset(reader, 0, sizeof(struct RunReader));
+    reader->fd = open(run->path, O_RDONLY);
+    if(reader->fd == -1)
+        return STANDART_ERROR_CODE;
+    reader->blockInts = blockInts;
+    reader->blocks[0] = (int*)malloc(blockInts * sizeof(int));
+    reader->blocks[1] = (int*)malloc(blockInts * sizeof(int));
+    if(!reader->blocks[0] || !reader->blocks[1])
+    {
+        free(reader->blocks[0]);
+        free(reader->blocks[1]);
+        close(reader->fd);
+        return STANDART_ERROR_CODE;
+    }
+    runReaderSubmit(reader);
+    return 0;
+}
+
+/**
+    \brief  Функция дожидается очередного блока серии и запускает
+            чтение следующего во второй буфер.
+    \return false, если серия закончилась или чтение не удалось.
+*/
+static bool runReaderNext(struct RunReader* reader, const int** begin, const int** end)
+{
+    if(!reader->aiocb.aio_buf)
+        return false;
+    coroutineWaitForIo(&reader->aiocb);
+    ssize_t nRead = aio_return(&reader->aiocb);
+    reader->aiocb.aio_buf = NULL;
+    if(nRead <= 0)
+        return false;
+    //дочитываем, если чтение оборвалось посреди числа
+    char* block = (char*)reader->blocks[reader->reading];
+    while(nRead % sizeof(int))
+    {
+        ssize_t nMore = pread(reader->fd, block + nRead, sizeof(int) - nRead % sizeof(int), reader->offset + nRead);
+        if(nMore <= 0)
+            return false;
+        nRead += nMore;
+    }
+    reader->offset += nRead;
+    *begin = (const int*)block;
+    *end = (const int*)(block + nRead);
+    reader->reading ^= 1;
+    runReaderSubmit(reader);
+    return true;
+}
+
+static void runReaderClose(struct RunReader* reader)
+{
+    if(reader->aiocb.aio_buf)
+    {
+        coroutineWaitForIo(&reader->aiocb);
+        aio_return(&reader->aiocb);
+    }
+    close(reader->fd);
+    free(reader->blocks[0]);
+    free(reader->blocks[1]);
+}
+
+//==================================================================================================
+//==================================================================================================
+
+
+
+
+
+
+//==================================================================================================
+
+//                               фаза 1: нарезка входа на отсортированные серии
+
+//==================================================================================================
+
+
+/**
+    \brief  Функция подготавливает внешнюю сортировку.
+    \param  [in]  sortConfig  параметры, в том числе бюджет памяти
+                              и каталог временных файлов
+    \param  [in]  nProducers  число корутин, которые одновременно
+                              будут нарезать серии
+    \return true в случае успеха, false иначе.
+    \note   Бюджет делится поровну между корутинами: все они могут
+            держать свои буферы одновременно, потому что вытесняются
+            посреди работы.
+*/
+bool externalSortBegin(const struct SortConfig* sortConfig, int nProducers)
+{
+    if(!sortConfig || !sortConfig->memoryBudget || nProducers <= 0)
+        return false;
+    config = *sortConfig;
+    if(!config.tempDir)
+        config.tempDir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    producerBudget = config.memoryBudget / nProducers;
+    if(producerBudget < MIN_PRODUCER_BUDGET)
+        producerBudget = MIN_PRODUCER_BUDGET;
+    memset(&info, 0, sizeof(info));
+    return true;
+}
+
+/**
+    \brief  Функция сортирует и сбрасывает на диск заполненную половину,
+            сразу начиная ее запись.
+    \param  [in,out]  spill  запись предыдущей серии, будет заменена
+                             записью новой
+    \param  [in,out]  stats  сюда добавляется время сортировки и
+                             записывается план сортировки серии
+    \note   Перед этим дожидается записи предыдущей серии, то есть
+            освобождения второй половины буфера.
+*/
+static bool spillRun(int* array, size_t size, struct RunWriter* spill, bool* hasSpill, struct Array* stats)
+{
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    traceBegin("sort");
+    sortIntegersPlanned(array, size, config.algorithm, &stats->plan);
+    traceEnd("sort");
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    stats->sortTime += (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9;
+    if(*hasSpill && runWriterClose(spill) == STANDART_ERROR_CODE)
+    {
+        *hasSpill = false;
+        return false;
+    }
+    *hasSpill = false;
+    if(runWriterOpen(spill) == STANDART_ERROR_CODE)
+        return false;
+    *hasSpill = true;
+    runWriterSubmit(spill, array, size);
+    return true;
+}
+
+/**
+    \brief  Функция нарезает двоичный файл серий на отсортированные
+            серии во временных файлах, распаковывая его по блокам.
+    \param  [in]   filename      имя файла
+    \param  [in]   halves        две половины буфера по halfCapacity чисел
+    \param  [out]  stats         сюда записываются число прочитанных
+                                 чисел и время разбора и сортировки
+    \return true в случае успеха, false иначе.
+    \note   Уже отсортированный файл тоже сортируется по сериям:
+            фаза 2 сливает их, не различая происхождение.
+*/
+static bool externalSortRunFile(const char* filename, int** halves, size_t halfCapacity, struct Array* stats)
+{
+    struct RunFile file;
+    if(runFileOpen(filename, &file) == STANDART_ERROR_CODE)
+        return false;
+    size_t blockValues = 0;
+    uint64_t nBlocks = runFileBlocks(&file, &blockValues);
+    if(blockValues > halfCapacity)
+    {
+        printf("Error: memory budget is too small for blocks of `%s`\n", filename);
+        runFileClose(&file);
+        return false;
+    }
+
+    int active = 0;
+    size_t size = 0;
+    struct RunWriter spill;
+    bool hasSpill = false;
+    bool isOk = true;
+    for(uint64_t block = 0; isOk && block < nBlocks; block++)
+    {
+        if(size + blockValues > halfCapacity)
+        {
+            isOk = spillRun(halves[active], size, &spill, &hasSpill, stats);
+            active ^= 1;
+            size = 0;
+        }
+        struct timespec start, stop;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        traceBegin("parse");
+        size_t nDecoded = runFileDecodeBlock(&file, block, halves[active] + size);
+        traceEnd("parse");
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        stats->parseTime += (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9;
+        if(!nDecoded)
+        {
+            printf("Error: binary run file `%s` is truncated\n", filename);
+            isOk = false;
+            break;
+        }
+        size += nDecoded;
+        stats->size += nDecoded;
+    }
+    if(isOk && stats->size != file.count)
+    {
+        printf("Error: binary run file `%s` is truncated\n", filename);
+        isOk = false;
+    }
+    if(isOk && size)
+        isOk = spillRun(halves[active], size, &spill, &hasSpill, stats);
+    if(hasSpill && runWriterClose(&spill) == STANDART_ERROR_CODE)
+        isOk = false;
+    stats->parsedBytes = file.mapSize;
+    runFileClose(&file);
+    return isOk;
+}
+
+/**
+    \brief  Функция выполняется на корутинах: нарезает диапазон файла
+            на отсортированные серии во временных файлах.
+    \param  [in]   filename  имя файла
+    \param  [in]   range     диапазон файла
+    \param  [out]  stats     сюда записываются число прочитанных чисел
+                             и время разбора и сортировки, data остается NULL
+    \return true в случае успеха, false иначе.
+    \note   Двоичный файл серий, как и в sortArrayFromFileRange(),
+            распознается по заголовку и читается целиком одним диапазоном.
+*/
+bool externalSortRange(const char* filename, const struct FileRange* range, struct Array* stats)
+{
+    memset(stats, 0, sizeof(struct Array));
+    size_t chunkSize = producerBudget / 8;
+    if(chunkSize > config.chunkSize)
+        chunkSize = config.chunkSize;
+    size_t halfCapacity = (producerBudget - 2 * chunkSize) / 2 / sizeof(int);
+
+    if(range->offset == 0 && isRunFile(filename))
+    {
+        int* halves[2] = {(int*)malloc(halfCapacity * sizeof(int)), (int*)malloc(halfCapacity * sizeof(int))};
+        bool isOk = halves[0] && halves[1];
+        if(!isOk)
+            printf("Error: Cant allocate memory for array of integers!\n");
+        else
+            isOk = externalSortRunFile(filename, halves, halfCapacity, stats);
+        free(halves[0]);
+        free(halves[1]);
+        return isOk;
+    }
+
+    struct ChunkReader reader;
+    if(chunkReaderOpenRange(&reader, filename, chunkSize, range->offset, range->length) == STANDART_ERROR_CODE)
+    {
+        printf("Error: cant read file!\n");
+        return false;
+    }
+    int* halves[2] = {(int*)malloc(halfCapacity * sizeof(int)), (int*)malloc(halfCapacity * sizeof(int))};
+    int active = 0;
+    size_t size = 0;
+    struct RunWriter spill;
+    bool hasSpill = false;
+
+    const char* tail = NULL;
+    size_t tailLen = 0;
+    bool isOk = halves[0] && halves[1];
+    if(!isOk)
+        printf("Error: Cant allocate memory for array of integers!\n");
+    while(isOk)
+    {
+        char* chunk = NULL;
+        traceBegin("read");
+        long len = chunkReaderNext(&reader, &chunk, tail, tailLen);
+        traceEnd("read");
+        if(len == STANDART_ERROR_CODE)
+        {
+            printf("Error: cant read file!\n");
+            isOk = false;
+            break;
+        }
+        bool isLast = len == 0;
+        if(isLast)
+        {
+            chunk = (char*)tail;
+            len = tailLen;
+        }
+
+        if(size && size + intParserCapacity(len) > halfCapacity)
+        {
+            isOk = spillRun(halves[active], size, &spill, &hasSpill, stats);
+            active ^= 1;
+            size = 0;
+        }
+
+        struct timespec start, stop;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        traceBegin("parse");
+        size_t nParsed = isLast ?
+            parseIntegers(chunk, chunk + len, halves[active] + size) :
+            parseIntegersChunk(chunk, chunk + len, halves[active] + size, &tail);
+        traceEnd("parse");
+        size += nParsed;
+        stats->size += nParsed;
+        tailLen = isLast ? 0 : (size_t)(chunk + len - tail);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        stats->parseTime += (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9;
+        stats->parsedBytes += len - tailLen;
+
+        if(isLast)
+            break;
+    }
+    if(isOk && size)
+        isOk = spillRun(halves[active], size, &spill, &hasSpill, stats);
+    if(hasSpill && runWriterClose(&spill) == STANDART_ERROR_CODE)
+        isOk = false;
+
+    chunkReaderClose(&reader);
+    free(halves[0]);
+    free(halves[1]);
+    return isOk;
+}
+
+//==================================================================================================
+//==================================================================================================
+
+
+
+
+
+
+//==================================================================================================
+
+//                               фаза 2: многопроходное слияние серий
+
+//==================================================================================================
+
+
+static bool refillFromReader(void* context, size_t run, const int** begin, const int** end)
+{
+    struct RunReader* readers = (struct RunReader*)context;
+    return runReaderNext(&readers[run], begin, end);
+}
+
+/**
+    \brief  Функция сливает серии first[0..count) в новую серию,
+            в текстовый или в двоичный файл.
+    \param  [out]  toRun     если не NULL, то результат пишется в серию
+    \param  [out]  toText    если не NULL, то результат печатается через OutputWriter
+    \param  [out]  toBinary  иначе результат пишется через RunFileWriter
+    \return В случае успеха возвращается 0, иначе константа -1.
+*/
+static int mergeRuns(const struct RunInfo* first, size_t count, struct RunWriter* toRun,
+                     struct OutputWriter* toText, struct RunFileWriter* toBinary)
+{
+    size_t blockInts = RUN_BLOCK_SIZE / sizeof(int);
+    struct RunReader* readers = (struct RunReader*)calloc(count ? count : 1, sizeof(struct RunReader));
+    struct SortedRun* blocks = (struct SortedRun*)calloc(count ? count : 1, sizeof(struct SortedRun));
+    int* output[2] = {NULL, NULL};
+    if(toRun)
+    {
+        output[0] = (int*)malloc(RUN_BLOCK_SIZE);
+        output[1] = (int*)malloc(RUN_BLOCK_SIZE);
+    }
+    size_t nOpened = 0;
+    int ret = readers && blocks && (!toRun || (output[0] && output[1])) ? 0 : STANDART_ERROR_CODE;
+    for(; !ret && nOpened < count; nOpened++)
+    {
+        if(runReaderOpen(&readers[nOpened], &first[nOpened], blockInts) == STANDART_ERROR_CODE)
+        {
+            printf("Error: cant read temporary file `%s`\n", first[nOpened].path);
+            ret = STANDART_ERROR_CODE;
+            break;
+        }
+        const int* begin = NULL;
+        const int* end = NULL;
+        if(runReaderNext(&readers[nOpened], &begin, &end))
+        {
+            blocks[nOpened].data = begin;
+            blocks[nOpened].size = end - begin;
+        }
+    }
+
+    struct LoserTree tree;
+    traceBegin("merge");
+    if(!ret && loserTreeInit(&tree, blocks, count))
+    {
+        loserTreeSetRefill(&tree, refillFromReader, readers);
+        int filling = 0;
+        size_t size = 0;
+        int value;
+        size_t repeat;
+        while((repeat = loserTreePop(&tree, &value)))
+        {
+            if(toText)
+            {
+                writerPutInts(toText, value, repeat);
+                continue;
+            }
+            if(toBinary)
+            {
+                runFileWriterPut(toBinary, value, repeat);
+                continue;
+            }
+            while(repeat--)
+            {
+                output[filling][size++] = value;
+                if(size < blockInts)
+                    continue;
+                runWriterSubmit(toRun, output[filling], size);
+                filling ^= 1;
+                size = 0;
+            }
+        }
+        if(toRun)
+        {
+            runWriterSubmit(toRun, output[filling], size);
+            runWriterWait(toRun);
+        }
+        loserTreeDestroy(&tree);
+    }
+    else
+        ret = STANDART_ERROR_CODE;
+    traceEnd("merge");
+
+    for(size_t i = 0; i < nOpened; i++)
+        runReaderClose(&readers[i]);
+    free(readers);
+    free(blocks);
+    free(output[0]);
+    free(output[1]);
+    return ret;
+}
+
+/**
+    \brief  Функция удаляет временные файлы серий [first, first + count).
+*/
+static void removeRuns(struct RunInfo* first, size_t count)
+{
+    for(size_t i = 0; i < count; i++)
+    {
+        unlink(first[i].path);
+        free(first[i].path);
+    }
+}
+
+/**
+    \brief  Функция сливает все серии и печатает результат в файл.
+    \param  [in]  filename  имя выходного файла
+    \param  [in]  mode      способ записи текстового выходного файла
+    \param  [in]  format    формат выходного файла
+    \return В случае успеха возвращается 0, иначе константа -1.
+    \details За один проход сливается fanIn серий: столько, чтобы их
+             буферы чтения (по два блока RUN_BLOCK_SIZE на серию)
+             поместились в бюджет памяти. Промежуточные проходы пишут
+             новые серии, пока серий не станет не больше fanIn.
+    \note   Все временные файлы удаляются, даже если случилась ошибка.
+*/
+int externalSortFinish(const char* filename, enum WriteMode mode, enum RunFormat format)
+{
+    size_t fanIn = config.memoryBudget / (2 * RUN_BLOCK_SIZE);
+    fanIn = fanIn > 2 ? fanIn - 1 : 2;
+    if(fanIn > MAX_FAN_IN)
+        fanIn = MAX_FAN_IN;
+    info.fanIn = fanIn;
+    info.nSpilledRuns = nRuns;
+
+    int ret = 0;
+    while(!ret && nRuns > fanIn)
+    {
+        //один проход: каждые fanIn серий сливаются в одну
+        size_t nNext = 0;
+        for(size_t first = 0; first < nRuns; first += fanIn)
+        {
+            size_t count = nRuns - first < fanIn ? nRuns - first : fanIn;
+            struct RunWriter merged;
+            if(count == 1)
+            {
+                runs[nNext++] = runs[first];
+                continue;
+            }
+            if(ret || runWriterOpen(&merged) == STANDART_ERROR_CODE)
+            {
+                ret = STANDART_ERROR_CODE;
+                removeRuns(runs + first, count);
+                continue;
+            }
+            ret = mergeRuns(runs + first, count, &merged, NULL, NULL);
+            removeRuns(runs + first, count);
+            if(merged.isFailed)
+                ret = STANDART_ERROR_CODE;
+            if(close(merged.fd) == -1)
+                ret = STANDART_ERROR_CODE;
+            info.spilledBytes += merged.offset;
+            if(ret)
+            {
+                unlink(merged.run.path);
+                free(merged.run.path);
+                continue;
+            }
+            runs[nNext++] = merged.run;
+        }
+        if(ret)
+        {
+            removeRuns(runs, nNext);
+            nNext = 0;
+        }
+        nRuns = nNext;
+        info.nMergePasses++;
+    }
+
+    if(!ret && format == RUN_FORMAT_TEXT)
+    {
+        struct OutputWriter writer;
+        ret = writerOpen(&writer, filename, mode);
+        if(!ret)
+        {
+            ret = mergeRuns(runs, nRuns, NULL, &writer, NULL);
+            if(writerClose(&writer) == STANDART_ERROR_CODE)
+                ret = STANDART_ERROR_CODE;
+        }
+    }
+    else if(!ret)
+    {
+        struct RunFileWriter writer;
+        ret = runFileWriterOpen(&writer, filename, format);
+        if(!ret)
+        {
+            ret = mergeRuns(runs, nRuns, NULL, NULL, &writer);
+            if(runFileWriterClose(&writer) == STANDART_ERROR_CODE)
+                ret = STANDART_ERROR_CODE;
+        }
+    }
+    removeRuns(runs, nRuns);
+    free(runs);
+    runs = NULL;
+    nRuns = 0;
+    runsCapacity = 0;
+    return ret;
+}
+
+/**
+    \brief  Функция возвращает статистику внешней сортировки.
+*/
+const struct ExternalSortInfo* getExternalSortInfo()
+{
+    return &info;
+}
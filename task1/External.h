@@ -0,0 +1,20 @@
+#pragma once
+#include <stddef.h>
+#include <stdbool.h>
+#include "Array.h"
+#include "Writer.h"
+#include "RunFile.h"
+
+/// статистика внешней сортировки
+struct ExternalSortInfo
+{
+    size_t nSpilledRuns;    ///< сколько отсортированных серий сброшено на диск
+    size_t nMergePasses;    ///< сколько промежуточных проходов слияния понадобилось
+    size_t fanIn;           ///< сколько серий сливается за раз
+    size_t spilledBytes;    ///< сколько байт записано во временные файлы
+};
+
+bool externalSortBegin(const struct SortConfig* config, int nProducers);
+bool externalSortRange(const char* filename, const struct FileRange* range, struct Array* stats);
+int externalSortFinish(const char* filename, enum WriteMode mode, enum RunFormat format);
+const struct ExternalSortInfo* getExternalSortInfo();
@@ -0,0 +1,284 @@
+#include "IntParser.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define INT_PARSER_X86 1
+#else
+    #define INT_PARSER_X86 0
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    #define INT_PARSER_SWAR 1
+#else
+    #define INT_PARSER_SWAR 0
+#endif
+
+/*
+    Разбор текста на целые числа.
+
+    Числом считается непрерывная последовательность десятичных цифр,
+    перед которой может стоять знак '-'. Любой другой символ является
+    разделителем. Переполнение обрабатывается так же, как и раньше
+    при чтении через sscanf("%d"): значение берется по модулю 2^32.
+
+    Векторные реализации обрабатывают текст блоками по 64 байта:
+    сначала за несколько инструкций строится битовая маска цифр блока,
+    затем по маске находятся начала и длины чисел, а сами цифры
+    переводятся в число по 8 штук за раз (SWAR). Хвост, который
+    короче блока, разбирается скалярной версией. За пределы
+    [begin, end) функции никогда не читают, поэтому дополнительного
+    выравнивания или нулей в конце буфера не требуется.
+*/
+
+#define BLOCK_SIZE 64
+#define IS_DIGIT(ch) ((unsigned char)((ch) - '0') < 10)
+
+typedef size_t (*ParserImpl)(const char* begin, const char* end, int* out);
+
+
+#if INT_PARSER_SWAR
+/**
+    \brief  Переводит от 1 до 8 цифр в число за несколько умножений.
+    \note   Читает ровно 8 байт начиная с digits.
+*/
+static inline uint32_t swarDigits8(const char* digits, size_t len)
+{
+    uint64_t word;
+    memcpy(&word, digits, sizeof(word));
+    word <<= (8 - len) * 8;
+    word &= 0x0F0F0F0F0F0F0F0FULL;
+    word = (word * 10 + (word >> 8)) & 0x00FF00FF00FF00FFULL;
+    word = (word * 100 + (word >> 16)) & 0x0000FFFF0000FFFFULL;
+    word = (word * 10000 + (word >> 32)) & 0x00000000FFFFFFFFULL;
+    return (uint32_t)word;
+}
+#endif
+
+/**
+    \brief  Переводит цифры [first, last) в число.
+    \param  [in]  end       граница буфера, до которой разрешено читать
+    \param  [in]  negative  стоял ли перед числом знак '-'
+*/
+static inline int convertDigits(const char* first, const char* last, const char* end, bool negative)
+{
+    size_t len = last - first;
+    uint32_t value = 0;
+#if INT_PARSER_SWAR
+    if(len <= 8 && end - first >= 8)
+        value = swarDigits8(first, len);
+    else if(len <= 16 && end - first >= 16)
+        value = swarDigits8(first, len - 8) * 100000000u + swarDigits8(last - 8, 8);
+    else
+#endif
+    for(const char* ch = first; ch < last; ch++)
+        value = value * 10 + (uint32_t)(*ch - '0');
+    return (int)(negative ? 0u - value : value);
+}
+
+/**
+    \brief  Скалярный разбор текста [from, end).
+    \param  [in]  origin  начало всего буфера, нужно чтобы
+                          проверять знак перед первым числом
+*/
+static size_t parseScalarFrom(const char* origin, const char* from, const char* end, int* out)
+{
+    int* cur = out;
+    const char* ch = from;
+    while(ch < end)
+    {
+        if(!IS_DIGIT(*ch))
+        {
+            ch++;
+            continue;
+        }
+        const char* first = ch;
+        while(ch < end && IS_DIGIT(*ch))
+            ch++;
+        *cur++ = convertDigits(first, ch, end, first > origin && first[-1] == '-');
+    }
+    return cur - out;
+}
+
+static size_t parseScalar(const char* begin, const char* end, int* out)
+{
+    return parseScalarFrom(begin, begin, end, out);
+}
+
+
+/*
+    Общая часть векторных реализаций. CLASSIFY(ptr) должна вернуть
+    64-битную маску, в которой i-й бит выставлен, если ptr[i] - цифра.
+    Число, которое начинается в блоке и продолжается за его пределами,
+    дочитывается скалярно, а carry не дает следующему блоку принять
+    его продолжение за новое число.
+*/
+#define DEFINE_BLOCK_PARSER(NAME, TARGET, CLASSIFY)                                     \
+TARGET static size_t NAME(const char* begin, const char* end, int* out)                 \
+{                                                                                       \
+    int* cur = out;                                                                     \
+    const char* block = begin;                                                          \
+    uint64_t carry = 0;                                                                 \
+    while(end - block >= BLOCK_SIZE)                                                    \
+    {                                                                                   \
+        uint64_t digits = CLASSIFY(block);                                              \
+        uint64_t starts = digits & ~((digits << 1) | carry);                            \
+        carry = digits >> 63;                                                           \
+        while(starts)                                                                   \
+        {                                                                               \
+            unsigned pos = __builtin_ctzll(starts);                                     \
+            starts &= starts - 1;                                                       \
+            uint64_t rest = ~(digits >> pos);                                           \
+            const char* first = block + pos;                                            \
+            const char* last = rest ? first + __builtin_ctzll(rest) : block + BLOCK_SIZE; \
+            if(last == block + BLOCK_SIZE)                                              \
+                while(last < end && IS_DIGIT(*last))                                    \
+                    last++;                                                             \
+            bool negative = first > begin && first[-1] == '-';                          \
+            *cur++ = convertDigits(first, last, end, negative);                         \
+        }                                                                               \
+        block += BLOCK_SIZE;                                                            \
+    }                                                                                   \
+    if(carry)                                                                           \
+        while(block < end && IS_DIGIT(*block))                                          \
+            block++;                                                                    \
+    cur += parseScalarFrom(begin, block, end, cur);                                     \
+    return cur - out;                                                                   \
+}
+
+
+#if INT_PARSER_X86
+
+__attribute__((target("avx2")))
+static inline uint64_t classifyAvx2(const char* block)
+{
+    const __m256i below = _mm256_set1_epi8('0' - 1);
+    const __m256i above = _mm256_set1_epi8('9' + 1);
+    __m256i lo = _mm256_loadu_si256((const __m256i*)block);
+    __m256i hi = _mm256_loadu_si256((const __m256i*)(block + 32));
+    lo = _mm256_and_si256(_mm256_cmpgt_epi8(lo, below), _mm256_cmpgt_epi8(above, lo));
+    hi = _mm256_and_si256(_mm256_cmpgt_epi8(hi, below), _mm256_cmpgt_epi8(above, hi));
+    return (uint64_t)(uint32_t)_mm256_movemask_epi8(lo) |
+           (uint64_t)(uint32_t)_mm256_movemask_epi8(hi) << 32;
+}
+
+static inline uint64_t classifySse2(const char* block)
+{
+    const __m128i below = _mm_set1_epi8('0' - 1);
+    const __m128i above = _mm_set1_epi8('9' + 1);
+    uint64_t mask = 0;
+    for(int i = 0; i < 4; i++)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(block + 16 * i));
+        chunk = _mm_and_si128(_mm_cmpgt_epi8(chunk, below), _mm_cmpgt_epi8(above, chunk));
+        mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(chunk) << (16 * i);
+    }
+    return mask;
+}
+
+DEFINE_BLOCK_PARSER(parseAvx2, __attribute__((target("avx2"))), classifyAvx2)
+DEFINE_BLOCK_PARSER(parseSse2, , classifySse2)
+
+#endif
+
+
+static ParserImpl parserImpl = NULL;
+static const char* parserImplName = NULL;
+static pthread_once_t parserOnce = PTHREAD_ONCE_INIT;
+
+/**
+    \brief  Выбирает реализацию разбора под текущий процессор.
+    \note   Переменной окружения INT_PARSER=avx2|sse2|scalar можно
+            принудительно выбрать реализацию (например, для сравнения).
+            Вызывается ровно один раз через pthread_once(): разбор
+            начинается из нескольких исполнителей сразу.
+*/
+static void resolveParser()
+{
+    const char* forced = getenv("INT_PARSER");
+    ParserImpl impl = parseScalar;
+    const char* name = "scalar";
+#if INT_PARSER_X86
+    __builtin_cpu_init();
+    bool forceScalar = forced && !strcmp(forced, "scalar");
+    bool forceSse2 = forced && !strcmp(forced, "sse2");
+    if(!forceScalar)
+    {
+        impl = parseSse2;
+        name = "sse2";
+    }
+    if(!forceScalar && !forceSse2 && __builtin_cpu_supports("avx2"))
+    {
+        impl = parseAvx2;
+        name = "avx2";
+    }
+#else
+    (void)forced;
+#endif
+    parserImplName = name;
+    parserImpl = impl;
+}
+
+/**
+    \brief  Функция возвращает максимально возможное количество
+            чисел в тексте заданной длины.
+    \param  [in]  nBytes  длина текста в байтах
+*/
+size_t intParserCapacity(size_t nBytes)
+{
+    return nBytes / 2 + 1;
+}
+
+/**
+    \brief  Функция за один проход разбирает текст на целые числа.
+    \param  [in]   begin  начало текста
+    \param  [in]   end    указатель за последний символ текста
+    \param  [out]  out    массив, куда будут записаны числа, должен
+                          вмещать intParserCapacity(end - begin) чисел
+    \return Количество записанных чисел
+*/
+size_t parseIntegers(const char* begin, const char* end, int* out)
+{
+    pthread_once(&parserOnce, resolveParser);
+    return parserImpl(begin, end, out);
+}
+
+/**
+    \brief  Функция возвращает имя выбранной реализации разбора.
+*/
+const char* intParserName()
+{
+    pthread_once(&parserOnce, resolveParser);
+    return parserImplName;
+}
+
+/**
+    \brief  Функция разбирает очередной кусок потока, не трогая число,
+            которое может продолжиться в следующем куске.
+    \param  [in]   begin  начало куска
+    \param  [in]   end    указатель за последний символ куска
+    \param  [out]  out    массив, куда будут записаны числа, должен
+                          вмещать intParserCapacity(end - begin) чисел
+    \param  [out]  stop   начало неразобранного хвоста (цифры и знак
+                          в конце куска), его нужно приклеить к началу
+                          следующего куска
+    \return Количество записанных чисел
+    \note   Если хвост длиннее INT_PARSER_MAX_CARRY байт, то это уже не
+            число типа int, и кусок разбирается целиком.
+*/
+size_t parseIntegersChunk(const char* begin, const char* end, int* out, const char** stop)
+{
+    const char* cut = end;
+    while(cut > begin && IS_DIGIT(cut[-1]))
+        cut--;
+    if(cut > begin && cut[-1] == '-')
+        cut--;
+    if(end - cut > INT_PARSER_MAX_CARRY)
+        cut = end;
+    *stop = cut;
+    return parseIntegers(begin, cut, out);
+}
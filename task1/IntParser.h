@@ -0,0 +1,10 @@
+#pragma once
+#include <stddef.h>
+
+/// максимальная длина хвоста, переносимого в следующий кусок
+#define INT_PARSER_MAX_CARRY 64
+
+size_t intParserCapacity(size_t nBytes);
+size_t parseIntegers(const char* begin, const char* end, int* out);
+size_t parseIntegersChunk(const char* begin, const char* end, int* out, const char** stop);
+const char* intParserName();
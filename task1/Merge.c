@@ -0,0 +1,272 @@
+#include "Merge.h"
+#include "SimdSort.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+/*
+    k-путевое слияние отсортированных массивов деревом проигравших.
+
+    Массив i является листом с номером nRuns + i, у узла p родитель
+    p / 2, а корень дерева - узел 1. Так дерево строится для любого k,
+    не обязательно степени двойки. После того как из массива-победителя
+    забрали элементы, достаточно переиграть только путь от его листа
+    до корня: это log2(k) сравнений на каждый элемент вместо
+    просмотра всех k массивов.
+
+    Закончившийся массив проигрывает всем, поэтому отдельное значение
+    "бесконечность" не нужно и INT_MAX остается обычным числом.
+*/
+
+/**
+    \brief  Функция сравнивает текущие элементы двух массивов.
+    \return true, если массив a должен выиграть у массива b.
+*/
+static inline bool runLess(const struct LoserTree* tree, size_t a, size_t b)
+{
+    if(tree->current[a] == tree->end[a])
+        return false;
+    if(tree->current[b] == tree->end[b])
+        return true;
+    return *tree->current[a] < *tree->current[b];
+}
+
+/**
+    \brief  Функция строит дерево проигравших над массивами.
+    \param  [out]  tree   дерево
+    \param  [in]   runs   отсортированные массивы
+    \param  [in]   nRuns  число массивов
+    \return true в случае успеха, false если не хватило памяти.
+    \note   Сами массивы не копируются и должны жить, пока идет слияние.
+*/
+bool loserTreeInit(struct LoserTree* tree, const struct SortedRun* runs, size_t nRuns)
+{
+    memset(tree, 0, sizeof(struct LoserTree));
+    if(!nRuns)
+        return true;
+    tree->nRuns = nRuns;
+    tree->losers = (size_t*)malloc(nRuns * sizeof(size_t));
+    tree->current = (const int**)malloc(nRuns * sizeof(int*));
+    tree->end = (const int**)malloc(nRuns * sizeof(int*));
+    size_t* winners = (size_t*)malloc(2 * nRuns * sizeof(size_t));
+    if(!tree->losers || !tree->current || !tree->end || !winners)
+    {
+        printf("Error: Cant allocate memory for merge tree!\n");
+        free(winners);
+        loserTreeDestroy(tree);
+        return false;
+    }
+
+    for(size_t i = 0; i < nRuns; i++)
+    {
+        tree->current[i] = runs[i].data;
+        tree->end[i] = runs[i].data + runs[i].size;
+        winners[nRuns + i] = i;
+    }
+    //играем турнир снизу вверх, в узлах остаются проигравшие
+    for(size_t node = nRuns - 1; node >= 1; node--)
+    {
+        size_t left = winners[2 * node];
+        size_t right = winners[2 * node + 1];
+        bool leftWins = runLess(tree, left, right);
+        winners[node] = leftWins ? left : right;
+        tree->losers[node] = leftWins ? right : left;
+    }
+    tree->losers[0] = nRuns > 1 ? winners[1] : 0;
+    free(winners);
+    return true;
+}
+
+/**
+    \brief  Функция забирает из слияния очередное наименьшее значение.
+    \param  [in,out]  tree   дерево
+    \param  [out]     value  наименьшее значение
+    \return Сколько раз подряд value встретилось в массиве-победителе,
+            или 0, если все массивы закончились.
+    \note   Повторы одного значения в массиве забираются разом, и
+            дерево переигрывается один раз на всю серию. Если то же
+            значение есть и в других массивах, то оно вернется
+            следующими вызовами.
+*/
+size_t loserTreePop(struct LoserTree* tree, int* value)
+{
+    if(!tree->nRuns)
+        return 0;
+    size_t winner = tree->losers[0];
+    const int* first = tree->current[winner];
+    const int* last = tree->end[winner];
+    if(first == last)
+        return 0;
+
+    *value = *first;
+    const int* next = first + 1;
+    while(next != last && *next == *first)
+        next++;
+    tree->current[winner] = next;
+    if(next == last && tree->refill &&
+       !tree->refill(tree->refillContext, winner, &tree->current[winner], &tree->end[winner]))
+        tree->current[winner] = tree->end[winner];
+
+    for(size_t node = (winner + tree->nRuns) / 2; node >= 1; node /= 2)
+        if(runLess(tree, tree->losers[node], winner))
+        {
+            size_t loser = winner;
+            winner = tree->losers[node];
+            tree->losers[node] = loser;
+        }
+    tree->losers[0] = winner;
+    return next - first;
+}
+
+/**
+    \brief  Функция забирает из слияния до capacity наименьших значений.
+    \param  [in,out]  tree      дерево
+    \param  [out]     out       куда записать значения
+    \param  [in]      capacity  сколько значений поместится в out
+    \return Число записанных значений, 0 - если все массивы закончились.
+    \note   Два массива, читаемые целиком, сливаются векторным ядром
+            mergeTwoRuns(), остальные забираются через loserTreePop().
+            Чередовать вызовы с loserTreePop() нельзя: дерево при
+            двух массивах не переигрывается, а не поместившиеся
+            повторы значения остаются в дереве до следующего вызова.
+*/
+size_t loserTreePopBlock(struct LoserTree* tree, int* out, size_t capacity)
+{
+    if(tree->nRuns == 2 && !tree->refill)
+        return mergeTwoRuns(&tree->current[0], tree->end[0], &tree->current[1], tree->end[1], out, capacity);
+
+    size_t size = 0;
+    while(size < capacity)
+    {
+        if(!tree->nPending)
+            tree->nPending = loserTreePop(tree, &tree->pendingValue);
+        if(!tree->nPending)
+            break;
+        size_t count = tree->nPending < capacity - size ? tree->nPending : capacity - size;
+        for(size_t i = 0; i < count; i++)
+            out[size++] = tree->pendingValue;
+        tree->nPending -= count;
+    }
+    return size;
+}
+
+/**
+    \brief  Функция включает чтение массивов блоками.
+    \param  [in,out]  tree     дерево, построенное над первыми блоками
+    \param  [in]      refill   функция, выдающая следующий блок массива
+    \param  [in]      context  аргумент для refill
+    \note   Первые блоки передаются в loserTreeInit() как обычные
+            массивы. Пустой первый блок означает пустой массив.
+*/
+void loserTreeSetRefill(struct LoserTree* tree, RunRefill refill, void* context)
+{
+    tree->refill = refill;
+    tree->refillContext = context;
+}
+
+/**
+    \brief  Функция освобождает память дерева.
+*/
+void loserTreeDestroy(struct LoserTree* tree)
+{
+    if(!tree)
+        return;
+    free(tree->losers);
+    free(tree->current);
+    free(tree->end);
+    memset(tree, 0, sizeof(struct LoserTree));
+}
+
+/**
+    \brief  Функция сливает отсортированные массивы в один.
+    \param  [in]   runs   отсортированные массивы
+    \param  [in]   nRuns  число массивов
+    \param  [out]  out    массив, вмещающий сумму размеров runs
+    \return Число записанных элементов.
+*/
+size_t mergeSortedRuns(const struct SortedRun* runs, size_t nRuns, int* out)
+{
+    struct LoserTree tree;
+    if(!loserTreeInit(&tree, runs, nRuns))
+        return 0;
+    size_t total = 0;
+    for(size_t i = 0; i < nRuns; i++)
+        total += runs[i].size;
+    size_t size = 0;
+    size_t count;
+    while((count = loserTreePopBlock(&tree, out + size, total - size)))
+        size += count;
+    loserTreeDestroy(&tree);
+    return size;
+}
+
+
+/**
+    \brief  Функция возвращает число элементов массива, меньших value
+            (или не больших, если orEqual).
+*/
+static size_t countBelow(const struct SortedRun* run, int64_t value, bool orEqual)
+{
+    size_t left = 0;
+    size_t right = run->size;
+    while(left < right)
+    {
+        size_t middle = left + (right - left) / 2;
+        if(run->data[middle] < value || (orEqual && run->data[middle] == value))
+            left = middle + 1;
+        else
+            right = middle;
+    }
+    return left;
+}
+
+/**
+    \brief  Функция находит, сколько элементов каждого массива попадает
+            в первые rank элементов результата слияния.
+    \param  [in]   runs    отсортированные массивы
+    \param  [in]   nRuns   число массивов
+    \param  [in]   rank    позиция разреза в результате слияния, не
+                           больше суммы размеров массивов
+    \param  [out]  splits  для каждого массива число его элементов,
+                           попавших левее разреза
+    \details Обобщение merge path на k массивов. Двоичным поиском по
+             значению находится наименьшее v, для которого элементов
+             не больше v набирается хотя бы rank. Все элементы меньше v
+             уходят левее разреза, а недостающие до rank копии v
+             добираются из массивов по порядку. Поэтому разрезы,
+             построенные для возрастающих rank, не пересекаются, и
+             части между ними можно сливать независимо.
+*/
+void splitRunsAtRank(const struct SortedRun* runs, size_t nRuns, size_t rank, size_t* splits)
+{
+    int64_t low = INT_MIN;
+    int64_t high = INT_MAX;
+    while(low < high)
+    {
+        int64_t middle = low + (high - low) / 2;
+        size_t count = 0;
+        for(size_t i = 0; i < nRuns && count < rank; i++)
+            count += countBelow(&runs[i], middle, true);
+        if(count >= rank)
+            high = middle;
+        else
+            low = middle + 1;
+    }
+
+    size_t need = rank;
+    for(size_t i = 0; i < nRuns; i++)
+    {
+        splits[i] = countBelow(&runs[i], low, false);
+        need -= splits[i];
+    }
+    for(size_t i = 0; i < nRuns && need; i++)
+    {
+        size_t equal = countBelow(&runs[i], low, true) - splits[i];
+        if(equal > need)
+            equal = need;
+        splits[i] += equal;
+        need -= equal;
+    }
+}
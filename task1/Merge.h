@@ -0,0 +1,47 @@
+#pragma once
+#include <stddef.h>
+#include <stdbool.h>
+
+/// столько значений удобно забирать за один вызов loserTreePopBlock()
+#define MERGE_POP_BLOCK 1024
+
+/// отсортированный по возрастанию массив, участвующий в слиянии
+struct SortedRun
+{
+    const int* data;
+    size_t size;
+};
+
+/**
+    Функция, которая выдает следующий блок закончившегося массива.
+    Должна записать в begin и end границы блока и вернуть false,
+    если массив закончился совсем.
+*/
+typedef bool (*RunRefill)(void* context, size_t run, const int** begin, const int** end);
+
+/**
+    Дерево проигравших для k-путевого слияния. В каждом внутреннем
+    узле хранится номер массива, проигравшего в этом узле, а в
+    losers[0] - номер массива с наименьшим текущим элементом.
+    Если задан refill, то массивы читаются блоками: когда блок
+    массива заканчивается, дерево просит у refill следующий.
+*/
+struct LoserTree
+{
+    size_t nRuns;
+    size_t* losers;
+    const int** current;
+    const int** end;
+    RunRefill refill;
+    void* refillContext;
+    int pendingValue;   ///< повторы, не поместившиеся в прошлый loserTreePopBlock()
+    size_t nPending;
+};
+
+bool loserTreeInit(struct LoserTree* tree, const struct SortedRun* runs, size_t nRuns);
+size_t loserTreePop(struct LoserTree* tree, int* value);
+size_t loserTreePopBlock(struct LoserTree* tree, int* out, size_t capacity);
+void loserTreeSetRefill(struct LoserTree* tree, RunRefill refill, void* context);
+void loserTreeDestroy(struct LoserTree* tree);
+size_t mergeSortedRuns(const struct SortedRun* runs, size_t nRuns, int* out);
+void splitRunsAtRank(const struct SortedRun* runs, size_t nRuns, size_t rank, size_t* splits);
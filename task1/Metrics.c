@@ -0,0 +1,89 @@
+#include "Metrics.h"
+#include "Coroutine.h"
+#include "Context.h"
+#include "IntParser.h"
+#include "StrLib.h"
+#include <stdio.h>
+
+/**
+    \brief  Функция пишет строку в кавычках, экранируя символы,
+            которые нельзя оставить в строке JSON как есть.
+*/
+static void writeJsonString(FILE* file, const char* text)
+{
+    fputc('"', file);
+    for(const unsigned char* c = (const unsigned char*)text; *c; c++)
+    {
+        if(*c == '"' || *c == '\\')
+            fprintf(file, "\\%c", *c);
+        else if(*c < 0x20)
+            fprintf(file, "\\u%04x", *c);
+        else
+            fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+/**
+    \brief  Функция записывает отчет о последнем запуске сортировки.
+    \param  [in]  filename   имя файла отчета
+    \param  [in]  config     настройки сортировки
+    \param  [in]  sources    что разбирала каждая корутина, может быть NULL
+    \param  [in]  arrays     результаты корутин со статистикой разбора
+                             и сортировки
+    \param  [in]  nTasks     число корутин
+    \param  [in]  writeTime  сколько секунд заняла запись результата
+    \return 0 в случае успеха, STANDART_ERROR_CODE иначе.
+    \note   Статистика планировщика берется из getSchedulerInfo() и
+            getRuntimeInfo(), поэтому отчет пишется до
+            cleanMemoryForCoroutine().
+*/
+int writeMetricsJson(const char* filename, const struct SortConfig* config,
+                     const char* const* sources, const struct Array* arrays, int nTasks,
+                     double writeTime)
+{
+    FILE* file = fopen(filename, "w");
+    if(!file)
+        return STANDART_ERROR_CODE;
+
+    const struct RuntimeInfo* runtime = getRuntimeInfo();
+    size_t overheadTime = runtime->workerCpuTime - runtime->coroutineCpuTime;
+    fprintf(file, "{\n  \"config\": {\"algorithm\": \"%s\", \"parser\": \"%s\", \"policy\": \"%s\", "
+                  "\"contextSwitch\": \"%s\", \"memoryBudget\": %zu, \"workers\": %d, \"coroutines\": %d},\n",
+        sortAlgorithmName(config->algorithm), intParserName(), schedulingPolicyName(runtime->policy),
+        contextBackendName(), config->memoryBudget, runtime->nWorkers, nTasks);
+    fprintf(file, "  \"runtime\": {\"workerCpuUs\": %zu, \"coroutineCpuUs\": %zu, \"overheadUs\": %zu, "
+                  "\"overheadPercent\": %.3lf, \"ticks\": %zu, \"preemptions\": %zu, "
+                  "\"firstResultUs\": %zu, \"makespanUs\": %zu, \"peakStacks\": %d, \"writeUs\": %.0lf},\n",
+        runtime->workerCpuTime, runtime->coroutineCpuTime, overheadTime,
+        runtime->workerCpuTime ? 100.0 * overheadTime / runtime->workerCpuTime : 0.0,
+        runtime->nTicks, runtime->nPreemptions, runtime->firstResultTime, runtime->makespan,
+        runtime->peakStacks, writeTime * 1e6);
+
+    fprintf(file, "  \"coroutines\": [\n");
+    for(int i = 0; i < nTasks; i++)
+    {
+        const struct SchedulerInfo* info = getSchedulerInfo(i);
+        fprintf(file, "    {\"id\": %d, \"source\": ", i);
+        writeJsonString(file, sources && sources[i] ? sources[i] : "");
+        fprintf(file, ", \"bytes\": %zu, \"elements\": %zu, \"parseUs\": %.0lf, \"sortUs\": %.0lf, "
+                      "\"cpuUs\": %zu, \"ioWaitUs\": %zu, \"queueWaitUs\": %zu, \"switches\": %zu, "
+                      "\"migrations\": %zu, \"switchLatencyNs\": %.1lf, \"stackBytes\": %zu, "
+                      "\"finishUs\": %zu, \"plan\": \"%s\", \"planReason\": ",
+            arrays[i].parsedBytes, arrays[i].size, arrays[i].parseTime * 1e6, arrays[i].sortTime * 1e6,
+            info->totalWakingTime, info->ioWaitTime, info->queueWaitTime, info->swapTimes,
+            info->migrations, info->nSwitches ? (double)info->switchLatency / info->nSwitches : 0.0,
+            info->stackHighWater, info->finishTime, sortAlgorithmName(arrays[i].plan.algorithm));
+        writeJsonString(file, arrays[i].plan.reason ? arrays[i].plan.reason : "");
+        fprintf(file, ", \"sliceHistogramUs\": [");
+        for(int bucket = 0; bucket < SLICE_HISTOGRAM_BUCKETS; bucket++)
+            fprintf(file, bucket ? ", %zu" : "%zu", info->sliceHistogram[bucket]);
+        fprintf(file, "]}%s\n", i + 1 < nTasks ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+
+    bool isFailed = ferror(file);
+    if(fclose(file) || isFailed)
+        return STANDART_ERROR_CODE;
+    return 0;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <stddef.h>
+#include "Array.h"
+
+/*
+    Отчет о работе сортировки в формате JSON.
+
+    В отчет попадают настройки запуска, статистика исполнителей и по
+    одной записи на корутину: что она разбирала, сколько байт и чисел
+    обработала, каким алгоритмом и почему сортировала, сколько времени
+    ушло на разбор, сортировку, ожидание чтения и очереди, задержка
+    переключений и гистограмма длин ее запусков. Все времена в
+    микросекундах, задержка переключения в наносекундах.
+*/
+
+int writeMetricsJson(const char* filename, const struct SortConfig* config,
+                     const char* const* sources, const struct Array* arrays, int nTasks,
+                     double writeTime);
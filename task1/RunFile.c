@@ -0,0 +1,539 @@
+#include "RunFile.h"
+#include "StrLib.h"
+#include "Trace.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define KB * 1024
+
+// размер буфера записи
+#define RUN_FILE_BUFFER_SIZE 1024 KB
+// столько байт максимум добавляет в буфер одно число (int32 или varint uint32)
+#define RUN_FILE_MAX_VALUE_BYTES 5
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    #define RUN_FILE_NATIVE_LE 1
+#else
+    #define RUN_FILE_NATIVE_LE 0
+#endif
+
+/*
+    Двоичный формат серий чисел.
+
+    RUN_FORMAT_RAW - это просто int32 в little-endian после заголовка:
+    на машине с тем же порядком байт файл читается одним memcpy без
+    всякого разбора.
+
+    RUN_FORMAT_DELTA годится только для отсортированных данных. Числа
+    разбиты на блоки по blockValues штук; блок начинается с первого
+    числа целиком, дальше идут разности соседних чисел в varint, то
+    есть по 7 бит на байт. В плотно заполненных отсортированных
+    данных разности маленькие, и большинство чисел занимает 1-2 байта
+    вместо 4 двоичных или 11 текстовых. Индекс блоков в конце файла
+    хранит смещение и первое число каждого блока, поэтому найти место
+    числа можно двоичным поиском по индексу и распаковкой одного блока.
+*/
+
+static void putLe16(uint8_t* out, uint16_t value)
+{
+    out[0] = value;
+    out[1] = value >> 8;
+}
+
+static void putLe32(uint8_t* out, uint32_t value)
+{
+    for(int i = 0; i < 4; i++)
+        out[i] = value >> (8 * i);
+}
+
+static void putLe64(uint8_t* out, uint64_t value)
+{
+    for(int i = 0; i < 8; i++)
+        out[i] = value >> (8 * i);
+}
+
+static uint16_t getLe16(const uint8_t* in)
+{
+    return in[0] | (uint16_t)in[1] << 8;
+}
+
+static uint32_t getLe32(const uint8_t* in)
+{
+    return in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+static uint64_t getLe64(const uint8_t* in)
+{
+    return getLe32(in) | (uint64_t)getLe32(in + 4) << 32;
+}
+
+
+//==================================================================================================
+
+//                               чтение
+
+//==================================================================================================
+
+
+/**
+    \brief  Функция проверяет, начинается ли файл с заголовка
+            двоичного формата.
+*/
+bool isRunFile(const char* filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if(fd == -1)
+        return false;
+    char magic[4];
+    bool isRun = pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+                 !memcmp(magic, RUN_FILE_MAGIC, sizeof(magic));
+    close(fd);
+    return isRun;
+}
+
+/**
+    \brief  Функция отображает двоичный файл в память и проверяет
+            его заголовок.
+    \param  [in]   filename  имя файла
+    \param  [out]  file      описание файла
+    \return В случае успеха возвращается 0, иначе константа -1.
+*/
+int runFileOpen(const char* filename, struct RunFile* file)
+{
+    memset(file, 0, sizeof(struct RunFile));
+    int fd = open(filename, O_RDONLY);
+    if(fd == -1)
+    {
+        printf("Failed open file for reading.\n");
+        return STANDART_ERROR_CODE;
+    }
+    struct stat info;
+    if(fstat(fd, &info) == -1 || info.st_size < RUN_FILE_HEADER_SIZE)
+    {
+        close(fd);
+        return STANDART_ERROR_CODE;
+    }
+    const uint8_t* map = (const uint8_t*)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return STANDART_ERROR_CODE;
+    file->map = map;
+    file->mapSize = info.st_size;
+
+    uint16_t version = getLe16(map + 4);
+    uint16_t format = getLe16(map + 6);
+    file->flags = getLe32(map + 8);
+    file->blockValues = getLe32(map + 12);
+    file->count = getLe64(map + 16);
+    file->nBlocks = getLe64(map + 24);
+    uint64_t indexOffset = getLe64(map + 32);
+    uint64_t dataOffset = getLe64(map + 40);
+
+    bool isValid = !memcmp(map, RUN_FILE_MAGIC, 4) && version == RUN_FILE_VERSION &&
+                   dataOffset <= file->mapSize;
+    if(isValid && format == RUN_FORMAT_RAW)
+        isValid = file->count <= (file->mapSize - dataOffset) / sizeof(int32_t);
+    else if(isValid && format == RUN_FORMAT_DELTA)
+        isValid = file->blockValues && indexOffset <= file->mapSize &&
+                  file->nBlocks <= (file->mapSize - indexOffset) / RUN_FILE_INDEX_ENTRY_SIZE &&
+                  file->nBlocks == (file->count + file->blockValues - 1) / file->blockValues;
+    else
+        isValid = false;
+    if(!isValid)
+    {
+        printf("Error: `%s` is not a valid binary run file\n", filename);
+        runFileClose(file);
+        return STANDART_ERROR_CODE;
+    }
+
+    file->format = (enum RunFormat)format;
+    file->data = map + dataOffset;
+    file->index = map + indexOffset;
+    return 0;
+}
+
+void runFileClose(struct RunFile* file)
+{
+    if(file && file->map)
+        munmap((void*)file->map, file->mapSize);
+    memset(file, 0, sizeof(struct RunFile));
+}
+
+/**
+    \brief  Функция распаковывает один блок сжатого файла.
+    \return Число распакованных чисел или 0, если блок поврежден.
+*/
+static size_t decodeDeltaBlock(const struct RunFile* file, uint64_t block, int* out)
+{
+    const uint8_t* entry = file->index + block * RUN_FILE_INDEX_ENTRY_SIZE;
+    uint64_t offset = getLe64(entry);
+    uint32_t count = getLe32(entry + 12);
+    const uint8_t* end = file->map + file->mapSize;
+    if(offset > file->mapSize - sizeof(int32_t) || count > file->blockValues)
+        return 0;
+    const uint8_t* in = file->map + offset;
+    uint32_t value = getLe32(in);
+    in += 4;
+    out[0] = (int)value;
+    for(uint32_t i = 1; i < count; i++)
+    {
+        uint32_t delta = 0;
+        for(int shift = 0; ; shift += 7)
+        {
+            if(in == end || shift > 28)
+                return 0;
+            uint8_t byte = *in++;
+            delta |= (uint32_t)(byte & 0x7F) << shift;
+            if(!(byte & 0x80))
+                break;
+        }
+        value += delta;
+        out[i] = (int)value;
+    }
+    return count;
+}
+
+/**
+    \brief  Функция распаковывает все числа файла.
+    \param  [in]   file  открытый файл
+    \param  [out]  out   массив на file->count чисел
+    \return Число распакованных чисел; меньше count, если файл поврежден.
+    \note   Формат RUN_FORMAT_RAW на little-endian машине копируется
+            одним memcpy().
+*/
+size_t runFileDecode(const struct RunFile* file, int* out)
+{
+    if(file->format == RUN_FORMAT_RAW)
+    {
+#if RUN_FILE_NATIVE_LE
+        memcpy(out, file->data, file->count * sizeof(int32_t));
+#else
+        for(uint64_t i = 0; i < file->count; i++)
+            out[i] = (int)getLe32(file->data + 4 * i);
+#endif
+        return file->count;
+    }
+
+    size_t size = 0;
+    for(uint64_t block = 0; block < file->nBlocks; block++)
+    {
+        size_t nDecoded = decodeDeltaBlock(file, block, out + size);
+        if(!nDecoded)
+            break;
+        size += nDecoded;
+    }
+    return size;
+}
+
+/**
+    \brief  Функция возвращает, на сколько блоков runFileDecodeBlock()
+            делит файл.
+    \param  [in]   file         открытый файл
+    \param  [out]  blockValues  сюда записывается, сколько чисел
+                                может быть в одном блоке
+    \note   Несжатый формат делится на блоки по RUN_FILE_BLOCK_VALUES.
+*/
+uint64_t runFileBlocks(const struct RunFile* file, size_t* blockValues)
+{
+    if(file->format == RUN_FORMAT_RAW)
+    {
+        *blockValues = RUN_FILE_BLOCK_VALUES;
+        return (file->count + RUN_FILE_BLOCK_VALUES - 1) / RUN_FILE_BLOCK_VALUES;
+    }
+    *blockValues = file->blockValues;
+    return file->nBlocks;
+}
+
+/**
+    \brief  Функция распаковывает один блок файла.
+    \param  [in]   file   открытый файл
+    \param  [in]   block  номер блока, меньше runFileBlocks()
+    \param  [out]  out    массив на blockValues чисел
+    \return Число распакованных чисел или 0, если блок поврежден.
+*/
+size_t runFileDecodeBlock(const struct RunFile* file, uint64_t block, int* out)
+{
+    if(file->format == RUN_FORMAT_DELTA)
+        return decodeDeltaBlock(file, block, out);
+    uint64_t first = block * RUN_FILE_BLOCK_VALUES;
+    if(first >= file->count)
+        return 0;
+    size_t count = file->count - first < RUN_FILE_BLOCK_VALUES ? file->count - first : RUN_FILE_BLOCK_VALUES;
+#if RUN_FILE_NATIVE_LE
+    memcpy(out, file->data + 4 * first, count * sizeof(int32_t));
+#else
+    for(size_t i = 0; i < count; i++)
+        out[i] = (int)getLe32(file->data + 4 * (first + i));
+#endif
+    return count;
+}
+
+/**
+    \brief  Функция находит в отсортированном файле позицию первого
+            числа, не меньшего value.
+    \return Позиция от 0 до file->count.
+    \note   Для сжатого формата двоичный поиск идет по индексу блоков,
+            а распаковывается только один блок.
+*/
+uint64_t runFileLowerBound(const struct RunFile* file, int value)
+{
+    if(file->format == RUN_FORMAT_RAW)
+    {
+        uint64_t left = 0;
+        uint64_t right = file->count;
+        while(left < right)
+        {
+            uint64_t middle = left + (right - left) / 2;
+            if((int)getLe32(file->data + 4 * middle) < value)
+                left = middle + 1;
+            else
+                right = middle;
+        }
+        return left;
+    }
+
+    //первый блок, который начинается с числа не меньше value
+    uint64_t left = 0;
+    uint64_t right = file->nBlocks;
+    while(left < right)
+    {
+        uint64_t middle = left + (right - left) / 2;
+        if((int)getLe32(file->index + middle * RUN_FILE_INDEX_ENTRY_SIZE + 8) < value)
+            left = middle + 1;
+        else
+            right = middle;
+    }
+    if(!left)
+        return 0;
+
+    //искомое число лежит в предыдущем блоке или в начале найденного
+    int block[RUN_FILE_BLOCK_VALUES];
+    int* values = file->blockValues <= RUN_FILE_BLOCK_VALUES ? block :
+                  (int*)malloc(file->blockValues * sizeof(int));
+    if(!values)
+        return (left - 1) * file->blockValues;
+    size_t count = decodeDeltaBlock(file, left - 1, values);
+    size_t position = 0;
+    while(position < count && values[position] < value)
+        position++;
+    if(values != block)
+        free(values);
+    return (left - 1) * file->blockValues + position;
+}
+
+//==================================================================================================
+//==================================================================================================
+
+
+
+
+
+
+//==================================================================================================
+
+//                               запись
+
+//==================================================================================================
+
+
+static int pwriteAll(int fd, const uint8_t* data, size_t size, uint64_t offset)
+{
+    traceBegin("write");
+    while(size)
+    {
+        ssize_t nWritten = pwrite(fd, data, size, offset);
+        if(nWritten == -1 && errno == EINTR)
+            continue;
+        if(nWritten <= 0)
+        {
+            traceEnd("write");
+            return STANDART_ERROR_CODE;
+        }
+        data += nWritten;
+        size -= nWritten;
+        offset += nWritten;
+    }
+    traceEnd("write");
+    return 0;
+}
+
+static void runFileWriterFlush(struct RunFileWriter* writer)
+{
+    if(!writer->isFailed && pwriteAll(writer->fd, writer->buffer, writer->bufferUsed, writer->fileOffset) == STANDART_ERROR_CODE)
+        writer->isFailed = true;
+    writer->fileOffset += writer->bufferUsed;
+    writer->bufferUsed = 0;
+}
+
+/**
+    \brief  Функция создает двоичный файл для потоковой записи.
+    \param  [out]  writer    состояние записи
+    \param  [in]   filename  имя файла
+    \param  [in]   format    RUN_FORMAT_RAW или RUN_FORMAT_DELTA
+    \return В случае успеха возвращается 0, иначе константа -1.
+    \note   Заголовок и индекс пишутся в runFileWriterClose(), когда
+            число чисел уже известно.
+*/
+int runFileWriterOpen(struct RunFileWriter* writer, const char* filename, enum RunFormat format)
+{
+    memset(writer, 0, sizeof(struct RunFileWriter));
+    if(format != RUN_FORMAT_RAW && format != RUN_FORMAT_DELTA)
+        return STANDART_ERROR_CODE;
+    writer->format = format;
+    writer->flags = RUN_FILE_SORTED;
+    writer->fileOffset = RUN_FILE_HEADER_SIZE;
+    writer->buffer = (uint8_t*)malloc(RUN_FILE_BUFFER_SIZE);
+    if(!writer->buffer)
+        return STANDART_ERROR_CODE;
+    writer->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(writer->fd == -1)
+    {
+        printf("Failed open file for writing.\n");
+        free(writer->buffer);
+        return STANDART_ERROR_CODE;
+    }
+    return 0;
+}
+
+/**
+    \brief  Функция добавляет в индекс новый блок, начинающийся
+            с текущей позиции записи.
+*/
+static bool addIndexEntry(struct RunFileWriter* writer, int firstValue)
+{
+    if(writer->nBlocks == writer->indexCapacity)
+    {
+        size_t capacity = writer->indexCapacity ? 2 * writer->indexCapacity : 256;
+        uint8_t* grown = (uint8_t*)realloc(writer->index, capacity * RUN_FILE_INDEX_ENTRY_SIZE);
+        if(!grown)
+            return false;
+        writer->index = grown;
+        writer->indexCapacity = capacity;
+    }
+    uint8_t* entry = writer->index + writer->nBlocks * RUN_FILE_INDEX_ENTRY_SIZE;
+    putLe64(entry, writer->fileOffset + writer->bufferUsed);
+    putLe32(entry + 8, (uint32_t)firstValue);
+    putLe32(entry + 12, 0);
+    writer->nBlocks++;
+    return true;
+}
+
+/**
+    \brief  Функция дописывает число value, повторенное count раз.
+    \note   Сжатый формат требует неубывающих чисел: если порядок
+            нарушен, запись помечается неудачной.
+*/
+void runFileWriterPut(struct RunFileWriter* writer, int value, size_t count)
+{
+    if(count && writer->count && value < writer->previous)
+    {
+        writer->flags &= ~RUN_FILE_SORTED;
+        if(writer->format == RUN_FORMAT_DELTA)
+            writer->isFailed = true;
+    }
+    while(count-- && !writer->isFailed)
+    {
+        uint8_t* out = writer->buffer + writer->bufferUsed;
+        if(writer->format == RUN_FORMAT_RAW || writer->count % RUN_FILE_BLOCK_VALUES == 0)
+        {
+            if(writer->format == RUN_FORMAT_DELTA && !addIndexEntry(writer, value))
+                writer->isFailed = true;
+            putLe32(out, (uint32_t)value);
+            out += 4;
+        }
+        else
+        {
+            uint32_t delta = (uint32_t)value - (uint32_t)writer->previous;
+            while(delta >= 0x80)
+            {
+                *out++ = (uint8_t)(delta | 0x80);
+                delta >>= 7;
+            }
+            *out++ = (uint8_t)delta;
+        }
+        writer->bufferUsed = out - writer->buffer;
+        writer->previous = value;
+        writer->count++;
+        if(writer->bufferUsed > RUN_FILE_BUFFER_SIZE - RUN_FILE_MAX_VALUE_BYTES)
+            runFileWriterFlush(writer);
+    }
+}
+
+/**
+    \brief  Функция дописывает индекс и заголовок и закрывает файл.
+    \return В случае успеха возвращается 0, иначе константа -1.
+*/
+int runFileWriterClose(struct RunFileWriter* writer)
+{
+    runFileWriterFlush(writer);
+    for(uint64_t block = 0; block < writer->nBlocks; block++)
+    {
+        uint64_t left = writer->count - block * RUN_FILE_BLOCK_VALUES;
+        putLe32(writer->index + block * RUN_FILE_INDEX_ENTRY_SIZE + 12,
+                left < RUN_FILE_BLOCK_VALUES ? (uint32_t)left : RUN_FILE_BLOCK_VALUES);
+    }
+    uint64_t indexOffset = writer->fileOffset;
+    if(!writer->isFailed && writer->nBlocks &&
+       pwriteAll(writer->fd, writer->index, writer->nBlocks * RUN_FILE_INDEX_ENTRY_SIZE, indexOffset) == STANDART_ERROR_CODE)
+        writer->isFailed = true;
+
+    uint8_t header[RUN_FILE_HEADER_SIZE];
+    memcpy(header, RUN_FILE_MAGIC, 4);
+    putLe16(header + 4, RUN_FILE_VERSION);
+    putLe16(header + 6, writer->format);
+    putLe32(header + 8, writer->flags);
+    putLe32(header + 12, writer->format == RUN_FORMAT_DELTA ? RUN_FILE_BLOCK_VALUES : 0);
+    putLe64(header + 16, writer->count);
+    putLe64(header + 24, writer->nBlocks);
+    putLe64(header + 32, indexOffset);
+    putLe64(header + 40, RUN_FILE_HEADER_SIZE);
+    if(!writer->isFailed && pwriteAll(writer->fd, header, sizeof(header), 0) == STANDART_ERROR_CODE)
+        writer->isFailed = true;
+
+    if(close(writer->fd) == -1)
+        writer->isFailed = true;
+    bool isFailed = writer->isFailed;
+    free(writer->buffer);
+    free(writer->index);
+    memset(writer, 0, sizeof(struct RunFileWriter));
+    writer->fd = -1;
+    return isFailed ? STANDART_ERROR_CODE : 0;
+}
+
+/**
+    \brief  Функция записывает массив в двоичный файл целиком.
+    \return В случае успеха возвращается 0, иначе константа -1.
+*/
+int writeRunFile(const char* filename, const int* data, size_t count, enum RunFormat format)
+{
+    struct RunFileWriter writer;
+    if(runFileWriterOpen(&writer, filename, format) == STANDART_ERROR_CODE)
+        return STANDART_ERROR_CODE;
+    for(size_t i = 0; i < count; i++)
+        runFileWriterPut(&writer, data[i], 1);
+    return runFileWriterClose(&writer);
+}
+
+/**
+    \brief  Функция переводит имя формата в RunFormat.
+    \param  [in]   name    "text", "raw" или "delta"
+    \param  [out]  format  формат
+    \return true, если имя известно, false иначе.
+*/
+bool parseRunFormat(const char* name, enum RunFormat* format)
+{
+    static const char* names[] = {"text", "raw", "delta"};
+    for(int i = 0; i < 3; i++)
+        if(!strcmp(name, names[i]))
+        {
+            *format = (enum RunFormat)i;
+            return true;
+        }
+    return false;
+}
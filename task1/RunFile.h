@@ -0,0 +1,84 @@
+#pragma once
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RUN_FILE_MAGIC "SRTB"
+#define RUN_FILE_VERSION 1
+/// размер заголовка в байтах
+#define RUN_FILE_HEADER_SIZE 48
+/// размер записи индекса блоков в байтах
+#define RUN_FILE_INDEX_ENTRY_SIZE 16
+/// сколько чисел лежит в одном блоке сжатого файла
+#define RUN_FILE_BLOCK_VALUES 4096
+/// флаг заголовка: числа в файле отсортированы по возрастанию
+#define RUN_FILE_SORTED 1u
+
+/// формат, в котором хранятся числа
+enum RunFormat
+{
+    RUN_FORMAT_TEXT,    ///< текст "%d " как в sorted.txt
+    RUN_FORMAT_RAW,     ///< двоичный: int32 little-endian подряд
+    RUN_FORMAT_DELTA    ///< двоичный: блоки разностей в varint с индексом блоков
+};
+
+/**
+    Двоичный файл, отображенный в память для чтения.
+
+    Раскладка файла (все числа little-endian):
+        заголовок RUN_FILE_HEADER_SIZE байт:
+            magic[4], version u16, format u16, flags u32, blockValues u32,
+            count u64, nBlocks u64, indexOffset u64, dataOffset u64
+        данные:
+            RUN_FORMAT_RAW   - count чисел int32
+            RUN_FORMAT_DELTA - nBlocks блоков: первое число блока int32,
+                               затем разности соседних чисел в varint (LEB128)
+        индекс блоков (только RUN_FORMAT_DELTA), по записи на блок:
+            offset u64 (от начала файла), firstValue i32, count u32
+*/
+struct RunFile
+{
+    const uint8_t* map;
+    size_t mapSize;
+    enum RunFormat format;
+    uint32_t flags;
+    uint32_t blockValues;
+    uint64_t count;
+    uint64_t nBlocks;
+    const uint8_t* data;
+    const uint8_t* index;
+};
+
+/// потоковая запись двоичного файла
+struct RunFileWriter
+{
+    int fd;
+    enum RunFormat format;
+    uint32_t flags;
+    uint64_t count;
+    int previous;
+    bool isFailed;
+
+    uint8_t* buffer;
+    size_t bufferUsed;
+    uint64_t fileOffset;    ///< смещение начала буфера в файле
+
+    uint8_t* index;         ///< индекс блоков, пишется в конец файла
+    uint64_t nBlocks;
+    size_t indexCapacity;
+};
+
+bool isRunFile(const char* filename);
+int runFileOpen(const char* filename, struct RunFile* file);
+void runFileClose(struct RunFile* file);
+size_t runFileDecode(const struct RunFile* file, int* out);
+uint64_t runFileBlocks(const struct RunFile* file, size_t* blockValues);
+size_t runFileDecodeBlock(const struct RunFile* file, uint64_t block, int* out);
+uint64_t runFileLowerBound(const struct RunFile* file, int value);
+
+int runFileWriterOpen(struct RunFileWriter* writer, const char* filename, enum RunFormat format);
+void runFileWriterPut(struct RunFileWriter* writer, int value, size_t count);
+int runFileWriterClose(struct RunFileWriter* writer);
+int writeRunFile(const char* filename, const int* data, size_t count, enum RunFormat format);
+
+bool parseRunFormat(const char* name, enum RunFormat* format);
@@ -0,0 +1,510 @@
+#include "SimdSort.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define SIMD_SORT_X86 1
+#else
+    #define SIMD_SORT_X86 0
+#endif
+
+/*
+    Сортировка и слияние без условных переходов по данным.
+
+    Блок загружается в столько регистров, сколько нужно, округляя до
+    степени двойки (недостающие числа заменяются на INT_MAX). Когда
+    заняты все SIMD_SORT_BLOCK / LANES регистров, сетью сортировки из
+    min/max сортируются столбцы - одинаковые позиции всех регистров, -
+    и после транспонирования каждый регистр оказывается
+    отсортированной серией. Для меньших блоков каждый регистр
+    сортируется отдельно перестановками внутри него. Дальше серии
+    сливаются попарно битоническим слиянием:
+    вторая серия разворачивается, и полученная битоническая
+    последовательность упорядочивается полуочистителями - сначала
+    между регистрами, затем перестановками внутри регистра.
+
+    Два массива сливаются тем же битоническим слиянием двух регистров:
+    младший регистр результата уходит в выход, старший остается и
+    сливается со следующим регистром того массива, у которого меньше
+    очередное число. Когда слияние прерывается, числа старшего
+    регистра возвращаются обратно в массивы: все они не меньше
+    последнего выведенного числа, а равные числа взаимозаменяемы,
+    поэтому достаточно отступить в каждом массиве на столько чисел,
+    сколько их оттуда попало в регистр. Хвосты сливаются скалярно.
+*/
+
+typedef void (*SortBlockImpl)(int* array, size_t n);
+typedef size_t (*MergeTwoImpl)(const int** left, const int* leftEnd, const int** right, const int* rightEnd,
+                               int* out, size_t capacity);
+
+/**
+    \brief  Сортировка вставками блока, скалярная реализация sortBlock().
+*/
+static void sortBlockScalar(int* array, size_t n)
+{
+    for(size_t i = 1; i < n; i++)
+    {
+        int value = array[i];
+        size_t j = i;
+        for(; j > 0 && array[j - 1] > value; j--)
+            array[j] = array[j - 1];
+        array[j] = value;
+    }
+}
+
+/**
+    \brief  Скалярная реализация mergeTwoRuns(), ею же векторные
+            реализации сливают хвосты.
+*/
+static size_t mergeTwoScalar(const int** leftPtr, const int* leftEnd, const int** rightPtr, const int* rightEnd,
+                             int* out, size_t capacity)
+{
+    const int* left = *leftPtr;
+    const int* right = *rightPtr;
+    int* cur = out;
+    int* outEnd = out + capacity;
+    while(cur < outEnd && left < leftEnd && right < rightEnd)
+    {
+        bool isRight = *right < *left;
+        *cur++ = isRight ? *right : *left;
+        right += isRight;
+        left += !isRight;
+    }
+    size_t nLeft = (size_t)(leftEnd - left) < (size_t)(outEnd - cur) ? (size_t)(leftEnd - left) : (size_t)(outEnd - cur);
+    memcpy(cur, left, nLeft * sizeof(int));
+    cur += nLeft;
+    left += nLeft;
+    size_t nRight = (size_t)(rightEnd - right) < (size_t)(outEnd - cur) ? (size_t)(rightEnd - right) : (size_t)(outEnd - cur);
+    memcpy(cur, right, nRight * sizeof(int));
+    cur += nRight;
+    right += nRight;
+    *leftPtr = left;
+    *rightPtr = right;
+    return cur - out;
+}
+
+
+/*
+    Общая часть векторных реализаций для регистра VEC из LANES чисел.
+    LOAD, STORE и SET1 - невыровненные загрузка, выгрузка и размножение
+    числа, COMPARE_SWAP кладет в первый регистр поэлементный минимум,
+    во второй - максимум, REVERSE разворачивает регистр, CLEAN
+    сортирует битоническую последовательность внутри регистра,
+    SORT_REGISTER сортирует произвольный регистр, SORT_COLUMNS сортирует SIMD_SORT_BLOCK / LANES регистров по
+    столбцам и транспонирует их, COUNT_GREATER и COUNT_EQUAL считают
+    числа регистра, большие и равные числу второго регистра.
+*/
+#define DEFINE_SIMD_KERNELS(SUFFIX, TARGET, VEC, LANES, LOAD, STORE, SET1, COMPARE_SWAP, REVERSE, CLEAN, \
+                            SORT_REGISTER, SORT_COLUMNS, COUNT_GREATER, COUNT_EQUAL)                      \
+/* сливает отсортированные regs[0, n/2) и regs[n/2, n) */                                              \
+TARGET static inline void mergeRegisters##SUFFIX(VEC* regs, int n)                                     \
+{                                                                                                       \
+    int half = n / 2;                                                                                   \
+    for(int i = 0; i < half / 2; i++)                                                                   \
+    {                                                                                                   \
+        VEC swap = regs[half + i];                                                                      \
+        regs[half + i] = regs[n - 1 - i];                                                               \
+        regs[n - 1 - i] = swap;                                                                         \
+    }                                                                                                   \
+    for(int i = half; i < n; i++)                                                                       \
+        regs[i] = REVERSE(regs[i]);                                                                     \
+    for(int step = half; step >= 1; step /= 2)                                                          \
+        for(int i = 0; i < n; i++)                                                                      \
+            if(!(i & step))                                                                             \
+                COMPARE_SWAP(&regs[i], &regs[i + step]);                                                \
+    for(int i = 0; i < n; i++)                                                                          \
+        regs[i] = CLEAN(regs[i]);                                                                       \
+}                                                                                                       \
+                                                                                                        \
+TARGET static void sortBlock##SUFFIX(int* array, size_t n)                                             \
+{                                                                                                       \
+    enum { N_REGS = SIMD_SORT_BLOCK / LANES };                                                          \
+    int nRegs = 1;                                                                                      \
+    while((size_t)nRegs * LANES < n)                                                                    \
+        nRegs *= 2;                                                                                     \
+    int block[SIMD_SORT_BLOCK];                                                                         \
+    memcpy(block, array, n * sizeof(int));                                                              \
+    for(size_t i = n; i < (size_t)nRegs * LANES; i++)                                                   \
+        block[i] = INT_MAX;                                                                             \
+    VEC regs[N_REGS];                                                                                   \
+    for(int i = 0; i < nRegs; i++)                                                                      \
+        regs[i] = LOAD(block + i * LANES);                                                              \
+    if(nRegs == N_REGS)                                                                                 \
+        SORT_COLUMNS(regs);                                                                             \
+    else                                                                                                \
+        for(int i = 0; i < nRegs; i++)                                                                  \
+            regs[i] = SORT_REGISTER(regs[i]);                                                           \
+    for(int width = 2; width <= nRegs; width *= 2)                                                      \
+        for(int i = 0; i < nRegs; i += width)                                                           \
+            mergeRegisters##SUFFIX(regs + i, width);                                                    \
+    for(int i = 0; i < nRegs; i++)                                                                      \
+        STORE(block + i * LANES, regs[i]);                                                              \
+    memcpy(array, block, n * sizeof(int));                                                              \
+}                                                                                                       \
+                                                                                                        \
+TARGET static size_t mergeTwo##SUFFIX(const int** leftPtr, const int* leftEnd,                          \
+                                      const int** rightPtr, const int* rightEnd,                        \
+                                      int* out, size_t capacity)                                        \
+{                                                                                                       \
+    const int* left = *leftPtr;                                                                         \
+    const int* right = *rightPtr;                                                                       \
+    int* cur = out;                                                                                     \
+    int* outEnd = out + capacity;                                                                       \
+    if(leftEnd - left >= LANES && rightEnd - right >= LANES && capacity >= LANES)                       \
+    {                                                                                                   \
+        VEC regs[2] = { LOAD(left), LOAD(right) };                                                      \
+        left += LANES;                                                                                  \
+        right += LANES;                                                                                 \
+        mergeRegisters##SUFFIX(regs, 2);                                                                \
+        STORE(cur, regs[0]);                                                                            \
+        cur += LANES;                                                                                   \
+        while(outEnd - cur >= LANES && leftEnd - left >= LANES && rightEnd - right >= LANES)            \
+        {                                                                                               \
+            bool isLeft = *left <= *right;                                                              \
+            regs[0] = regs[1];                                                                          \
+            regs[1] = LOAD(isLeft ? left : right);                                                      \
+            left += isLeft ? LANES : 0;                                                                 \
+            right += isLeft ? 0 : LANES;                                                                \
+            mergeRegisters##SUFFIX(regs, 2);                                                            \
+            STORE(cur, regs[0]);                                                                        \
+            cur += LANES;                                                                               \
+        }                                                                                               \
+        /* возвращаем старший регистр обратно в массивы */                                            \
+        VEC pivot = SET1(cur[-1]);                                                                      \
+        VEC leftTail = LOAD(left - LANES);                                                              \
+        int nGreaterLeft = COUNT_GREATER(leftTail, pivot);                                              \
+        int nEqual = LANES - nGreaterLeft - COUNT_GREATER(LOAD(right - LANES), pivot);                  \
+        int nEqualLeft = COUNT_EQUAL(leftTail, pivot);                                                  \
+        int nFromLeft = nGreaterLeft + (nEqual < nEqualLeft ? nEqual : nEqualLeft);                     \
+        left -= nFromLeft;                                                                              \
+        right -= LANES - nFromLeft;                                                                     \
+    }                                                                                                   \
+    cur += mergeTwoScalar(&left, leftEnd, &right, rightEnd, cur, outEnd - cur);                         \
+    *leftPtr = left;                                                                                    \
+    *rightPtr = right;                                                                                  \
+    return cur - out;                                                                                   \
+}
+
+
+#if SIMD_SORT_X86
+
+//==================================================================================================
+
+//                               AVX2: регистр из 8 чисел
+
+//==================================================================================================
+
+__attribute__((target("avx2")))
+static inline void compareSwapAvx2(__m256i* a, __m256i* b)
+{
+    __m256i low = _mm256_min_epi32(*a, *b);
+    *b = _mm256_max_epi32(*a, *b);
+    *a = low;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i reverseAvx2(__m256i v)
+{
+    return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+}
+
+// компаратор между числами регистра v и other, большие попадают в числа MASK
+#define MIN_MAX_AVX2(v, other, MASK) _mm256_blend_epi32(_mm256_min_epi32(v, other), _mm256_max_epi32(v, other), MASK)
+
+/**
+    \brief  Функция сортирует битоническую последовательность из 8 чисел
+            полуочистителями с шагом 4, 2 и 1.
+*/
+__attribute__((target("avx2")))
+static inline __m256i cleanAvx2(__m256i v)
+{
+    v = MIN_MAX_AVX2(v, _mm256_permute2x128_si256(v, v, 1), 0xF0);
+    v = MIN_MAX_AVX2(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)), 0xCC);
+    return MIN_MAX_AVX2(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)), 0xAA);
+}
+
+/**
+    \brief  Функция сортирует 8 чисел регистра битонической сетью:
+            пары, затем четверки, затем весь регистр.
+*/
+__attribute__((target("avx2")))
+static inline __m256i sortRegisterAvx2(__m256i v)
+{
+    v = MIN_MAX_AVX2(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)), 0xAA);
+    v = MIN_MAX_AVX2(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)), 0xCC);
+    v = MIN_MAX_AVX2(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)), 0xAA);
+    v = MIN_MAX_AVX2(v, reverseAvx2(v), 0xF0);
+    v = MIN_MAX_AVX2(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)), 0xCC);
+    return MIN_MAX_AVX2(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)), 0xAA);
+}
+
+/**
+    \brief  Функция сортирует 8 регистров по столбцам сетью из 19
+            компараторов и транспонирует их, так что каждый регистр
+            становится отсортированной серией из 8 чисел.
+*/
+__attribute__((target("avx2")))
+static inline void sortColumnsAvx2(__m256i* r)
+{
+#define CS(a, b) compareSwapAvx2(&r[a], &r[b])
+    CS(0, 2); CS(1, 3);
+    CS(4, 6); CS(5, 7);
+    CS(0, 4); CS(1, 5);
+    CS(2, 6); CS(3, 7);
+    CS(0, 1); CS(2, 3);
+    CS(4, 5); CS(6, 7);
+    CS(2, 4); CS(3, 5);
+    CS(1, 4); CS(3, 6);
+    CS(1, 2); CS(3, 4);
+    CS(5, 6);
+#undef CS
+
+    __m256i t[8], u[8];
+    for(int i = 0; i < 8; i += 2)
+    {
+        t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+        t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+    }
+    for(int i = 0; i < 8; i += 4)
+    {
+        u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+        u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+        u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+        u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+    }
+    for(int i = 0; i < 4; i++)
+    {
+        r[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+        r[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+    }
+}
+
+__attribute__((target("avx2")))
+static inline int countGreaterAvx2(__m256i v, __m256i pivot)
+{
+    return __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, pivot))));
+}
+
+__attribute__((target("avx2")))
+static inline int countEqualAvx2(__m256i v, __m256i pivot)
+{
+    return __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, pivot))));
+}
+
+#define LOAD_AVX2(p) _mm256_loadu_si256((const __m256i*)(p))
+#define STORE_AVX2(p, v) _mm256_storeu_si256((__m256i*)(p), v)
+
+DEFINE_SIMD_KERNELS(Avx2, __attribute__((target("avx2"))), __m256i, 8, LOAD_AVX2, STORE_AVX2,
+                    _mm256_set1_epi32, compareSwapAvx2, reverseAvx2, cleanAvx2, sortRegisterAvx2, sortColumnsAvx2,
+                    countGreaterAvx2, countEqualAvx2)
+
+
+//==================================================================================================
+
+//                               SSE4.1: регистр из 4 чисел
+
+//==================================================================================================
+
+__attribute__((target("sse4.1")))
+static inline void compareSwapSse41(__m128i* a, __m128i* b)
+{
+    __m128i low = _mm_min_epi32(*a, *b);
+    *b = _mm_max_epi32(*a, *b);
+    *a = low;
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i reverseSse41(__m128i v)
+{
+    return _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+}
+
+// компаратор между числами регистра v и other, большие попадают в числа MASK
+#define MIN_MAX_SSE41(v, other, MASK) _mm_blend_epi16(_mm_min_epi32(v, other), _mm_max_epi32(v, other), MASK)
+
+/**
+    \brief  Функция сортирует битоническую последовательность из 4 чисел
+            полуочистителями с шагом 2 и 1.
+*/
+__attribute__((target("sse4.1")))
+static inline __m128i cleanSse41(__m128i v)
+{
+    v = MIN_MAX_SSE41(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)), 0xF0);
+    return MIN_MAX_SSE41(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)), 0xCC);
+}
+
+/**
+    \brief  Функция сортирует 4 числа регистра битонической сетью.
+*/
+__attribute__((target("sse4.1")))
+static inline __m128i sortRegisterSse41(__m128i v)
+{
+    v = MIN_MAX_SSE41(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)), 0xCC);
+    v = MIN_MAX_SSE41(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)), 0xF0);
+    return MIN_MAX_SSE41(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)), 0xCC);
+}
+
+/**
+    \brief  Функция сортирует каждую четверку из 16 регистров по
+            столбцам сетью из 5 компараторов и транспонирует ее, так что
+            каждый регистр становится отсортированной серией из 4 чисел.
+*/
+__attribute__((target("sse4.1")))
+static inline void sortColumnsSse41(__m128i* regs)
+{
+    for(int group = 0; group < 16; group += 4)
+    {
+        __m128i* r = regs + group;
+#define CS(a, b) compareSwapSse41(&r[a], &r[b])
+        CS(0, 1); CS(2, 3);
+        CS(0, 2); CS(1, 3);
+        CS(1, 2);
+#undef CS
+
+        __m128i t0 = _mm_unpacklo_epi32(r[0], r[1]);
+        __m128i t1 = _mm_unpacklo_epi32(r[2], r[3]);
+        __m128i t2 = _mm_unpackhi_epi32(r[0], r[1]);
+        __m128i t3 = _mm_unpackhi_epi32(r[2], r[3]);
+        r[0] = _mm_unpacklo_epi64(t0, t1);
+        r[1] = _mm_unpackhi_epi64(t0, t1);
+        r[2] = _mm_unpacklo_epi64(t2, t3);
+        r[3] = _mm_unpackhi_epi64(t2, t3);
+    }
+}
+
+__attribute__((target("sse4.1")))
+static inline int countGreaterSse41(__m128i v, __m128i pivot)
+{
+    return __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, pivot))));
+}
+
+__attribute__((target("sse4.1")))
+static inline int countEqualSse41(__m128i v, __m128i pivot)
+{
+    return __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, pivot))));
+}
+
+#define LOAD_SSE41(p) _mm_loadu_si128((const __m128i*)(p))
+#define STORE_SSE41(p, v) _mm_storeu_si128((__m128i*)(p), v)
+
+DEFINE_SIMD_KERNELS(Sse41, __attribute__((target("sse4.1"))), __m128i, 4, LOAD_SSE41, STORE_SSE41,
+                    _mm_set1_epi32, compareSwapSse41, reverseSse41, cleanSse41, sortRegisterSse41, sortColumnsSse41,
+                    countGreaterSse41, countEqualSse41)
+
+#endif
+
+
+static SortBlockImpl sortBlockImpl = NULL;
+static MergeTwoImpl mergeTwoImpl = NULL;
+static const char* simdSortImplName = NULL;
+static pthread_once_t simdSortOnce = PTHREAD_ONCE_INIT;
+
+/**
+    \brief  Функция ставит реализацию ядер с именем name.
+    \return false, если такой реализации нет или процессор ее не
+            поддерживает (выбранная реализация тогда не меняется).
+*/
+static bool setSimdSort(const char* name)
+{
+    if(!strcmp(name, "scalar"))
+    {
+        simdSortImplName = "scalar";
+        sortBlockImpl = sortBlockScalar;
+        mergeTwoImpl = mergeTwoScalar;
+        return true;
+    }
+#if SIMD_SORT_X86
+    __builtin_cpu_init();
+    if(!strcmp(name, "sse4.1") && __builtin_cpu_supports("sse4.1"))
+    {
+        simdSortImplName = "sse4.1";
+        sortBlockImpl = sortBlockSse41;
+        mergeTwoImpl = mergeTwoSse41;
+        return true;
+    }
+    if(!strcmp(name, "avx2") && __builtin_cpu_supports("avx2"))
+    {
+        simdSortImplName = "avx2";
+        sortBlockImpl = sortBlockAvx2;
+        mergeTwoImpl = mergeTwoAvx2;
+        return true;
+    }
+#endif
+    return false;
+}
+
+/**
+    \brief  Выбирает реализацию под текущий процессор.
+    \note   Переменной окружения SIMD_SORT=avx2|sse4.1|scalar можно
+            принудительно выбрать реализацию (например, для сравнения).
+            Вызывается ровно один раз через pthread_once(): ядра
+            вызываются из нескольких исполнителей сразу.
+*/
+static void resolveSimdSort()
+{
+    const char* forced = getenv("SIMD_SORT");
+    if(forced && setSimdSort(forced))
+        return;
+    if(!setSimdSort("avx2") && !setSimdSort("sse4.1"))
+        setSimdSort("scalar");
+}
+
+/**
+    \brief  Функция выбирает реализацию ядер по имени.
+    \param  [in]  name  "avx2", "sse4.1" или "scalar"
+    \return false, если такой реализации нет или процессор ее не
+            поддерживает (выбранная реализация тогда не меняется).
+    \note   Вызывается до запуска исполнителей: сами ядра читают
+            выбранную реализацию без синхронизации.
+*/
+bool selectSimdSort(const char* name)
+{
+    pthread_once(&simdSortOnce, resolveSimdSort);
+    return setSimdSort(name);
+}
+
+/**
+    \brief  Функция сортирует блок из не более чем SIMD_SORT_BLOCK чисел.
+    \param  [in,out]  array  блок
+    \param  [in]      n      размер блока
+*/
+void sortBlock(int* array, size_t n)
+{
+    pthread_once(&simdSortOnce, resolveSimdSort);
+    if(n > 1)
+        sortBlockImpl(array, n);
+}
+
+/**
+    \brief  Функция сливает два отсортированных массива, пока не
+            закончатся оба или место в out.
+    \param  [in,out]  left      начало левого массива, сдвигается на
+                                число забранных из него чисел
+    \param  [in]      leftEnd   конец левого массива
+    \param  [in,out]  right     то же для правого массива
+    \param  [in]      rightEnd  конец правого массива
+    \param  [out]     out       выход, не должен пересекаться с массивами
+    \param  [in]      capacity  сколько чисел поместится в out
+    \return Число записанных чисел.
+    \note   Если место кончилось, слияние можно продолжить следующим
+            вызовом с теми же указателями.
+*/
+size_t mergeTwoRuns(const int** left, const int* leftEnd, const int** right, const int* rightEnd,
+                    int* out, size_t capacity)
+{
+    pthread_once(&simdSortOnce, resolveSimdSort);
+    return mergeTwoImpl(left, leftEnd, right, rightEnd, out, capacity);
+}
+
+/**
+    \brief  Функция возвращает имя выбранной реализации ядер.
+*/
+const char* simdSortName()
+{
+    pthread_once(&simdSortOnce, resolveSimdSort);
+    return simdSortImplName;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+    Векторные ядра сортировки: сеть сортировки блока до
+    SIMD_SORT_BLOCK чисел в регистрах и битоническое слияние двух
+    отсортированных массивов.
+
+    Реализация выбирается при первом вызове под текущий процессор:
+    AVX2, SSE4.1 или скалярная. Переменной окружения
+    SIMD_SORT=avx2|sse4.1|scalar, как и функцией selectSimdSort(),
+    можно выбрать реализацию принудительно.
+*/
+
+/// столько чисел помещается в регистры сети сортировки
+#define SIMD_SORT_BLOCK 64
+
+void sortBlock(int* array, size_t n);
+size_t mergeTwoRuns(const int** left, const int* leftEnd, const int** right, const int* rightEnd,
+                    int* out, size_t capacity);
+const char* simdSortName();
+bool selectSimdSort(const char* name);
@@ -0,0 +1,914 @@
+#include "Sort.h"
+#include "SimdSort.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/*
+    Сортировка слиянием снизу вверх без рекурсии.
+
+    Массив делится на блоки по MERGE_BLOCK_SIZE чисел, которые вместе
+    с такой же частью буфера помещаются в L2. Каждый блок сортируется
+    целиком, пока он в кэше: серии по SIMD_SORT_BLOCK чисел сортируются
+    в регистрах сетью sortBlock(), затем сливаются попарно векторным
+    mergeTwoRuns(), удваиваясь. После этого попарно сливаются уже
+    отсортированные блоки. Данные на каждом
+    проходе перекладываются между массивом и одним буфером из кучи
+    того же размера, так что на стеке ничего не выделяется и размер
+    массива ограничен только памятью.
+*/
+
+#define MERGE_BLOCK_SIZE (128 * 1024 / sizeof(int))
+
+/**
+    \brief  Один проход слияния: соседние серии длины width из src
+            попарно сливаются в dst.
+    \note   Если серии уже идут по порядку, они просто копируются.
+*/
+static void mergePass(const int* src, int* dst, size_t n, size_t width)
+{
+    for(size_t begin = 0; begin < n; begin += 2 * width)
+    {
+        size_t middle = begin + width < n ? begin + width : n;
+        size_t end = middle + width < n ? middle + width : n;
+        const int* left = src + begin;
+        const int* right = src + middle;
+        if(middle == end || src[middle - 1] <= src[middle])
+            memcpy(dst + begin, src + begin, (end - begin) * sizeof(int));
+        else
+            mergeTwoRuns(&left, src + middle, &right, src + end, dst + begin, end - begin);
+    }
+}
+
+/**
+    \brief  Функция сливает серии длины width в одну, перекладывая их
+            между array и scratch.
+    \return Где оказался результат: array или scratch.
+*/
+static int* mergeUp(int* array, int* scratch, size_t n, size_t width)
+{
+    int* src = array;
+    int* dst = scratch;
+    for(; width < n; width *= 2)
+    {
+        mergePass(src, dst, n, width);
+        int* tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    return src;
+}
+
+/**
+    \brief  Сортировка слиянием снизу вверх.
+    \return false, если не удалось выделить память под буфер
+            (массив в этом случае не изменяется).
+*/
+static bool mergeSort(int* array, size_t n)
+{
+    int* scratch = (int*)malloc(n * sizeof(int));
+    if(!scratch)
+        return false;
+
+    for(size_t block = 0; block < n; block += MERGE_BLOCK_SIZE)
+    {
+        size_t size = n - block < MERGE_BLOCK_SIZE ? n - block : MERGE_BLOCK_SIZE;
+        for(size_t run = 0; run < size; run += SIMD_SORT_BLOCK)
+            sortBlock(array + block + run, size - run < SIMD_SORT_BLOCK ? size - run : SIMD_SORT_BLOCK);
+        if(mergeUp(array + block, scratch + block, size, SIMD_SORT_BLOCK) != array + block)
+            memcpy(array + block, scratch + block, size * sizeof(int));
+    }
+    if(mergeUp(array, scratch, n, MERGE_BLOCK_SIZE) != array)
+        memcpy(array, scratch, n * sizeof(int));
+    free(scratch);
+    return true;
+}
+
+///реализация сортировки кучей
+static void heapify(int* array, size_t n, size_t i)
+{
+    size_t largest = i;
+    size_t l = (i << 1) + 1;
+    size_t r = l + 1; 
+
+    if(l < n) largest = array[l] > array[largest] ? l : largest; 
+    if(r < n) largest = array[r] > array[largest] ? r : largest; 
+
+    if(largest != i)
+    {
+        array[i] ^= array[largest];
+        array[largest] ^= array[i];
+        array[i] ^= array[largest];
+
+        heapify(array, n, largest);
+    }
+}
+
+static void heapSort(int* array, size_t n)
+{
+    for(size_t i = n>>1; i-- > 0;)
+        heapify(array, n, i);
+
+    for(size_t i = n -1; i > 0; i--)
+    {
+        array[0] ^= array[i];
+        array[i] ^= array[0];
+        array[0] ^= array[i];
+
+        heapify(array, i, 0);
+    }
+}
+
+
+/*
+    LSD поразрядная сортировка 32-битных ключей.
+
+    Чтобы отрицательные числа оказались перед положительными, ключом
+    служит число с инвертированным знаковым битом. Для небольших
+    массивов используются 4 прохода по 8 бит, для больших - 3 прохода
+    по 11 бит: гистограмма из 2048 счетчиков все еще помещается в L1.
+    Гистограммы всех разрядов строятся за один проход по массиву,
+    а разряды, в которых все ключи совпадают, пропускаются. Данные
+    перекладываются между массивом и одним буфером того же размера.
+*/
+
+#define RADIX_SMALL_BITS 8
+#define RADIX_LARGE_BITS 11
+#define RADIX_LARGE_THRESHOLD (1 << 16)
+#define RADIX_MAX_PASSES 4
+// на столько элементов вперед подгружается вход, но не за его конец
+#define RADIX_PREFETCH_DISTANCE 64
+
+static inline uint32_t radixKey(int value)
+{
+    return (uint32_t)value ^ 0x80000000u;
+}
+
+/**
+    \brief  Поразрядная сортировка массива.
+    \return false, если не удалось выделить память под буфер
+            (массив в этом случае не изменяется).
+*/
+static bool radixSort(int* array, size_t n)
+{
+    unsigned bits = n < RADIX_LARGE_THRESHOLD ? RADIX_SMALL_BITS : RADIX_LARGE_BITS;
+    unsigned nPasses = (32 + bits - 1) / bits;
+    size_t nBuckets = (size_t)1 << bits;
+    uint32_t mask = (uint32_t)nBuckets - 1;
+
+    int* scratch = (int*)malloc(n * sizeof(int));
+    size_t* histograms = (size_t*)calloc(nPasses * nBuckets, sizeof(size_t));
+    if(!scratch || !histograms)
+    {
+        free(scratch);
+        free(histograms);
+        return false;
+    }
+
+    for(size_t i = 0; i < n; i++)
+    {
+        if(i + RADIX_PREFETCH_DISTANCE < n)
+            __builtin_prefetch(&array[i + RADIX_PREFETCH_DISTANCE]);
+        uint32_t key = radixKey(array[i]);
+        for(unsigned pass = 0; pass < nPasses; pass++)
+            histograms[pass * nBuckets + ((key >> (pass * bits)) & mask)]++;
+    }
+
+    int* src = array;
+    int* dst = scratch;
+    for(unsigned pass = 0; pass < nPasses; pass++)
+    {
+        size_t* histogram = histograms + pass * nBuckets;
+        unsigned shift = pass * bits;
+        if(histogram[(radixKey(src[0]) >> shift) & mask] == n)
+            continue;
+
+        //переводим счетчики в позиции начала корзин
+        size_t offset = 0;
+        for(size_t bucket = 0; bucket < nBuckets; bucket++)
+        {
+            size_t count = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += count;
+        }
+
+        for(size_t i = 0; i < n; i++)
+        {
+            if(i + RADIX_PREFETCH_DISTANCE < n)
+                __builtin_prefetch(&src[i + RADIX_PREFETCH_DISTANCE]);
+            int value = src[i];
+            dst[histogram[(radixKey(value) >> shift) & mask]++] = value;
+        }
+
+        int* tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if(src != array)
+        memcpy(array, src, n * sizeof(int));
+    free(scratch);
+    free(histograms);
+    return true;
+}
+
+
+/*
+    Адаптивная сортировка естественным слиянием в духе powersort.
+
+    За один проход массив делится на серии: неубывающие остаются как
+    есть, строго убывающие разворачиваются на месте. Короткие серии
+    дополняются до ADAPTIVE_MIN_RUN вставками. Порядок слияний задает
+    "мощность" границы между соседними сериями - глубина, на которой
+    эта граница оказалась бы в идеальном дереве слияний, построенном
+    по положениям середин серий. Так стек серий остается логарифмической
+    глубины, а слияния близки к оптимальным по числу сравнений.
+
+    При слиянии в буфер копируется только короче из двух серий, а
+    уже стоящие на месте начало левой и конец правой серии находятся
+    экспоненциальным поиском (галопом). Когда одна серия выигрывает
+    ADAPTIVE_MIN_GALLOP сравнений подряд, слияние тоже переходит на
+    галоп и переносит элементы блоками. Отсортированный массив - это
+    одна серия, он проверяется за O(n) без выделения памяти.
+*/
+
+#define ADAPTIVE_MIN_RUN 32
+#define ADAPTIVE_MIN_GALLOP 7
+#define ADAPTIVE_MAX_RUNS 128
+
+struct SortRun
+{
+    size_t begin;
+    size_t length;
+    unsigned power;     ///< мощность границы с следующей серией
+};
+
+/**
+    \brief  Функция находит серию, начинающуюся с begin, и
+            разворачивает ее, если она строго убывает.
+    \return Конец серии.
+*/
+static size_t findRun(int* array, size_t begin, size_t n)
+{
+    size_t end = begin + 1;
+    if(end == n)
+        return end;
+    if(array[end] < array[begin])
+    {
+        while(end + 1 < n && array[end + 1] < array[end])
+            end++;
+        end++;
+        for(size_t l = begin, r = end - 1; l < r; l++, r--)
+        {
+            int tmp = array[l];
+            array[l] = array[r];
+            array[r] = tmp;
+        }
+        return end;
+    }
+    while(end + 1 < n && array[end + 1] >= array[end])
+        end++;
+    return end + 1;
+}
+
+/**
+    \brief  Функция дополняет отсортированное начало [begin, sorted)
+            до [begin, end) вставками с двоичным поиском места.
+*/
+static void binaryInsertionSort(int* array, size_t begin, size_t sorted, size_t end)
+{
+    for(size_t i = sorted; i < end; i++)
+    {
+        int value = array[i];
+        size_t lo = begin;
+        size_t hi = i;
+        while(lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+            if(array[mid] <= value)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        memmove(&array[lo + 1], &array[lo], (i - lo) * sizeof(int));
+        array[lo] = value;
+    }
+}
+
+/**
+    \brief  Функция вычисляет мощность границы между сериями
+            [begin, begin + n1) и [begin + n1, begin + n1 + n2).
+    \param  [in]  n  размер всего массива
+    \details Мощность - номер первого двоичного разряда, в котором
+             различаются середины серий, деленные на n.
+*/
+static unsigned nodePower(size_t begin, size_t n1, size_t n2, size_t n)
+{
+    unsigned power = 0;
+    size_t a = 2 * begin + n1;
+    size_t b = a + n1 + n2;
+    for(;;)
+    {
+        power++;
+        if(a >= n)
+        {
+            a -= n;
+            b -= n;
+        }
+        else if(b >= n)
+            break;
+        a <<= 1;
+        b <<= 1;
+    }
+    return power;
+}
+
+/**
+    \brief  Функция считает, сколько первых элементов array
+            меньше key (или не больше, если orEqual).
+    \note   Поиск экспоненциальный от начала, поэтому короткий
+            ответ находится за O(log ответа) сравнений.
+*/
+static size_t gallopFromStart(const int* array, size_t n, int key, bool orEqual)
+{
+    size_t bound = 1;
+    while(bound <= n && (orEqual ? array[bound - 1] <= key : array[bound - 1] < key))
+        bound <<= 1;
+    size_t lo = bound >> 1;
+    size_t hi = bound < n ? bound : n;
+    while(lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if(orEqual ? array[mid] <= key : array[mid] < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/**
+    \brief  Функция считает, сколько последних элементов array
+            больше key (или не меньше, если orEqual).
+*/
+static size_t gallopFromEnd(const int* array, size_t n, int key, bool orEqual)
+{
+    size_t bound = 1;
+    while(bound <= n && (orEqual ? array[n - bound] >= key : array[n - bound] > key))
+        bound <<= 1;
+    size_t lo = bound >> 1;
+    size_t hi = bound < n ? bound : n;
+    while(lo < hi)
+    {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        if(orEqual ? array[n - mid] >= key : array[n - mid] > key)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+/**
+    \brief  Слияние, когда левая серия короче: она копируется в
+            буфер, и результат пишется от начала к концу.
+*/
+static void mergeLow(int* out, size_t nLeft, size_t nRight, int* scratch)
+{
+    memcpy(scratch, out, nLeft * sizeof(int));
+    const int* left = scratch;
+    const int* right = out + nLeft;
+    const int* leftEnd = left + nLeft;
+    const int* rightEnd = right + nRight;
+
+    while(left < leftEnd && right < rightEnd)
+    {
+        unsigned leftWins = 0;
+        unsigned rightWins = 0;
+        while(left < leftEnd && right < rightEnd &&
+              leftWins < ADAPTIVE_MIN_GALLOP && rightWins < ADAPTIVE_MIN_GALLOP)
+        {
+            if(*right < *left)
+            {
+                *out++ = *right++;
+                rightWins++;
+                leftWins = 0;
+            }
+            else
+            {
+                *out++ = *left++;
+                leftWins++;
+                rightWins = 0;
+            }
+        }
+
+        while(left < leftEnd && right < rightEnd)
+        {
+            size_t nFromLeft = gallopFromStart(left, leftEnd - left, *right, true);
+            memcpy(out, left, nFromLeft * sizeof(int));
+            out += nFromLeft;
+            left += nFromLeft;
+            if(left == leftEnd)
+                break;
+            size_t nFromRight = gallopFromStart(right, rightEnd - right, *left, false);
+            memmove(out, right, nFromRight * sizeof(int));
+            out += nFromRight;
+            right += nFromRight;
+            if(nFromLeft < ADAPTIVE_MIN_GALLOP && nFromRight < ADAPTIVE_MIN_GALLOP)
+                break;
+        }
+    }
+    //остаток правой серии уже стоит на месте
+    memcpy(out, left, (leftEnd - left) * sizeof(int));
+}
+
+/**
+    \brief  Слияние, когда правая серия короче: она копируется в
+            буфер, и результат пишется от конца к началу.
+*/
+static void mergeHigh(int* begin, size_t nLeft, size_t nRight, int* scratch)
+{
+    memcpy(scratch, begin + nLeft, nRight * sizeof(int));
+    int* out = begin + nLeft + nRight;
+    const int* left = begin + nLeft;    // левая серия - [begin, left)
+    const int* right = scratch + nRight;// правая серия - [scratch, right)
+
+    while(left > begin && right > scratch)
+    {
+        unsigned leftWins = 0;
+        unsigned rightWins = 0;
+        while(left > begin && right > scratch &&
+              leftWins < ADAPTIVE_MIN_GALLOP && rightWins < ADAPTIVE_MIN_GALLOP)
+        {
+            if(right[-1] < left[-1])
+            {
+                *--out = *--left;
+                leftWins++;
+                rightWins = 0;
+            }
+            else
+            {
+                *--out = *--right;
+                rightWins++;
+                leftWins = 0;
+            }
+        }
+
+        while(left > begin && right > scratch)
+        {
+            size_t nFromRight = gallopFromEnd(scratch, right - scratch, left[-1], true);
+            out -= nFromRight;
+            right -= nFromRight;
+            memcpy(out, right, nFromRight * sizeof(int));
+            if(right == scratch)
+                break;
+            size_t nFromLeft = gallopFromEnd(begin, left - begin, right[-1], false);
+            out -= nFromLeft;
+            left -= nFromLeft;
+            memmove(out, left, nFromLeft * sizeof(int));
+            if(nFromLeft < ADAPTIVE_MIN_GALLOP && nFromRight < ADAPTIVE_MIN_GALLOP)
+                break;
+        }
+    }
+    //остаток левой серии уже стоит на месте
+    memcpy(begin, scratch, (right - scratch) * sizeof(int));
+}
+
+/**
+    \brief  Функция сливает соседние серии [begin, begin + nLeft) и
+            [begin + nLeft, begin + nLeft + nRight).
+    \param  [in]  scratch  буфер не меньше половины массива
+*/
+static void mergeRuns(int* array, size_t begin, size_t nLeft, size_t nRight, int* scratch)
+{
+    int* left = array + begin;
+    int* right = left + nLeft;
+    //начало левой серии, не большее первого элемента правой, уже на месте
+    size_t skip = gallopFromStart(left, nLeft, right[0], true);
+    left += skip;
+    nLeft -= skip;
+    if(!nLeft)
+        return;
+    //и конец правой серии, больший последнего элемента левой
+    nRight -= gallopFromEnd(right, nRight, right[-1], false);
+    if(!nRight)
+        return;
+
+    if(nLeft <= nRight)
+        mergeLow(left, nLeft, nRight, scratch);
+    else
+        mergeHigh(left, nLeft, nRight, scratch);
+}
+
+/**
+    \brief  Адаптивная сортировка массива естественным слиянием.
+    \return false, если не удалось выделить память под буфер
+            (массив в этом случае может быть частично упорядочен).
+*/
+static bool adaptiveSort(int* array, size_t n)
+{
+    struct SortRun runs[ADAPTIVE_MAX_RUNS];
+    int nRuns = 0;
+    int* scratch = NULL;
+
+    for(size_t begin = 0; begin < n;)
+    {
+        size_t end = findRun(array, begin, n);
+        if(begin == 0 && end == n)
+            return true;
+        if(end - begin < ADAPTIVE_MIN_RUN && end < n)
+        {
+            size_t forcedEnd = n - begin < ADAPTIVE_MIN_RUN ? n : begin + ADAPTIVE_MIN_RUN;
+            binaryInsertionSort(array, begin, end, forcedEnd);
+            end = forcedEnd;
+        }
+        if(nRuns)
+        {
+            if(!scratch)
+                scratch = (int*)malloc((n / 2 + 1) * sizeof(int));
+            if(!scratch)
+                return false;
+            unsigned power = nodePower(runs[nRuns - 1].begin, runs[nRuns - 1].length, end - begin, n);
+            while(nRuns > 1 && runs[nRuns - 2].power > power)
+            {
+                mergeRuns(array, runs[nRuns - 2].begin, runs[nRuns - 2].length,
+                          runs[nRuns - 1].length, scratch);
+                runs[nRuns - 2].length += runs[nRuns - 1].length;
+                nRuns--;
+            }
+            runs[nRuns - 1].power = power;
+        }
+        runs[nRuns++] = (struct SortRun){begin, end - begin, 0};
+        begin = end;
+    }
+
+    for(; nRuns > 1; nRuns--)
+    {
+        mergeRuns(array, runs[nRuns - 2].begin, runs[nRuns - 2].length, runs[nRuns - 1].length, scratch);
+        runs[nRuns - 2].length += runs[nRuns - 1].length;
+    }
+    free(scratch);
+    return true;
+}
+
+
+/*
+    Сортировка подсчетом для узкого диапазона значений: по счетчику на
+    каждое значение от min до max, два прохода по массиву.
+
+    Если диапазон широк, но разных значений мало, счетчики заводятся
+    только для встреченных значений: они хранятся в упорядоченном
+    словаре, и каждое число ищется в нем двоичным поиском.
+*/
+
+#define COUNTING_MAX_RANGE (1 << 24)
+#define DICTIONARY_MAX_VALUES 1024
+
+/**
+    \brief  Сортировка подсчетом массива со значениями из [min, max].
+    \return false, если диапазон слишком широк или не удалось выделить
+            память под счетчики (массив в этом случае не изменяется).
+*/
+static bool countingSort(int* array, size_t n, int min, int max)
+{
+    uint32_t range = (uint32_t)max - (uint32_t)min;
+    if(range >= COUNTING_MAX_RANGE || n > UINT32_MAX)
+        return false;
+    uint32_t* counts = (uint32_t*)calloc((size_t)range + 1, sizeof(uint32_t));
+    if(!counts)
+        return false;
+    for(size_t i = 0; i < n; i++)
+        counts[(uint32_t)array[i] - (uint32_t)min]++;
+    int* out = array;
+    for(uint32_t value = 0; value <= range; value++)
+        for(uint32_t count = counts[value]; count; count--)
+            *out++ = (int)((uint32_t)min + value);
+    free(counts);
+    return true;
+}
+
+/**
+    \brief  Сортировка подсчетом по словарю встреченных значений.
+    \return false, если разных значений больше DICTIONARY_MAX_VALUES
+            или не удалось выделить память (массив в этом случае не
+            изменяется).
+    \note   Словарь - хеш-таблица с открытой адресацией, заполненная
+            не больше чем наполовину, поэтому число почти всегда
+            находится с первой пробы. Упорядочиваются потом только
+            ключи таблицы.
+*/
+static bool dictionarySort(int* array, size_t n)
+{
+    enum { TABLE_SIZE = 2 * DICTIONARY_MAX_VALUES, TABLE_BITS = 11 };
+    int* keys = (int*)malloc(TABLE_SIZE * sizeof(int));
+    size_t* counts = (size_t*)calloc(TABLE_SIZE, sizeof(size_t));
+    bool isOk = keys && counts;
+    size_t nValues = 0;
+    for(size_t i = 0; isOk && i < n; i++)
+    {
+        int value = array[i];
+        uint32_t slot = ((uint32_t)value * 2654435761u) >> (32 - TABLE_BITS);
+        while(counts[slot] && keys[slot] != value)
+            slot = (slot + 1) & (TABLE_SIZE - 1);
+        if(!counts[slot])
+        {
+            isOk = nValues < DICTIONARY_MAX_VALUES;
+            keys[slot] = value;
+            nValues++;
+        }
+        counts[slot]++;
+    }
+    if(isOk)
+    {
+        size_t nUsed = 0;
+        for(size_t slot = 0; slot < TABLE_SIZE; slot++)
+            if(counts[slot])
+            {
+                keys[nUsed] = keys[slot];
+                counts[nUsed++] = counts[slot];
+            }
+        // вставками: значений немного, а ключи и счетчики переставляются вместе
+        for(size_t i = 1; i < nUsed; i++)
+        {
+            int key = keys[i];
+            size_t count = counts[i];
+            size_t j = i;
+            for(; j > 0 && keys[j - 1] > key; j--)
+            {
+                keys[j] = keys[j - 1];
+                counts[j] = counts[j - 1];
+            }
+            keys[j] = key;
+            counts[j] = count;
+        }
+        int* out = array;
+        for(size_t i = 0; i < nUsed; i++)
+            for(size_t count = counts[i]; count; count--)
+                *out++ = keys[i];
+    }
+    free(keys);
+    free(counts);
+    return isOk;
+}
+
+/**
+    \brief  Функция находит наименьшее и наибольшее значения массива.
+*/
+static void findRange(const int* array, size_t n, int* min, int* max)
+{
+    int low = array[0];
+    int high = array[0];
+    for(size_t i = 1; i < n; i++)
+    {
+        low = array[i] < low ? array[i] : low;
+        high = array[i] > high ? array[i] : high;
+    }
+    *min = low;
+    *max = high;
+}
+
+
+/*
+    Выбор алгоритма для --algorithm=auto.
+
+    Перед сортировкой массив проходится один раз: находятся точные
+    min и max (они нужны сортировке подсчетом) и число мест, где
+    соседние числа убывают и где возрастают. Меньшее из двух чисел
+    плюс один оценивает число серий, которые найдет адаптивная
+    сортировка. Число разных значений оценивается по выборке из
+    PLAN_SAMPLE_SIZE равноотстоящих элементов оценкой GEE: значения,
+    встреченные в выборке один раз, масштабируются на sqrt(n / s),
+    остальные считаются по одному разу.
+
+    Правила проверяются по порядку:
+      - маленький массив, отсортированный массив или массив из длинных
+        серий сортируется адаптивно, почти за O(n);
+      - узкий диапазон, не шире PLAN_COUNTING_FACTOR * n значений, -
+        подсчетом;
+      - мало разных значений при широком диапазоне - подсчетом по
+        словарю: оценка не больше PLAN_MAX_DISTINCT и в
+        PLAN_DISTINCT_FACTOR раз меньше n;
+      - остальное - поразрядно.
+*/
+
+#define PLAN_SMALL_ARRAY 256
+#define PLAN_MIN_AVERAGE_RUN 32
+#define PLAN_COUNTING_FACTOR 2
+#define PLAN_SAMPLE_SIZE 1024
+// запас на ошибку оценки: словарь вмещает DICTIONARY_MAX_VALUES значений
+#define PLAN_MAX_DISTINCT (DICTIONARY_MAX_VALUES / 2)
+#define PLAN_DISTINCT_FACTOR 16
+
+/**
+    \brief  Функция оценивает число разных значений массива по выборке.
+    \param  [in]  range  max - min + 1, оценка его не превышает
+*/
+static size_t estimateDistinct(const int* array, size_t n, uint64_t range)
+{
+    int sample[PLAN_SAMPLE_SIZE];
+    size_t nSample = n < PLAN_SAMPLE_SIZE ? n : PLAN_SAMPLE_SIZE;
+    for(size_t i = 0; i < nSample; i++)
+        sample[i] = array[i * n / nSample];
+    heapSort(sample, nSample);
+
+    size_t nDistinct = 0;
+    size_t nSingles = 0;
+    for(size_t i = 0; i < nSample;)
+    {
+        size_t j = i + 1;
+        while(j < nSample && sample[j] == sample[i])
+            j++;
+        nDistinct++;
+        nSingles += j - i == 1;
+        i = j;
+    }
+    double estimate = sqrt((double)n / nSample) * nSingles + (nDistinct - nSingles);
+    if(estimate > (double)n)
+        estimate = n;
+    if(estimate > (double)range)
+        estimate = range;
+    return (size_t)estimate;
+}
+
+/**
+    \brief  Функция выбирает алгоритм сортировки массива.
+    \param  [in]   array  массив, он не изменяется
+    \param  [in]   size   размер массива
+    \param  [out]  plan   выбранный алгоритм, собранная статистика и
+                          причина выбора
+*/
+void planSort(const int* array, size_t size, struct SortPlan* plan)
+{
+    memset(plan, 0, sizeof(*plan));
+    plan->size = size;
+    plan->nRuns = size ? 1 : 0;
+    if(size <= 1)
+    {
+        plan->algorithm = SORT_ADAPTIVE;
+        plan->reason = "nothing to sort";
+        return;
+    }
+
+    size_t nDescents = 0;
+    size_t nAscents = 0;
+    int min = array[0];
+    int max = array[0];
+    for(size_t i = 1; i < size; i++)
+    {
+        nDescents += array[i] < array[i - 1];
+        nAscents += array[i] > array[i - 1];
+        min = array[i] < min ? array[i] : min;
+        max = array[i] > max ? array[i] : max;
+    }
+    plan->min = min;
+    plan->max = max;
+    plan->nRuns = (nDescents < nAscents ? nDescents : nAscents) + 1;
+    uint64_t range = (uint64_t)((int64_t)plan->max - plan->min) + 1;
+    plan->distinctEstimate = estimateDistinct(array, size, range);
+
+    if(size < PLAN_SMALL_ARRAY)
+    {
+        plan->algorithm = SORT_ADAPTIVE;
+        plan->reason = "small array, insertion sort";
+    }
+    else if(plan->nRuns == 1)
+    {
+        plan->algorithm = SORT_ADAPTIVE;
+        plan->reason = nDescents ? "sorted in reverse, reversed in place" : "already sorted, single O(n) pass";
+    }
+    else if(size / plan->nRuns >= PLAN_MIN_AVERAGE_RUN)
+    {
+        plan->algorithm = SORT_ADAPTIVE;
+        plan->reason = "long presorted runs";
+    }
+    else if(range <= PLAN_COUNTING_FACTOR * (uint64_t)size && range <= COUNTING_MAX_RANGE)
+    {
+        plan->algorithm = SORT_COUNTING;
+        plan->reason = "narrow value range";
+    }
+    else if(plan->distinctEstimate <= PLAN_MAX_DISTINCT &&
+            plan->distinctEstimate * PLAN_DISTINCT_FACTOR <= size)
+    {
+        plan->algorithm = SORT_COUNTING;
+        plan->reason = "few distinct values, counting by dictionary";
+    }
+    else
+    {
+        plan->algorithm = SORT_RADIX;
+        plan->reason = "wide value range, no presorted runs";
+    }
+}
+
+
+/**
+    \brief  Функция сортирует массив целых чисел заданным алгоритмом
+    \param  [in]   array      указатель на массив
+    \param  [in]   size       размер массива
+    \param  [in]   algorithm  алгоритм сортировки
+    \param  [out]  plan       если не NULL, сюда записывается, каким
+                              алгоритмом и почему сортировался массив
+    \note   Для SORT_AUTO алгоритм выбирает planSort(). Если
+            сортировке, которой нужен буфер, не хватило памяти,
+            массив сортируется кучей, а подсчету со слишком широким
+            диапазоном и слишком многими разными значениями -
+            поразрядно. В plan попадает
+            алгоритм, который в итоге отработал.
+*/
+void sortIntegersPlanned(int* array, size_t size, enum SortAlgorithm algorithm, struct SortPlan* plan)
+{
+    struct SortPlan chosen;
+    if(algorithm == SORT_AUTO && array)
+        planSort(array, size, &chosen);
+    else
+    {
+        memset(&chosen, 0, sizeof(chosen));
+        chosen.algorithm = algorithm;
+        chosen.size = size;
+        chosen.reason = "requested";
+    }
+    if(!array || size <= 1)
+    {
+        if(plan)
+            *plan = chosen;
+        return;
+    }
+
+    switch(chosen.algorithm)
+    {
+        case SORT_MERGE:
+            if(mergeSort(array, size))
+                break;
+            chosen.algorithm = SORT_HEAP;
+            chosen.reason = "no memory for merge buffer";
+            heapSort(array, size);
+            break;
+        case SORT_COUNTING:
+            if(algorithm != SORT_AUTO)
+                findRange(array, size, &chosen.min, &chosen.max);
+            if(countingSort(array, size, chosen.min, chosen.max) || dictionarySort(array, size))
+                break;
+            chosen.algorithm = SORT_RADIX;
+            chosen.reason = "too many distinct values for counting";
+            // fallthrough
+        case SORT_RADIX:
+            if(radixSort(array, size))
+                break;
+            chosen.algorithm = SORT_HEAP;
+            chosen.reason = "no memory for radix buffer";
+            heapSort(array, size);
+            break;
+        case SORT_ADAPTIVE:
+            if(adaptiveSort(array, size))
+                break;
+            chosen.algorithm = SORT_HEAP;
+            chosen.reason = "no memory for adaptive merge buffer";
+            // fallthrough
+        case SORT_HEAP:
+        default:
+            heapSort(array, size);
+            break;
+    }
+    if(plan)
+        *plan = chosen;
+}
+
+/**
+    \brief  Функция сортирует массив целых чисел заданным алгоритмом
+    \param  [in]  array      указатель на массив
+    \param  [in]  size       размер массива
+    \param  [in]  algorithm  алгоритм сортировки
+*/
+void sortIntegers(int* array, size_t size, enum SortAlgorithm algorithm)
+{
+    sortIntegersPlanned(array, size, algorithm, NULL);
+}
+
+static const char* algorithmNames[] = {"heap", "merge", "radix", "adaptive", "counting", "auto"};
+
+/**
+    \brief  Функция возвращает имя алгоритма сортировки.
+*/
+const char* sortAlgorithmName(enum SortAlgorithm algorithm)
+{
+    if((unsigned)algorithm >= sizeof(algorithmNames) / sizeof(algorithmNames[0]))
+        return "unknown";
+    return algorithmNames[algorithm];
+}
+
+/**
+    \brief  Функция находит алгоритм сортировки по имени.
+    \param  [in]   name       имя алгоритма
+    \param  [out]  algorithm  найденный алгоритм
+    \return true, если алгоритм с таким именем есть, false иначе.
+*/
+bool parseSortAlgorithm(const char* name, enum SortAlgorithm* algorithm)
+{
+    for(unsigned i = 0; i < sizeof(algorithmNames) / sizeof(algorithmNames[0]); i++)
+        if(!strcmp(name, algorithmNames[i]))
+        {
+            *algorithm = (enum SortAlgorithm)i;
+            return true;
+        }
+    return false;
+}
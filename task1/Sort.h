@@ -0,0 +1,32 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+/// алгоритм сортировки, выбирается ключом --algorithm
+enum SortAlgorithm
+{
+    SORT_HEAP,
+    SORT_MERGE,
+    SORT_RADIX,
+    SORT_ADAPTIVE,  ///< естественное слияние серий, O(n) на отсортированном
+    SORT_COUNTING,  ///< подсчет, только для узкого диапазона значений
+    SORT_AUTO       ///< выбор по статистике массива, см. planSort()
+};
+
+/// что planSort() узнал о массиве и какой алгоритм выбрал
+struct SortPlan
+{
+    enum SortAlgorithm algorithm;   ///< никогда не SORT_AUTO
+    size_t size;
+    int min;
+    int max;
+    size_t distinctEstimate;        ///< оценка числа разных значений по выборке
+    size_t nRuns;                   ///< оценка числа отсортированных серий
+    const char* reason;             ///< почему выбран algorithm, литерал
+};
+
+void sortIntegers(int* array, size_t size, enum SortAlgorithm algorithm);
+void sortIntegersPlanned(int* array, size_t size, enum SortAlgorithm algorithm, struct SortPlan* plan);
+void planSort(const int* array, size_t size, struct SortPlan* plan);
+const char* sortAlgorithmName(enum SortAlgorithm algorithm);
+bool parseSortAlgorithm(const char* name, enum SortAlgorithm* algorithm);
@@ -1,4 +1,5 @@
 #include "StrLib.h"
+#include "Coroutine.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -7,9 +8,13 @@
 #include <fcntl.h>
 #include <aio.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <limits.h>
+
+#define KB * 1024
 
 /**
     \brief  Функция полностью сичтывает файл
@@ -18,7 +23,7 @@
     \return В случае успеха возвращается количество прочитанных байт.
     Если произошла ошибка, то возвращается константа -1.
 */
-int readFullFile(const char* filename, char** outString)
+long readFullFile(const char* filename, char** outString)
 {
     assert(filename);
     assert(outString);
@@ -41,7 +46,7 @@ int readFullFile(const char* filename, char** outString)
     if (!string)
         return STANDART_ERROR_CODE;
 
-    unsigned nReadBytes = fread(string, sizeof(char), fsize, inputFile);
+    size_t nReadBytes = fread(string, sizeof(char), fsize, inputFile);
     fclose(inputFile);
     string[fsize] = 0;
 
@@ -55,19 +60,36 @@ int readFullFile(const char* filename, char** outString)
 
 /**
     \brief  Функция полностью сичтывает файл используя aio_read()
+    \note   Если функция вызвана из корутины, то на время чтения
+            корутина засыпает и не тратит процессорное время.
+    \param  [in]      filename  Имя считываемого файла
+    \param  [in,out]  outString Указатель на считанную строку
+    \return В случае успеха возвращается количество прочитанных байт.
+    Если произошла ошибка, то возвращается константа -1.
+*/
+long async_readFullFile(const char* filename, char** outString)
+{
+    return async_readFileRange(filename, 0, TO_END_OF_FILE, outString);
+}
+
+/**
+    \brief  Функция считывает диапазон файла используя aio_read()
     \param  [in]      filename  Имя считываемого файла
+    \param  [in]      offset    Смещение начала диапазона
+    \param  [in]      length    Длина диапазона или TO_END_OF_FILE
     \param  [in,out]  outString Указатель на считанную строку
     \return В случае успеха возвращается количество прочитанных байт.
     Если произошла ошибка, то возвращается константа -1.
+    \note   Диапазон, выходящий за конец файла, обрезается по нему.
 */
-int async_readFullFile(const char* filename, char** outString)
+long async_readFileRange(const char* filename, size_t offset, size_t length, char** outString)
 {
     assert(filename);
     assert(outString);
     if (!filename || !outString)
         return STANDART_ERROR_CODE;
 
-    int fd =  open(filename, O_RDWR | O_EXCL, S_IRUSR | S_IWUSR);
+    int fd =  open(filename, O_RDONLY);
     assert(fd != -1);
     if(fd == -1)
     {
@@ -77,38 +99,359 @@ int async_readFullFile(const char* filename, char** outString)
 
     long fsize = lseek(fd, 0, SEEK_END);
     lseek(fd, 0, SEEK_SET);
+    if(fsize < 0 || (size_t)fsize < offset)
+        fsize = offset;
+    if(length > (size_t)fsize - offset)
+        length = fsize - offset;
 
-    char* string = (char*)calloc(fsize + 8, sizeof(char));
+    char* string = (char*)calloc(length + 8, sizeof(char));
     assert(string);
     if (!string)
+    {
+        close(fd);
         return STANDART_ERROR_CODE;
+    }
 
 
     struct aiocb aiocb;
     memset(&aiocb, 0, sizeof(struct aiocb));
     aiocb.aio_fildes = fd;
-    aiocb.aio_buf = string;
-    aiocb.aio_nbytes = fsize;
 
-    if(aio_read(&aiocb) == -1)
+    //пока чтение идет, корутина спит, а остальные корутины работают
+    long nReadBytes = 0;
+    while((size_t)nReadBytes < length)
     {
-        printf("Error at aio_read()\n");
-        close(fd);
-        free(string);
+        aiocb.aio_buf = string + nReadBytes;
+        aiocb.aio_nbytes = length - nReadBytes;
+        aiocb.aio_offset = offset + nReadBytes;
+        if(aio_read(&aiocb) == -1)
+        {
+            printf("Error at aio_read()\n");
+            close(fd);
+            free(string);
+            return STANDART_ERROR_CODE;
+        }
+
+        coroutineWaitForIo(&aiocb);
+        ssize_t ret = aio_return(&aiocb);
+        if(ret <= 0)
+            break;
+        nReadBytes += ret;
+    }
+
+    close(fd);
+    string[nReadBytes] = 0;
+
+    *outString = string;
+
+    return nReadBytes;
+}
+
+
+
+
+/**
+    \brief  Функция считывает в кучу все, что удастся прочитать
+            из дескриптора, до конца потока.
+    \param  [in]      fd    Дескриптор, из которого читаем
+    \param  [in,out]  view  Структура, в которую запишется результат
+    \return В случае успеха возвращается 0, иначе константа -1.
+    \note   Используется для каналов и специальных файлов, размер
+            которых заранее неизвестен.
+*/
+static int readFullStream(int fd, struct FileView* view)
+{
+    size_t capacity = 64 KB;
+    size_t size = 0;
+    char* string = (char*)malloc(capacity + 1);
+    if (!string)
         return STANDART_ERROR_CODE;
+
+    for(;;)
+    {
+        if(size == capacity)
+        {
+            capacity *= 2;
+            char* grown = (char*)realloc(string, capacity + 1);
+            if(!grown)
+            {
+                free(string);
+                return STANDART_ERROR_CODE;
+            }
+            string = grown;
+        }
+        ssize_t nRead = read(fd, string + size, capacity - size);
+        if(nRead == -1 && errno == EINTR)
+            continue;
+        if(nRead == -1)
+        {
+            free(string);
+            return STANDART_ERROR_CODE;
+        }
+        if(nRead == 0)
+            break;
+        size += nRead;
     }
+    string[size] = 0;
+
+    view->data = string;
+    view->size = size;
+    view->mappedSize = 0;
+    return 0;
+}
 
-    int err,ret;
-    while ((err = aio_error (&aiocb)) == EINPROGRESS);
-    err = aio_error(&aiocb);
-    ret = aio_return(&aiocb);
+/**
+    \brief  Функция отображает файл в память без копирования.
+    \param  [in]      filename  Имя файла
+    \param  [in,out]  view      Структура, в которую запишется результат
+    \return В случае успеха возвращается 0, иначе константа -1.
+*/
+int mapFullFile(const char* filename, struct FileView* view)
+{
+    return mapFileRange(filename, 0, TO_END_OF_FILE, view);
+}
 
+/**
+    \brief  Функция отображает диапазон файла в память без копирования.
+    \param  [in]      filename  Имя файла
+    \param  [in]      offset    Смещение начала диапазона
+    \param  [in]      length    Длина диапазона или TO_END_OF_FILE
+    \param  [in,out]  view      Структура, в которую запишется результат
+    \return В случае успеха возвращается 0, иначе константа -1.
+    \details Сначала резервируется анонимная область на один байт
+             больше диапазона (с округлением до страницы), затем поверх
+             ее начала с MAP_FIXED отображается сам файл, начиная со
+             страницы, в которую попадает offset. Поэтому байт за концом
+             диапазона всегда существует: это либо следующий байт файла,
+             либо ноль, если диапазон доходит до конца файла. Отображение
+             приватное и только для чтения, страницы подгружаются сразу
+             (MAP_POPULATE) и читаются последовательно (MADV_SEQUENTIAL).
+    \note   Для каналов и специальных файлов, которые нельзя отобразить,
+            содержимое читается в кучу целиком, как и раньше.
+*/
+int mapFileRange(const char* filename, size_t offset, size_t length, struct FileView* view)
+{
+    assert(filename);
+    assert(view);
+    if (!filename || !view)
+        return STANDART_ERROR_CODE;
 
-    unsigned nReadBytes = ret;
+    int fd = open(filename, O_RDONLY);
+    if(fd == -1)
+    {
+        printf("Failed open file for reading.\n");
+        return STANDART_ERROR_CODE;
+    }
+
+    struct stat info;
+    if(fstat(fd, &info) == -1 || !S_ISREG(info.st_mode) || (size_t)info.st_size <= offset)
+    {
+        int ret = 0;
+        if(offset == 0)
+            ret = readFullStream(fd, view);
+        else
+            memset(view, 0, sizeof(struct FileView));
+        close(fd);
+        return ret;
+    }
+
+    size_t fsize = info.st_size;
+    if(length > fsize - offset)
+        length = fsize - offset;
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t shift = offset % pageSize;
+    size_t mappedSize = (shift + length + 1 + pageSize - 1) / pageSize * pageSize;
+
+    char* base = (char*)mmap(NULL, mappedSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED)
+    {
+        close(fd);
+        return STANDART_ERROR_CODE;
+    }
+    size_t fileBytes = fsize - (offset - shift);
+    if(fileBytes > mappedSize)
+        fileBytes = mappedSize;
+    char* data = (char*)mmap(base, fileBytes, PROT_READ, MAP_PRIVATE | MAP_FIXED | MAP_POPULATE, fd, offset - shift);
     close(fd);
-    string[fsize] = 0;
+    if(data == MAP_FAILED)
+    {
+        munmap(base, mappedSize);
+        return STANDART_ERROR_CODE;
+    }
+    madvise(data, fileBytes, MADV_SEQUENTIAL);
 
-    *outString = string;
+    view->data = data + shift;
+    view->size = length;
+    view->mappedSize = mappedSize;
+    return 0;
+}
 
-    return nReadBytes;
+/**
+    \brief  Функция освобождает ресурсы, занятые содержимым файла.
+    \param  [in,out]  view  Структура, полученная от mapFullFile()
+                            или заполненная вручную из кучи
+*/
+void releaseFileView(struct FileView* view)
+{
+    if(!view || !view->data)
+        return;
+    if(view->mappedSize)
+    {
+        //отображение начинается с начала страницы, в которую попадают данные
+        size_t pageSize = sysconf(_SC_PAGESIZE);
+        munmap((char*)((size_t)view->data / pageSize * pageSize), view->mappedSize);
+    }
+    else
+        free(view->data);
+    view->data = NULL;
+    view->size = 0;
+    view->mappedSize = 0;
+}
+
+
+
+
+/**
+    \brief  Функция ставит в очередь чтение следующего куска
+            в буфер reader->filling.
+    \return В случае успеха возвращается 0, иначе константа -1.
+*/
+static int chunkReaderSubmit(struct ChunkReader* reader)
+{
+    memset(&reader->aiocb, 0, sizeof(struct aiocb));
+    reader->aiocb.aio_fildes = reader->fd;
+    reader->aiocb.aio_buf = reader->buffers[reader->filling] + CHUNK_HEADROOM;
+    reader->aiocb.aio_nbytes = reader->chunkSize;
+    if(reader->end - reader->offset < (off_t)reader->chunkSize)
+        reader->aiocb.aio_nbytes = reader->end - reader->offset;
+    reader->aiocb.aio_offset = reader->offset;
+    if(aio_read(&reader->aiocb) == -1)
+    {
+        printf("Error at aio_read()\n");
+        return STANDART_ERROR_CODE;
+    }
+    return 0;
+}
+
+/**
+    \brief  Функция открывает файл для потокового чтения и сразу
+            запускает чтение первого куска.
+    \param  [in,out]  reader     Структура состояния чтения
+    \param  [in]      filename   Имя файла
+    \param  [in]      chunkSize  Размер куска в байтах
+    \return В случае успеха возвращается 0, иначе константа -1.
+*/
+int chunkReaderOpen(struct ChunkReader* reader, const char* filename, size_t chunkSize)
+{
+    return chunkReaderOpenRange(reader, filename, chunkSize, 0, TO_END_OF_FILE);
+}
+
+/**
+    \brief  Функция открывает диапазон файла для потокового чтения
+            и сразу запускает чтение первого куска.
+    \param  [in,out]  reader     Структура состояния чтения
+    \param  [in]      filename   Имя файла
+    \param  [in]      chunkSize  Размер куска в байтах
+    \param  [in]      offset     Смещение начала диапазона
+    \param  [in]      length     Длина диапазона или TO_END_OF_FILE
+    \return В случае успеха возвращается 0, иначе константа -1.
+*/
+int chunkReaderOpenRange(struct ChunkReader* reader, const char* filename, size_t chunkSize,
+                         size_t offset, size_t length)
+{
+    assert(reader);
+    assert(filename);
+    if (!reader || !filename || !chunkSize)
+        return STANDART_ERROR_CODE;
+
+    memset(reader, 0, sizeof(struct ChunkReader));
+    reader->fd = open(filename, O_RDONLY);
+    if(reader->fd == -1)
+    {
+        printf("Failed open file for reading.\n");
+        return STANDART_ERROR_CODE;
+    }
+    reader->chunkSize = chunkSize;
+    reader->offset = offset;
+    reader->end = length > (size_t)LONG_MAX - offset ? LONG_MAX : (off_t)(offset + length);
+    for(int i = 0; i < 2; i++)
+    {
+        reader->buffers[i] = (char*)malloc(CHUNK_HEADROOM + chunkSize);
+        if(!reader->buffers[i])
+        {
+            chunkReaderClose(reader);
+            return STANDART_ERROR_CODE;
+        }
+    }
+    if(chunkReaderSubmit(reader) == STANDART_ERROR_CODE)
+    {
+        chunkReaderClose(reader);
+        return STANDART_ERROR_CODE;
+    }
+    return 0;
+}
+
+/**
+    \brief  Функция дожидается очередного куска и запускает чтение
+            следующего во второй буфер.
+    \param  [in,out]  reader   Структура состояния чтения
+    \param  [out]     chunk    Указатель на начало готового куска
+    \param  [in]      tail     Неразобранный хвост предыдущего куска
+    \param  [in]      tailLen  Длина хвоста, не больше CHUNK_HEADROOM
+    \return Длина куска вместе с приклеенным в его начало хвостом,
+            0 в конце файла или константа -1 в случае ошибки.
+    \note   Хвост копируется до того, как буфер, в котором он лежит,
+            будет отдан под следующее чтение. В конце файла буфер
+            с последним куском остается нетронутым.
+*/
+long chunkReaderNext(struct ChunkReader* reader, char** chunk, const char* tail, size_t tailLen)
+{
+    assert(reader);
+    assert(chunk);
+    assert(tailLen <= CHUNK_HEADROOM);
+    if(reader->isEof)
+        return 0;
+
+    coroutineWaitForIo(&reader->aiocb);
+    ssize_t nRead = aio_return(&reader->aiocb);
+    if(nRead < 0)
+        return STANDART_ERROR_CODE;
+    if(nRead == 0)
+    {
+        reader->isEof = true;
+        return 0;
+    }
+
+    char* data = reader->buffers[reader->filling] + CHUNK_HEADROOM;
+    if(tailLen)
+        memcpy(data - tailLen, tail, tailLen);
+    reader->offset += nRead;
+    reader->filling ^= 1;
+    if(chunkReaderSubmit(reader) == STANDART_ERROR_CODE)
+        return STANDART_ERROR_CODE;
+
+    *chunk = data - tailLen;
+    return nRead + tailLen;
+}
+
+/**
+    \brief  Функция закрывает файл и освобождает буферы.
+    \note   Если чтение еще идет, то функция дожидается его
+            завершения, чтобы не освободить буфер раньше времени.
+*/
+void chunkReaderClose(struct ChunkReader* reader)
+{
+    if(!reader)
+        return;
+    if(reader->fd != -1 && reader->aiocb.aio_buf)
+    {
+        coroutineWaitForIo(&reader->aiocb);
+        aio_return(&reader->aiocb);
+    }
+    if(reader->fd != -1)
+        close(reader->fd);
+    free(reader->buffers[0]);
+    free(reader->buffers[1]);
+    memset(reader, 0, sizeof(struct ChunkReader));
+    reader->fd = -1;
 }
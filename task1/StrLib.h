@@ -1,7 +1,54 @@
 #pragma once
+#include <stddef.h>
+#include <stdbool.h>
+#include <aio.h>
 
 
 #define STANDART_ERROR_CODE -1
 
-int readFullFile(const char* filename, char** outString);
-int async_readFullFile(const char* filename, char** outString);
\ No newline at end of file
+/// длина диапазона, означающая "до конца файла"
+#define TO_END_OF_FILE ((size_t)-1)
+
+/**
+    Содержимое файла (или его диапазона), доступное для чтения.
+    Сразу за последним байтом всегда лежит нулевой байт, если
+    диапазон доходит до конца файла, иначе - следующий байт файла.
+*/
+struct FileView
+{
+    char* data;
+    size_t size;
+    size_t mappedSize; ///< 0, если данные лежат в куче
+};
+
+/// место перед каждым куском, куда можно приклеить хвост предыдущего
+#define CHUNK_HEADROOM 64
+
+/**
+    Потоковое чтение файла кусками фиксированного размера.
+    Пока вызывающий разбирает один кусок, следующий уже читается
+    через aio_read() во второй буфер.
+*/
+struct ChunkReader
+{
+    int fd;
+    size_t chunkSize;
+    off_t offset;
+    off_t end;          ///< граница диапазона, дальше которой не читаем
+    char* buffers[2];
+    int filling;        ///< номер буфера, в который идет чтение
+    bool isEof;
+    struct aiocb aiocb;
+};
+
+long readFullFile(const char* filename, char** outString);
+long async_readFullFile(const char* filename, char** outString);
+long async_readFileRange(const char* filename, size_t offset, size_t length, char** outString);
+int mapFullFile(const char* filename, struct FileView* view);
+int mapFileRange(const char* filename, size_t offset, size_t length, struct FileView* view);
+void releaseFileView(struct FileView* view);
+int chunkReaderOpen(struct ChunkReader* reader, const char* filename, size_t chunkSize);
+int chunkReaderOpenRange(struct ChunkReader* reader, const char* filename, size_t chunkSize,
+                         size_t offset, size_t length);
+long chunkReaderNext(struct ChunkReader* reader, char** chunk, const char* tail, size_t tailLen);
+void chunkReaderClose(struct ChunkReader* reader);
\ No newline at end of file
@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+#include "Trace.h"
+#include "Coroutine.h"
+#include "StrLib.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+
+// столько событий помещается в буфер одного потока, остальные теряются
+#define TRACE_BUFFER_EVENTS (1 << 20)
+// дорожки потоков и корутин в терминах Chrome trace event
+#define THREADS_PID 1
+#define COROUTINES_PID 2
+
+struct TraceEvent
+{
+    uint64_t time;          ///< нс, для 'X' - начало отрезка
+    uint64_t duration;      ///< нс, только для 'X'
+    const char* name;
+    int coroutine;          ///< дорожка для 'B' и 'E', аргумент для 'X' и 'i', -1 - нет
+    char phase;
+};
+
+struct TraceBuffer
+{
+    struct TraceBuffer* next;
+    pid_t tid;
+    char name[32];
+    atomic_size_t nEvents;  ///< сколько мест занято, может превышать TRACE_BUFFER_EVENTS
+    struct TraceEvent events[TRACE_BUFFER_EVENTS];
+};
+
+bool isTraceEnabled = false;
+
+static uint64_t traceStartTime;
+static _Atomic(struct TraceBuffer*) buffers = NULL;
+static __thread struct TraceBuffer* threadBuffer = NULL;
+
+/**
+    \brief  Функция включает трассировку, время событий отсчитывается
+            от этого момента.
+*/
+void traceStart()
+{
+    traceStartTime = traceNow();
+    isTraceEnabled = true;
+}
+
+/**
+    \brief  Функция возвращает буфер текущего потока.
+    \param  [in]  mayAllocate  можно ли завести буфер, если его нет
+    \note   Новый буфер добавляется в общий список через CAS. Память
+            под события выделяется по страницам по мере записи.
+*/
+static struct TraceBuffer* getThreadBuffer(bool mayAllocate)
+{
+    struct TraceBuffer* buffer = threadBuffer;
+    if(buffer || !mayAllocate)
+        return buffer;
+    buffer = (struct TraceBuffer*)calloc(1, sizeof(struct TraceBuffer));
+    if(!buffer)
+        return NULL;
+    buffer->tid = syscall(SYS_gettid);
+    snprintf(buffer->name, sizeof(buffer->name), "thread %d", (int)buffer->tid);
+    buffer->next = atomic_load(&buffers);
+    while(!atomic_compare_exchange_weak(&buffers, &buffer->next, buffer))
+        ;
+    threadBuffer = buffer;
+    return buffer;
+}
+
+/**
+    \brief  Функция дает имя дорожке текущего потока.
+    \param  [in]  name   имя, к которому добавляется index
+    \param  [in]  index  номер потока, если отрицательный, то не печатается
+*/
+void traceThreadName(const char* name, int index)
+{
+    if(!isTraceEnabled)
+        return;
+    struct TraceBuffer* buffer = getThreadBuffer(true);
+    if(!buffer)
+        return;
+    if(index < 0)
+        snprintf(buffer->name, sizeof(buffer->name), "%s", name);
+    else
+        snprintf(buffer->name, sizeof(buffer->name), "%s %d", name, index);
+}
+
+/**
+    \brief  Функция записывает событие в буфер текущего потока.
+    \param  [in]  phase      'B', 'E', 'X' или 'i'
+    \param  [in]  name       имя этапа
+    \param  [in]  coroutine  корутина для 'X' и 'i'
+    \param  [in]  start      начало отрезка для 'X'
+    \note   Обычно вызывается через traceBegin() и соседние функции.
+*/
+void traceRecord(char phase, const char* name, int coroutine, uint64_t start)
+{
+    struct TraceBuffer* buffer = getThreadBuffer(phase != 'i');
+    if(!buffer)
+        return;
+    uint64_t now = traceNow();
+    if(phase == 'B' || phase == 'E')
+        coroutine = getCurrentCoroutine();
+
+    size_t slot = atomic_fetch_add(&buffer->nEvents, 1);
+    if(slot >= TRACE_BUFFER_EVENTS)
+        return;
+    struct TraceEvent* event = &buffer->events[slot];
+    event->time = phase == 'X' ? start : now;
+    event->duration = phase == 'X' ? now - start : 0;
+    event->name = name;
+    event->coroutine = coroutine;
+    event->phase = phase;
+}
+
+/**
+    \brief  Функция печатает время в микросекундах от traceStart().
+*/
+static void writeTimestamp(FILE* file, const char* key, uint64_t time)
+{
+    uint64_t relative = time > traceStartTime ? time - traceStartTime : 0;
+    fprintf(file, ", \"%s\": %llu.%03llu", key,
+            (unsigned long long)(relative / 1000), (unsigned long long)(relative % 1000));
+}
+
+/**
+    \brief  Функция записывает события всех потоков в файл и
+            освобождает буферы.
+    \param  [in]  filename  имя файла трассы
+    \return Число записанных событий или STANDART_ERROR_CODE.
+    \note   Вызывается, когда остальные потоки уже ничего не пишут.
+            Трассировка после этого выключается.
+*/
+long traceDump(const char* filename)
+{
+    isTraceEnabled = false;
+    FILE* file = fopen(filename, "w");
+    long nWritten = 0;
+    size_t nDropped = 0;
+    int maxCoroutine = -1;
+
+    struct TraceBuffer* buffer = atomic_exchange(&buffers, NULL);
+    threadBuffer = NULL;
+    if(file)
+        fprintf(file, "{\"traceEvents\": [\n"
+                      "{\"ph\": \"M\", \"name\": \"process_name\", \"pid\": %d, \"args\": {\"name\": \"threads\"}},\n"
+                      "{\"ph\": \"M\", \"name\": \"process_name\", \"pid\": %d, \"args\": {\"name\": \"coroutines\"}}",
+                THREADS_PID, COROUTINES_PID);
+    while(buffer)
+    {
+        size_t nEvents = atomic_load(&buffer->nEvents);
+        if(nEvents > TRACE_BUFFER_EVENTS)
+        {
+            nDropped += nEvents - TRACE_BUFFER_EVENTS;
+            nEvents = TRACE_BUFFER_EVENTS;
+        }
+        if(file)
+            fprintf(file, ",\n{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": %d, \"tid\": %d, "
+                          "\"args\": {\"name\": \"%s\"}}", THREADS_PID, (int)buffer->tid, buffer->name);
+        for(size_t i = 0; file && i < nEvents; i++)
+        {
+            const struct TraceEvent* event = &buffer->events[i];
+            bool onCoroutine = (event->phase == 'B' || event->phase == 'E') && event->coroutine != -1;
+            fprintf(file, ",\n{\"ph\": \"%c\", \"name\": \"%s\", \"pid\": %d, \"tid\": %d",
+                    event->phase, event->name, onCoroutine ? COROUTINES_PID : THREADS_PID,
+                    onCoroutine ? event->coroutine : (int)buffer->tid);
+            writeTimestamp(file, "ts", event->time);
+            if(event->phase == 'X')
+                fprintf(file, ", \"dur\": %llu.%03llu", (unsigned long long)(event->duration / 1000),
+                        (unsigned long long)(event->duration % 1000));
+            if(event->phase == 'i')
+                fprintf(file, ", \"s\": \"t\"");
+            if(!onCoroutine && event->coroutine != -1)
+                fprintf(file, ", \"args\": {\"coroutine\": %d}", event->coroutine);
+            fprintf(file, "}");
+            if(event->coroutine > maxCoroutine)
+                maxCoroutine = event->coroutine;
+            nWritten++;
+        }
+        struct TraceBuffer* next = buffer->next;
+        free(buffer);
+        buffer = next;
+    }
+    if(!file)
+        return STANDART_ERROR_CODE;
+
+    for(int i = 0; i <= maxCoroutine; i++)
+        fprintf(file, ",\n{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": %d, \"tid\": %d, "
+                      "\"args\": {\"name\": \"coroutine %d\"}}", COROUTINES_PID, i, i);
+    fprintf(file, "\n],\n\"displayTimeUnit\": \"ns\",\n\"otherData\": {\"droppedEvents\": \"%zu\"}\n}\n", nDropped);
+    bool isFailed = ferror(file);
+    if(fclose(file) || isFailed)
+        return STANDART_ERROR_CODE;
+    return nWritten;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+    Трассировка этапов сортировки в формате Chrome trace event,
+    который открывают chrome://tracing и Perfetto.
+
+    События пишутся в буферы потоков без блокировок: место под событие
+    занимается атомарным увеличением счетчика буфера, поэтому событие
+    можно записать и из обработчика сигнала, прервавшего запись другого
+    события в том же потоке. Этапы, начатые в корутине, попадают на
+    дорожку корутины, а не потока: корутина может начать этап на одном
+    исполнителе, а закончить на другом.
+
+    Пока трассировка не включена через traceStart(), каждая точка
+    трассировки стоит одну проверку флага.
+*/
+
+extern bool isTraceEnabled;
+
+void traceStart();
+void traceThreadName(const char* name, int index);
+void traceRecord(char phase, const char* name, int coroutine, uint64_t start);
+long traceDump(const char* filename);
+
+/**
+    \brief  Функция возвращает время для traceSlice() в наносекундах.
+*/
+static inline uint64_t traceNow()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+/**
+    \brief  Функция отмечает начало этапа name.
+    \note   name должна жить до traceDump(), обычно это литерал.
+*/
+static inline void traceBegin(const char* name)
+{
+    if(isTraceEnabled)
+        traceRecord('B', name, -1, 0);
+}
+
+/**
+    \brief  Функция отмечает конец этапа name.
+*/
+static inline void traceEnd(const char* name)
+{
+    if(isTraceEnabled)
+        traceRecord('E', name, -1, 0);
+}
+
+/**
+    \brief  Функция записывает на дорожку потока отрезок name от start
+            до текущего момента, относящийся к корутине coroutine.
+*/
+static inline void traceSlice(const char* name, int coroutine, uint64_t start)
+{
+    if(isTraceEnabled)
+        traceRecord('X', name, coroutine, start);
+}
+
+/**
+    \brief  Функция записывает на дорожку потока мгновенное событие.
+    \note   Можно вызывать из обработчика сигнала: буфер потока при
+            этом не заводится, и если его еще нет, событие теряется.
+*/
+static inline void traceInstant(const char* name, int coroutine)
+{
+    if(isTraceEnabled)
+        traceRecord('i', name, coroutine, 0);
+}
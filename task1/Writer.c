@@ -0,0 +1,445 @@
+#define _GNU_SOURCE
+#include "Writer.h"
+#include "StrLib.h"
+#include "Merge.h"
+#include "Trace.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+#define KB * 1024
+#define MB * 1024 KB
+
+// размер одного буфера, кратен размеру блока, как того требует O_DIRECT
+#define WRITER_BUFFER_SIZE 1 MB
+// выравнивание буферов, подходит для O_DIRECT на всех распространенных ФС
+#define WRITER_ALIGNMENT 4096
+// размер окна отображения в режиме WRITE_MMAP
+#define WRITER_WINDOW_SIZE 64 MB
+
+#define handle_error_rude(msg) \
+    do { perror(msg); exit(EXIT_FAILURE); } while (0)
+
+/**
+    \brief  Функция отдает файлу все байты из iov, повторяя
+            writev() после частичной записи.
+    \return В случае успеха возвращается 0, иначе константа -1.
+*/
+static int writeFullVector(int fd, struct iovec* iov, int iovcnt)
+{
+    traceBegin("write");
+    while(iovcnt)
+    {
+        ssize_t nWritten = writev(fd, iov, iovcnt);
+        if(nWritten == -1 && errno == EINTR)
+            continue;
+        if(nWritten <= 0)
+        {
+            traceEnd("write");
+            return STANDART_ERROR_CODE;
+        }
+        while(iovcnt && (size_t)nWritten >= iov->iov_len)
+        {
+            nWritten -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt)
+        {
+            iov->iov_base = (char*)iov->iov_base + nWritten;
+            iov->iov_len -= nWritten;
+        }
+    }
+    traceEnd("write");
+    return 0;
+}
+
+/**
+    \brief  Функция отображает в память очередное окно выходного файла.
+    \note   Окно на страницу длиннее WRITER_WINDOW_SIZE: число, которое
+            не поместилось в конец окна, дописывается в эту страницу и
+            оказывается в начале следующего окна.
+*/
+static int mapWindow(struct OutputWriter* writer, size_t overflow)
+{
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t mappedSize = writer->windowSize + pageSize;
+    if(ftruncate(writer->fd, writer->windowOffset + mappedSize) == -1)
+        return STANDART_ERROR_CODE;
+    char* window = (char*)mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                               writer->fd, writer->windowOffset);
+    if(window == MAP_FAILED)
+        return STANDART_ERROR_CODE;
+    writer->window = window;
+    writer->current = window + overflow;
+    writer->limit = window + writer->windowSize;
+    return 0;
+}
+
+/**
+    \brief  Функция открывает файл для записи чисел.
+    \param  [out]  writer    Структура состояния записи
+    \param  [in]   filename  Имя выходного файла
+    \param  [in]   mode      Способ записи
+    \return В случае успеха возвращается 0, иначе константа -1.
+    \note   Если файловая система не поддерживает O_DIRECT, то файл
+            открывается обычным образом.
+*/
+int writerOpen(struct OutputWriter* writer, const char* filename, enum WriteMode mode)
+{
+    if(!writer || !filename)
+        return STANDART_ERROR_CODE;
+    memset(writer, 0, sizeof(struct OutputWriter));
+    writer->mode = mode;
+
+    int flags = O_CREAT | O_TRUNC | (mode == WRITE_MMAP ? O_RDWR : O_WRONLY);
+    writer->fd = open(filename, flags | (mode == WRITE_DIRECT ? O_DIRECT : 0), 0644);
+    if(writer->fd == -1 && mode == WRITE_DIRECT && errno == EINVAL)
+        writer->fd = open(filename, flags, 0644);
+    if(writer->fd == -1)
+    {
+        printf("Failed open file for writing.\n");
+        return STANDART_ERROR_CODE;
+    }
+
+    if(mode == WRITE_MMAP)
+    {
+        writer->windowSize = WRITER_WINDOW_SIZE;
+        if(mapWindow(writer, 0) == STANDART_ERROR_CODE)
+        {
+            close(writer->fd);
+            return STANDART_ERROR_CODE;
+        }
+        return 0;
+    }
+
+    writer->bufferSize = WRITER_BUFFER_SIZE;
+    for(int i = 0; i < WRITER_IOV; i++)
+        if(posix_memalign((void**)&writer->buffers[i], WRITER_ALIGNMENT,
+                          writer->bufferSize + WRITER_ALIGNMENT))
+        {
+            while(i--)
+                free(writer->buffers[i]);
+            close(writer->fd);
+            return STANDART_ERROR_CODE;
+        }
+    writer->current = writer->buffers[0];
+    writer->limit = writer->buffers[0] + writer->bufferSize;
+    return 0;
+}
+
+/**
+    \brief  Функция вызывается, когда текущий буфер заполнен: переходит
+            к следующему буферу, а когда заполнены все, отдает их файлу
+            одним writev().
+    \note   Байты, вылезшие за границу буфера, переносятся в начало
+            следующего, поэтому файлу всегда отдаются целые буферы.
+*/
+void writerFlushFull(struct OutputWriter* writer)
+{
+    size_t overflow = writer->current - writer->limit;
+    if(writer->mode == WRITE_MMAP)
+    {
+        munmap(writer->window, writer->windowSize + sysconf(_SC_PAGESIZE));
+        writer->windowOffset += writer->windowSize;
+        if(mapWindow(writer, overflow) == STANDART_ERROR_CODE)
+            handle_error_rude("Cant map output file.");
+        return;
+    }
+
+    char* tail = writer->limit;
+    writer->filling++;
+    if(writer->filling == WRITER_IOV)
+    {
+        struct iovec iov[WRITER_IOV];
+        for(int i = 0; i < WRITER_IOV; i++)
+        {
+            iov[i].iov_base = writer->buffers[i];
+            iov[i].iov_len = writer->bufferSize;
+        }
+        if(!writer->isFailed && writeFullVector(writer->fd, iov, WRITER_IOV) == STANDART_ERROR_CODE)
+            writer->isFailed = true;
+        writer->filling = 0;
+    }
+    char* buffer = writer->buffers[writer->filling];
+    memcpy(buffer, tail, overflow);
+    writer->current = buffer + overflow;
+    writer->limit = buffer + writer->bufferSize;
+}
+
+/**
+    \brief  Функция дописывает остаток текста, закрывает файл и
+            освобождает буферы.
+    \return В случае успеха возвращается 0, иначе константа -1.
+    \note   Последний буфер обычно не кратен размеру блока, поэтому
+            перед его записью O_DIRECT снимается.
+*/
+int writerClose(struct OutputWriter* writer)
+{
+    if(!writer || writer->fd == -1)
+        return STANDART_ERROR_CODE;
+
+    if(writer->mode == WRITE_MMAP)
+    {
+        off_t size = writer->windowOffset + (writer->current - writer->window);
+        munmap(writer->window, writer->windowSize + sysconf(_SC_PAGESIZE));
+        if(ftruncate(writer->fd, size) == -1)
+            writer->isFailed = true;
+    }
+    else
+    {
+        struct iovec iov[WRITER_IOV];
+        for(int i = 0; i < writer->filling; i++)
+        {
+            iov[i].iov_base = writer->buffers[i];
+            iov[i].iov_len = writer->bufferSize;
+        }
+        if(!writer->isFailed && writer->filling &&
+           writeFullVector(writer->fd, iov, writer->filling) == STANDART_ERROR_CODE)
+            writer->isFailed = true;
+
+        if(writer->mode == WRITE_DIRECT)
+            fcntl(writer->fd, F_SETFL, fcntl(writer->fd, F_GETFL) & ~O_DIRECT);
+        iov[0].iov_base = writer->buffers[writer->filling];
+        iov[0].iov_len = writer->current - writer->buffers[writer->filling];
+        if(!writer->isFailed && iov[0].iov_len &&
+           writeFullVector(writer->fd, iov, 1) == STANDART_ERROR_CODE)
+            writer->isFailed = true;
+
+        for(int i = 0; i < WRITER_IOV; i++)
+            free(writer->buffers[i]);
+    }
+
+    if(close(writer->fd) == -1)
+        writer->isFailed = true;
+    bool isFailed = writer->isFailed;
+    memset(writer, 0, sizeof(struct OutputWriter));
+    writer->fd = -1;
+    return isFailed ? STANDART_ERROR_CODE : 0;
+}
+
+/**
+    \brief  Функция переводит имя способа записи в WriteMode.
+    \param  [in]   name  "write", "direct" или "mmap"
+    \param  [out]  mode  способ записи
+    \return true, если имя известно, false иначе.
+*/
+bool parseWriteMode(const char* name, enum WriteMode* mode)
+{
+    static const char* names[] = {"write", "direct", "mmap"};
+    for(int i = 0; i < 3; i++)
+        if(!strcmp(name, names[i]))
+        {
+            *mode = (enum WriteMode)i;
+            return true;
+        }
+    return false;
+}
+
+
+
+
+/// часть результата слияния, которую форматирует и пишет один поток
+struct WritePart
+{
+    int id;
+    int fd;
+    const struct SortedRun* runs;
+    size_t nRuns;
+    const size_t* begin;    ///< начало части в каждом массиве
+    const size_t* end;      ///< конец части в каждом массиве
+    off_t length;           ///< длина текста части
+    struct WritePart* parts;
+    pthread_barrier_t* lengthsReady;
+    bool isFailed;
+};
+
+/**
+    \brief  Функция возвращает длину текста части, не сливая ее:
+            длина записи не зависит от порядка чисел.
+*/
+static off_t partTextLength(const struct SortedRun* runs, size_t nRuns, const size_t* begin, const size_t* end)
+{
+    off_t length = 0;
+    for(size_t i = 0; i < nRuns; i++)
+        for(size_t j = begin[i]; j < end[i]; j++)
+            length += intTextLength(runs[i].data[j]);
+    return length;
+}
+
+/**
+    \brief  Функция отдает файлу весь буфер по смещению offset,
+            повторяя pwrite() после частичной записи.
+*/
+static int pwriteFull(int fd, const char* buffer, size_t size, off_t offset)
+{
+    traceBegin("write");
+    while(size)
+    {
+        ssize_t nWritten = pwrite(fd, buffer, size, offset);
+        if(nWritten == -1 && errno == EINTR)
+            continue;
+        if(nWritten <= 0)
+        {
+            traceEnd("write");
+            return STANDART_ERROR_CODE;
+        }
+        buffer += nWritten;
+        size -= nWritten;
+        offset += nWritten;
+    }
+    traceEnd("write");
+    return 0;
+}
+
+/**
+    \brief  Функция потока: считает длину текста своей части, дожидается
+            остальных, чтобы узнать свое смещение в файле, а затем сливает
+            часть деревом проигравших, форматирует ее в свой буфер и
+            пишет в файл через pwrite().
+*/
+static void* writePart(void* arg)
+{
+    struct WritePart* part = (struct WritePart*)arg;
+    traceThreadName("writer", part->id);
+    part->length = partTextLength(part->runs, part->nRuns, part->begin, part->end);
+    pthread_barrier_wait(part->lengthsReady);
+    off_t offset = 0;
+    for(int p = 0; p < part->id; p++)
+        offset += part->parts[p].length;
+
+    struct SortedRun* slices = (struct SortedRun*)malloc(part->nRuns * sizeof(struct SortedRun));
+    char* buffer = (char*)malloc(WRITER_BUFFER_SIZE + WRITER_MAX_INT_TEXT);
+    struct LoserTree tree;
+    if(!slices || !buffer)
+    {
+        free(slices);
+        free(buffer);
+        part->isFailed = true;
+        return NULL;
+    }
+    for(size_t i = 0; i < part->nRuns; i++)
+    {
+        slices[i].data = part->runs[i].data + part->begin[i];
+        slices[i].size = part->end[i] - part->begin[i];
+    }
+    if(!loserTreeInit(&tree, slices, part->nRuns))
+    {
+        free(slices);
+        free(buffer);
+        part->isFailed = true;
+        return NULL;
+    }
+
+    traceBegin("merge");
+    char* current = buffer;
+    char* limit = buffer + WRITER_BUFFER_SIZE;
+    int block[MERGE_POP_BLOCK];
+    size_t count;
+    while((count = loserTreePopBlock(&tree, block, MERGE_POP_BLOCK)) && !part->isFailed)
+        for(size_t i = 0; i < count; i++)
+        {
+            current = formatInt(current, block[i]);
+            if(current < limit)
+                continue;
+            if(pwriteFull(part->fd, buffer, current - buffer, offset) == STANDART_ERROR_CODE)
+                part->isFailed = true;
+            offset += current - buffer;
+            current = buffer;
+        }
+    if(current != buffer && !part->isFailed &&
+       pwriteFull(part->fd, buffer, current - buffer, offset) == STANDART_ERROR_CODE)
+        part->isFailed = true;
+    traceEnd("merge");
+
+    loserTreeDestroy(&tree);
+    free(slices);
+    free(buffer);
+    return NULL;
+}
+
+/**
+    \brief  Функция сливает отсортированные массивы в текстовый файл
+            на нескольких потоках.
+    \param  [in]  filename  имя выходного файла
+    \param  [in]  runs      отсортированные массивы
+    \param  [in]  nRuns     число массивов
+    \param  [in]  nThreads  число потоков
+    \return В случае успеха возвращается 0, иначе константа -1.
+    \details Результат слияния делится на nThreads частей равной длины
+             разрезами splitRunsAtRank(). Длина текста части не зависит
+             от порядка чисел, поэтому потоки сначала считают длины своих
+             частей, после чего смещения частей в файле известны еще до
+             слияния, и каждый поток пишет свою часть через pwrite()
+             независимо от остальных. Текст совпадает с тем, который
+             пишет последовательное слияние через OutputWriter.
+*/
+int writeRunsParallel(const char* filename, const struct SortedRun* runs, size_t nRuns, int nThreads)
+{
+    if(!filename || nThreads < 1)
+        return STANDART_ERROR_CODE;
+    size_t total = 0;
+    for(size_t i = 0; i < nRuns; i++)
+        total += runs[i].size;
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd == -1)
+    {
+        printf("Failed open file for writing.\n");
+        return STANDART_ERROR_CODE;
+    }
+
+    size_t* splits = (size_t*)calloc((nThreads + 1) * (nRuns ? nRuns : 1), sizeof(size_t));
+    struct WritePart* parts = (struct WritePart*)calloc(nThreads, sizeof(struct WritePart));
+    pthread_t* threads = (pthread_t*)calloc(nThreads, sizeof(pthread_t));
+    if(!splits || !parts || !threads)
+    {
+        free(splits);
+        free(parts);
+        free(threads);
+        close(fd);
+        return STANDART_ERROR_CODE;
+    }
+
+    for(int p = 1; p <= nThreads; p++)
+        splitRunsAtRank(runs, nRuns, total / nThreads * p + (p == nThreads ? total % nThreads : 0),
+                        splits + p * nRuns);
+    pthread_barrier_t lengthsReady;
+    pthread_barrier_init(&lengthsReady, NULL, nThreads);
+    for(int p = 0; p < nThreads; p++)
+    {
+        parts[p].id = p;
+        parts[p].fd = fd;
+        parts[p].runs = runs;
+        parts[p].nRuns = nRuns;
+        parts[p].begin = splits + p * nRuns;
+        parts[p].end = splits + (p + 1) * nRuns;
+        parts[p].parts = parts;
+        parts[p].lengthsReady = &lengthsReady;
+    }
+
+    for(int p = 1; p < nThreads; p++)
+        if(pthread_create(&threads[p], NULL, writePart, &parts[p]))
+            handle_error_rude("pthread_create");
+    writePart(&parts[0]);
+    bool isFailed = parts[0].isFailed;
+    for(int p = 1; p < nThreads; p++)
+    {
+        pthread_join(threads[p], NULL);
+        isFailed |= parts[p].isFailed;
+    }
+    pthread_barrier_destroy(&lengthsReady);
+
+    if(close(fd) == -1)
+        isFailed = true;
+    free(splits);
+    free(parts);
+    free(threads);
+    return isFailed ? STANDART_ERROR_CODE : 0;
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+
+/// самая длинная запись одного числа: "-2147483648 "
+#define WRITER_MAX_INT_TEXT 12
+/// число буферов, которые сбрасываются одним writev()
+#define WRITER_IOV 4
+
+/// способ, которым текст попадает в выходной файл
+enum WriteMode
+{
+    WRITE_BUFFERED, ///< write()/writev() через кэш страниц
+    WRITE_DIRECT,   ///< то же, но с O_DIRECT, в обход кэша страниц
+    WRITE_MMAP      ///< запись прямо в отображенный в память файл
+};
+
+/**
+    Буферизованная запись чисел в текстовый файл в формате "%d ".
+    Текст пишется в буферы, выровненные по странице; каждый буфер
+    отдается ядру ровно по bufferSize байт, а то, что не поместилось
+    в его конец, переносится в начало следующего. В режиме WRITE_MMAP
+    буфером служит окно отображения файла.
+*/
+struct OutputWriter
+{
+    int fd;
+    enum WriteMode mode;
+    char* current;          ///< куда будет записан следующий символ
+    char* limit;            ///< после этой границы буфер считается полным
+    bool isFailed;
+
+    // режимы WRITE_BUFFERED и WRITE_DIRECT
+    size_t bufferSize;
+    char* buffers[WRITER_IOV];
+    int filling;            ///< номер заполняемого буфера
+
+    // режим WRITE_MMAP
+    char* window;
+    size_t windowSize;
+    off_t windowOffset;
+};
+
+struct SortedRun;
+
+int writerOpen(struct OutputWriter* writer, const char* filename, enum WriteMode mode);
+void writerFlushFull(struct OutputWriter* writer);
+int writerClose(struct OutputWriter* writer);
+bool parseWriteMode(const char* name, enum WriteMode* mode);
+int writeRunsParallel(const char* filename, const struct SortedRun* runs, size_t nRuns, int nThreads);
+
+/**
+    \brief  Функция возвращает число десятичных цифр в number.
+*/
+static inline int decimalLength(unsigned int number)
+{
+    return number < 10 ? 1 : number < 100 ? 2 : number < 1000 ? 3 : number < 10000 ? 4 :
+           number < 100000 ? 5 : number < 1000000 ? 6 : number < 10000000 ? 7 :
+           number < 100000000 ? 8 : number < 1000000000 ? 9 : 10;
+}
+
+/**
+    \brief  Функция возвращает длину записи "%d " числа value.
+*/
+static inline size_t intTextLength(int value)
+{
+    return value < 0 ? decimalLength(0u - (unsigned int)value) + 2 : decimalLength(value) + 1;
+}
+
+/**
+    \brief  Функция переводит число в текст "%d " по таблице пар цифр.
+    \param  [out]  out  куда писать, нужно WRITER_MAX_INT_TEXT байт
+    \return Указатель за последний записанный символ.
+*/
+static inline char* formatInt(char* out, int value)
+{
+    static const char digitPairs[201] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    unsigned int number = value;
+    if(value < 0)
+    {
+        *out++ = '-';
+        number = 0u - number;
+    }
+    int length = decimalLength(number);
+    char* digit = out + length;
+    while(number >= 100)
+    {
+        unsigned int pair = number % 100;
+        number /= 100;
+        digit -= 2;
+        digit[0] = digitPairs[2 * pair];
+        digit[1] = digitPairs[2 * pair + 1];
+    }
+    if(number >= 10)
+    {
+        digit[-2] = digitPairs[2 * number];
+        digit[-1] = digitPairs[2 * number + 1];
+    }
+    else
+        digit[-1] = '0' + number;
+    out[length] = ' ';
+    return out + length + 1;
+}
+
+/**
+    \brief  Функция дописывает в файл число value, повторенное count раз.
+*/
+static inline void writerPutInts(struct OutputWriter* writer, int value, size_t count)
+{
+    char text[WRITER_MAX_INT_TEXT];
+    size_t length = formatInt(text, value) - text;
+    while(count--)
+    {
+        memcpy(writer->current, text, WRITER_MAX_INT_TEXT);
+        writer->current += length;
+        if(writer->current >= writer->limit)
+            writerFlushFull(writer);
+    }
+}
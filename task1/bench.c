@@ -0,0 +1,1170 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include "Sort.h"
+#include "Merge.h"
+#include "Context.h"
+#include "Coroutine.h"
+#include "Array.h"
+#include "Writer.h"
+#include "SimdSort.h"
+
+/*
+    Бенчмарки ядер сортировщика. Каждый режим запускается отдельной
+    подкомандой:
+
+        bench.out sort  [-n COUNT] [-a heap,merge,radix,adaptive] [-s SEED]
+        bench.out merge [-n COUNT] [-k 2,16,...,10000] [-l LIMIT] [-s SEED]
+        bench.out kernels [-n COUNT] [-i scalar,sse4.1,avx2] [-b 8,16,32,64] [-s SEED]
+        bench.out switch [-n COUNT]
+        bench.out schedule [-c COROUTINES] [-n COUNT] [-t THREADS] [-p rr,sff,...] [-s SEED]
+        bench.out channel [-c PAIRS] [-n COUNT] [-b CAPACITY] [-t THREADS]
+        bench.out generate -d DISTRIBUTION [-n COUNT] [-f FILES] [-o PREFIX] [-t THREADS] [-s SEED]
+        bench.out pipeline [-d uniform,sorted,...] [-n COUNT] [-f FILES] [-a heap,merge,radix,adaptive,auto]
+                           [-r mmap|aio|stream] [-o DIR] [-t THREADS] [-s SEED]
+
+    Время печатается в одном формате для всех режимов, чтобы
+    результаты разных запусков было удобно сравнивать.
+*/
+
+#define handle_error_rude(msg) \
+    do { perror(msg); exit(EXIT_FAILURE); } while (0)
+
+static double nowSeconds()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static uint64_t randomState = 88172645463325252ULL;
+
+static uint32_t nextRandomFrom(uint64_t* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return (uint32_t)(*state >> 16);
+}
+
+static uint32_t nextRandom()
+{
+    return nextRandomFrom(&randomState);
+}
+
+static bool isSorted(const int* array, size_t size)
+{
+    for(size_t i = 1; i < size; i++)
+        if(array[i - 1] > array[i])
+            return false;
+    return true;
+}
+
+
+//==================================================================================================
+
+//                               режим sort: сравнение алгоритмов
+
+//==================================================================================================
+
+struct SortJob
+{
+    int* array;
+    size_t size;
+    enum SortAlgorithm algorithm;
+    double seconds;
+};
+
+static void* sortJob(void* arg)
+{
+    struct SortJob* job = (struct SortJob*)arg;
+    double start = nowSeconds();
+    sortIntegers(job->array, job->size, job->algorithm);
+    job->seconds = nowSeconds() - start;
+    return NULL;
+}
+
+/**
+    \brief  Функция сортирует копию массива в отдельном потоке.
+    \note   Сортировка слиянием держит на стеке временные массивы
+            суммарным размером до двух исходных, поэтому стек потока
+            выделяется с запасом под них.
+*/
+static double timeSort(int* array, size_t size, enum SortAlgorithm algorithm)
+{
+    struct SortJob job = {array, size, algorithm, 0};
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 2 * size * sizeof(int) + (16 << 20));
+    pthread_t thread;
+    if(pthread_create(&thread, &attr, sortJob, &job))
+        handle_error_rude("pthread_create");
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+    return job.seconds;
+}
+
+static int benchSort(int argc, char* argv[])
+{
+    size_t count = 10 * 1000 * 1000;
+    char algorithms[256] = "heap,merge,radix,adaptive";
+    int opt;
+    while((opt = getopt(argc, argv, "n:a:s:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n': count = strtoull(optarg, NULL, 10); break;
+            case 'a': snprintf(algorithms, sizeof(algorithms), "%s", optarg); break;
+            case 's': randomState = strtoull(optarg, NULL, 10) | 1; break;
+            default:
+                printf("Usage: %s sort [-n COUNT] [-a heap,merge,radix,adaptive] [-s SEED]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    int* source = (int*)malloc(count * sizeof(int));
+    int* array = (int*)malloc(count * sizeof(int));
+    if(!source || !array)
+        handle_error_rude("Cant allocate memory for arrays.");
+    for(size_t i = 0; i < count; i++)
+        source[i] = (int)nextRandom();
+
+    printf("sort: %zu random ints\n", count);
+    for(char* name = strtok(algorithms, ","); name; name = strtok(NULL, ","))
+    {
+        enum SortAlgorithm algorithm;
+        if(!parseSortAlgorithm(name, &algorithm))
+        {
+            printf("Error: unknown sort algorithm `%s`\n", name);
+            continue;
+        }
+        memcpy(array, source, count * sizeof(int));
+        double seconds = timeSort(array, count, algorithm);
+        printf("%-8s %10.4lf s  %8.2lf Mkeys/s  %s\n", name, seconds,
+            seconds > 0 ? count / seconds / 1e6 : 0.0,
+            isSorted(array, count) ? "ok" : "NOT SORTED");
+    }
+
+    free(source);
+    free(array);
+    return 0;
+}
+
+
+
+//==================================================================================================
+
+//                               режим merge: k-путевое слияние
+
+//==================================================================================================
+
+/**
+    \brief  Слияние, которым раньше пользовался writeArraysInFile():
+            на каждое значение просматриваются все k массивов.
+    \note   Оставлено только для сравнения с деревом проигравших.
+*/
+static size_t mergeByLinearScan(const struct SortedRun* runs, size_t nRuns, int* out)
+{
+    size_t* index = (size_t*)calloc(nRuns, sizeof(size_t));
+    if(!index)
+        handle_error_rude("Cant allocate memory for indexes.");
+    size_t size = 0;
+    for(;;)
+    {
+        size_t best = nRuns;
+        for(size_t i = 0; i < nRuns; i++)
+            if(index[i] < runs[i].size &&
+               (best == nRuns || runs[i].data[index[i]] < runs[best].data[index[best]]))
+                best = i;
+        if(best == nRuns)
+            break;
+        int min = runs[best].data[index[best]];
+        for(size_t i = 0; i < nRuns; i++)
+            while(index[i] < runs[i].size && runs[i].data[index[i]] == min)
+            {
+                out[size++] = min;
+                index[i]++;
+            }
+    }
+    free(index);
+    return size;
+}
+
+static void printMergeResult(size_t k, const char* name, double seconds, size_t count, const int* out)
+{
+    printf("k=%-6zu %-7s %10.4lf s  %8.2lf Mkeys/s  %s\n", k, name, seconds,
+        seconds > 0 ? count / seconds / 1e6 : 0.0,
+        isSorted(out, count) ? "ok" : "NOT SORTED");
+}
+
+static int benchMerge(int argc, char* argv[])
+{
+    size_t count = 10 * 1000 * 1000;
+    size_t linearLimit = 256;
+    char ks[256] = "2,4,8,16,64,256,1000,4096,10000";
+    int opt;
+    while((opt = getopt(argc, argv, "n:k:l:s:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n': count = strtoull(optarg, NULL, 10); break;
+            case 'k': snprintf(ks, sizeof(ks), "%s", optarg); break;
+            case 'l': linearLimit = strtoull(optarg, NULL, 10); break;
+            case 's': randomState = strtoull(optarg, NULL, 10) | 1; break;
+            default:
+                printf("Usage: %s merge [-n COUNT] [-k 2,16,...] [-l LIMIT] [-s SEED]\n"
+                       "  LIMIT - largest k for which the old linear scan is timed too\n", argv[0]);
+                return 1;
+        }
+    }
+
+    int* source = (int*)malloc(count * sizeof(int));
+    int* out = (int*)malloc(count * sizeof(int));
+    if(!source || !out)
+        handle_error_rude("Cant allocate memory for arrays.");
+
+    printf("merge: %zu random ints split into k sorted runs\n", count);
+    for(char* item = strtok(ks, ","); item; item = strtok(NULL, ","))
+    {
+        size_t k = strtoull(item, NULL, 10);
+        if(!k || k > count)
+        {
+            printf("Error: wrong number of runs `%s`\n", item);
+            continue;
+        }
+        struct SortedRun* runs = (struct SortedRun*)malloc(k * sizeof(struct SortedRun));
+        if(!runs)
+            handle_error_rude("Cant allocate memory for runs.");
+        for(size_t i = 0; i < count; i++)
+            source[i] = (int)nextRandom();
+        for(size_t i = 0; i < k; i++)
+        {
+            size_t begin = count / k * i;
+            size_t end = i + 1 == k ? count : count / k * (i + 1);
+            sortIntegers(source + begin, end - begin, SORT_RADIX);
+            runs[i].data = source + begin;
+            runs[i].size = end - begin;
+        }
+
+        double start = nowSeconds();
+        size_t merged = mergeSortedRuns(runs, k, out);
+        printMergeResult(k, "loser", nowSeconds() - start, merged, out);
+
+        if(k <= linearLimit)
+        {
+            start = nowSeconds();
+            merged = mergeByLinearScan(runs, k, out);
+            printMergeResult(k, "linear", nowSeconds() - start, merged, out);
+        }
+        free(runs);
+    }
+
+    free(source);
+    free(out);
+    return 0;
+}
+
+
+
+//==================================================================================================
+
+//                               режим kernels: векторные ядра сортировки
+
+//==================================================================================================
+
+static void printKernelResult(const char* kernel, const char* name, double seconds, size_t count, bool isOk)
+{
+    printf("%-9s %-7s %10.4lf s  %8.2lf Mkeys/s  %s\n", kernel, name, seconds,
+        seconds > 0 ? count / seconds / 1e6 : 0.0, isOk ? "ok" : "NOT SORTED");
+}
+
+static int benchKernels(int argc, char* argv[])
+{
+    size_t count = 10 * 1000 * 1000;
+    char implementations[256] = "scalar,sse4.1,avx2";
+    char blockSizes[256] = "8,16,32,64";
+    int opt;
+    while((opt = getopt(argc, argv, "n:i:b:s:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n': count = strtoull(optarg, NULL, 10); break;
+            case 'i': snprintf(implementations, sizeof(implementations), "%s", optarg); break;
+            case 'b': snprintf(blockSizes, sizeof(blockSizes), "%s", optarg); break;
+            case 's': randomState = strtoull(optarg, NULL, 10) | 1; break;
+            default:
+                printf("Usage: %s kernels [-n COUNT] [-i scalar,sse4.1,avx2] [-b 8,16,32,64] [-s SEED]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    int* source = (int*)malloc(count * sizeof(int));
+    int* work = (int*)malloc(count * sizeof(int));
+    int* out = (int*)malloc(count * sizeof(int));
+    if(!source || !work || !out)
+        handle_error_rude("Cant allocate memory for arrays.");
+    for(size_t i = 0; i < count; i++)
+        source[i] = (int)nextRandom();
+    //для слияния - две отсортированные половины
+    size_t half = count / 2;
+    memcpy(work, source, count * sizeof(int));
+    sortIntegers(work, half, SORT_RADIX);
+    sortIntegers(work + half, count - half, SORT_RADIX);
+
+    printf("kernels: %zu random ints\n", count);
+    char* save = NULL;
+    for(char* name = strtok_r(implementations, ",", &save); name; name = strtok_r(NULL, ",", &save))
+    {
+        if(!selectSimdSort(name))
+        {
+            printf("Error: kernels `%s` are not supported here\n", name);
+            continue;
+        }
+        char list[256];
+        snprintf(list, sizeof(list), "%s", blockSizes);
+        char* saveSize = NULL;
+        for(char* item = strtok_r(list, ",", &saveSize); item; item = strtok_r(NULL, ",", &saveSize))
+        {
+            size_t size = strtoull(item, NULL, 10);
+            if(!size || size > SIMD_SORT_BLOCK)
+            {
+                printf("Error: wrong block size `%s`\n", item);
+                continue;
+            }
+            memcpy(out, source, count * sizeof(int));
+            size_t nSorted = count / size * size;
+            double start = nowSeconds();
+            for(size_t i = 0; i < nSorted; i += size)
+                sortBlock(out + i, size);
+            double seconds = nowSeconds() - start;
+            bool isOk = true;
+            for(size_t i = 0; i < nSorted; i += size)
+                isOk = isOk && isSorted(out + i, size);
+            char kernel[32];
+            snprintf(kernel, sizeof(kernel), "block=%zu", size);
+            printKernelResult(kernel, name, seconds, nSorted, isOk);
+        }
+
+        const int* left = work;
+        const int* right = work + half;
+        double start = nowSeconds();
+        size_t merged = mergeTwoRuns(&left, work + half, &right, work + count, out, count);
+        printKernelResult("merge2", name, nowSeconds() - start, merged, merged == count && isSorted(out, count));
+    }
+
+    free(source);
+    free(work);
+    free(out);
+    return 0;
+}
+
+
+
+//==================================================================================================
+
+//                               режим switch: переключение контекстов
+
+//==================================================================================================
+
+#define SWITCH_STACK_SIZE (64 * 1024)
+
+/// переключения туда и обратно между основным контекстом и корутиной
+struct PingPong
+{
+    struct ExecutionContext main;
+    struct ExecutionContext coroutine;
+    void (*switchTo)(struct ExecutionContext* from, struct ExecutionContext* to);
+};
+
+static struct PingPong pingPong;
+
+static void pingPongEntry(int arg)
+{
+    (void)arg;
+    for(;;)
+        pingPong.switchTo(&pingPong.coroutine, &pingPong.main);
+}
+
+#if CONTEXT_HAS_ASM
+static void asmSwitch(struct ExecutionContext* from, struct ExecutionContext* to)
+{
+    asmContextSwitch(&from->stackPointer, &to->stackPointer);
+}
+#endif
+
+/**
+    \brief  Функция меряет среднее время одного переключения контекста.
+    \return Время в наносекундах.
+*/
+static double timeSwitches(void (*init)(struct ExecutionContext*, void*, size_t, ContextEntry, int),
+                           void (*switchTo)(struct ExecutionContext*, struct ExecutionContext*),
+                           size_t count)
+{
+    void* stack = malloc(SWITCH_STACK_SIZE);
+    if(!stack)
+        handle_error_rude("Cant allocate memory for stack.");
+    pingPong.switchTo = switchTo;
+    init(&pingPong.coroutine, stack, SWITCH_STACK_SIZE, pingPongEntry, 0);
+
+    double start = nowSeconds();
+    for(size_t i = 0; i < count; i++)
+        switchTo(&pingPong.main, &pingPong.coroutine);
+    double seconds = nowSeconds() - start;
+
+    free(stack);
+    return seconds / (2.0 * count) * 1e9;
+}
+
+static int benchSwitch(int argc, char* argv[])
+{
+    size_t count = 1000 * 1000;
+    int opt;
+    while((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n': count = strtoull(optarg, NULL, 10); break;
+            default:
+                printf("Usage: %s switch [-n COUNT]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(!count)
+        count = 1;
+
+    printf("switch: %zu round trips, runtime uses %s\n", count, contextBackendName());
+#if CONTEXT_HAS_ASM
+    double asmNs = timeSwitches(asmContextInit, asmSwitch, count);
+    printf("%-9s %8.2lf ns/switch\n", "asm", asmNs);
+#endif
+    double ucontextNs = timeSwitches(ucontextInit, ucontextSwitch, count);
+    printf("%-9s %8.2lf ns/switch\n", "ucontext", ucontextNs);
+    return 0;
+}
+
+
+
+//==================================================================================================
+
+//                               режим schedule: политики планирования
+
+//==================================================================================================
+
+/// задача для корутины: отсортировать свою копию массива
+struct ScheduleJob
+{
+    int* source;
+    int* array;
+    size_t size;
+};
+
+static void scheduleJob(int id, void* arg)
+{
+    (void)id;
+    struct ScheduleJob* job = (struct ScheduleJob*)arg;
+    sortIntegers(job->array, job->size, SORT_HEAP);
+}
+
+/**
+    \brief  Бенчмарк сортирует на корутинах массивы очень разных
+            размеров под каждой политикой и печатает время до первого
+            результата, среднее время завершения и время до последнего.
+    \note   Размеры массивов растут в геометрической прогрессии, а
+            статические приоритеты - случайная перестановка, чтобы
+            политика priority не совпадала ни с одной другой.
+*/
+static int benchSchedule(int argc, char* argv[])
+{
+    int nCoroutines = 16;
+    size_t count = 4 * 1000 * 1000;
+    int nThreads = 1;
+    char policies[256] = "rr,sff,least-time,priority";
+    int opt;
+    while((opt = getopt(argc, argv, "c:n:t:p:s:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'c': nCoroutines = atoi(optarg); break;
+            case 'n': count = strtoull(optarg, NULL, 10); break;
+            case 't': nThreads = atoi(optarg); break;
+            case 'p': snprintf(policies, sizeof(policies), "%s", optarg); break;
+            case 's': randomState = strtoull(optarg, NULL, 10) | 1; break;
+            default:
+                printf("Usage: %s schedule [-c COROUTINES] [-n COUNT] [-t THREADS]\n"
+                       "          [-p rr,sff,least-time,priority] [-s SEED]\n"
+                       "  COUNT - total number of ints sorted by all coroutines\n", argv[0]);
+                return 1;
+        }
+    }
+    if(nCoroutines <= 0 || nThreads <= 0)
+    {
+        printf("Error: wrong number of coroutines or threads\n");
+        return 1;
+    }
+
+    //доля каждой корутины - случайная степень двойки от 1 до 128
+    struct ScheduleJob* jobs = (struct ScheduleJob*)calloc(nCoroutines, sizeof(struct ScheduleJob));
+    int* priorities = (int*)malloc(nCoroutines * sizeof(int));
+    if(!jobs || !priorities)
+        handle_error_rude("Cant allocate memory for jobs.");
+    size_t totalWeight = 0;
+    for(int i = 0; i < nCoroutines; i++)
+    {
+        jobs[i].size = (size_t)1 << (nextRandom() % 8);
+        totalWeight += jobs[i].size;
+        priorities[i] = i;
+    }
+    for(int i = nCoroutines - 1; i > 0; i--)
+    {
+        int j = nextRandom() % (i + 1);
+        int swap = priorities[i];
+        priorities[i] = priorities[j];
+        priorities[j] = swap;
+    }
+    for(int i = 0; i < nCoroutines; i++)
+    {
+        jobs[i].size = count * jobs[i].size / totalWeight + 1;
+        jobs[i].source = (int*)malloc(jobs[i].size * sizeof(int));
+        jobs[i].array = (int*)malloc(jobs[i].size * sizeof(int));
+        if(!jobs[i].source || !jobs[i].array)
+            handle_error_rude("Cant allocate memory for arrays.");
+        for(size_t j = 0; j < jobs[i].size; j++)
+            jobs[i].source[j] = (int)nextRandom();
+    }
+
+    printf("schedule: %d coroutines, %zu ints in total, %d threads\n", nCoroutines, count, nThreads);
+    for(char* name = strtok(policies, ","); name; name = strtok(NULL, ","))
+    {
+        enum SchedulingPolicy policy;
+        if(!parseSchedulingPolicy(name, &policy))
+        {
+            printf("Error: unknown scheduling policy `%s`\n", name);
+            continue;
+        }
+        allocateMemoryForCoroutine(nCoroutines);
+        for(int i = 0; i < nCoroutines; i++)
+        {
+            memcpy(jobs[i].array, jobs[i].source, jobs[i].size * sizeof(int));
+            createCoroutine(i, scheduleJob, &jobs[i]);
+            setCoroutineHints(i, jobs[i].size, priorities[i]);
+        }
+        setSchedulingPolicy(policy);
+        runCoroutines(nThreads);
+
+        double meanFinish = 0;
+        bool isOk = true;
+        for(int i = 0; i < nCoroutines; i++)
+        {
+            meanFinish += getSchedulerInfo(i)->finishTime * 1e-6 / nCoroutines;
+            isOk = isOk && isSorted(jobs[i].array, jobs[i].size);
+        }
+        const struct RuntimeInfo* info = getRuntimeInfo();
+        printf("%-11s first %8.4lf s  mean %8.4lf s  makespan %8.4lf s  %s\n", name,
+            info->firstResultTime * 1e-6, meanFinish, info->makespan * 1e-6,
+            isOk ? "ok" : "NOT SORTED");
+        cleanMemoryForCoroutine(nCoroutines);
+    }
+
+    for(int i = 0; i < nCoroutines; i++)
+    {
+        free(jobs[i].source);
+        free(jobs[i].array);
+    }
+    free(jobs);
+    free(priorities);
+    return 0;
+}
+
+
+//==================================================================================================
+
+//                               режим channel: передача между корутинами
+
+//==================================================================================================
+
+/// общее состояние производителей, потребителей и закрывающей корутины
+struct ChannelBench
+{
+    struct Channel channel;
+    struct WaitGroup producers;
+    size_t count;               ///< сколько чисел отправляет каждый производитель
+    int nPairs;
+    uint64_t* sums;             ///< сумма принятого каждым потребителем
+};
+
+static struct ChannelBench channelBench;
+
+static void producerJob(int id, void* arg)
+{
+    (void)id;
+    (void)arg;
+    for(size_t i = 1; i <= channelBench.count; i++)
+    {
+        uint64_t value = i;
+        channelSend(&channelBench.channel, &value);
+    }
+    waitGroupDone(&channelBench.producers);
+}
+
+static void consumerJob(int id, void* arg)
+{
+    (void)arg;
+    uint64_t value;
+    while(channelReceive(&channelBench.channel, &value))
+        channelBench.sums[id - channelBench.nPairs] += value;
+}
+
+static void closerJob(int id, void* arg)
+{
+    (void)id;
+    (void)arg;
+    waitGroupWait(&channelBench.producers);
+    channelClose(&channelBench.channel);
+}
+
+/**
+    \brief  Бенчмарк гоняет числа через канал от PAIRS производителей
+            к PAIRS потребителям и печатает время одной передачи.
+    \note   Канал закрывает отдельная корутина, дождавшись WaitGroup
+            производителей, поэтому проверяются и ожидание WaitGroup
+            в корутине, и пробуждение ждущих при закрытии.
+*/
+static int benchChannel(int argc, char* argv[])
+{
+    int nPairs = 4;
+    size_t count = 1000 * 1000;
+    size_t capacity = 64;
+    int nThreads = 1;
+    int opt;
+    while((opt = getopt(argc, argv, "c:n:b:t:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'c': nPairs = atoi(optarg); break;
+            case 'n': count = strtoull(optarg, NULL, 10); break;
+            case 'b': capacity = strtoull(optarg, NULL, 10); break;
+            case 't': nThreads = atoi(optarg); break;
+            default:
+                nPairs = 0;
+                break;
+        }
+    }
+    if(nPairs <= 0 || nThreads <= 0 || !capacity)
+    {
+        printf("Usage: %s channel [-c PAIRS] [-n COUNT] [-b CAPACITY] [-t THREADS]\n"
+               "  COUNT - ints sent by every producer\n", argv[0]);
+        return 1;
+    }
+
+    channelBench.count = count;
+    channelBench.nPairs = nPairs;
+    channelBench.sums = (uint64_t*)calloc(nPairs, sizeof(uint64_t));
+    if(!channelBench.sums || !channelInit(&channelBench.channel, sizeof(uint64_t), capacity))
+        handle_error_rude("Cant allocate memory for channel.");
+    waitGroupInit(&channelBench.producers, nPairs);
+
+    int nCoroutines = 2 * nPairs + 1;
+    allocateMemoryForCoroutine(nCoroutines);
+    for(int i = 0; i < nPairs; i++)
+    {
+        createCoroutine(i, producerJob, NULL);
+        createCoroutine(nPairs + i, consumerJob, NULL);
+    }
+    createCoroutine(2 * nPairs, closerJob, NULL);
+
+    double start = nowSeconds();
+    runCoroutines(nThreads);
+    double seconds = nowSeconds() - start;
+
+    uint64_t total = 0;
+    for(int i = 0; i < nPairs; i++)
+        total += channelBench.sums[i];
+    uint64_t expected = (uint64_t)nPairs * count * (count + 1) / 2;
+    size_t nMessages = nPairs * count;
+    printf("channel: %d producers, %d consumers, capacity %zu, %d threads\n", nPairs, nPairs, capacity, nThreads);
+    printf("%zu messages %10.4lf s  %8.2lf ns/message  %s\n", nMessages, seconds,
+        nMessages ? seconds / nMessages * 1e9 : 0.0, total == expected ? "ok" : "LOST MESSAGES");
+
+    cleanMemoryForCoroutine(nCoroutines);
+    waitGroupDestroy(&channelBench.producers);
+    channelDestroy(&channelBench.channel);
+    free(channelBench.sums);
+    return 0;
+}
+
+
+
+
+//==================================================================================================
+
+//                               режим generate: наборы данных
+
+//==================================================================================================
+
+// столько чисел генерируется и пишется за раз
+#define GENERATE_BLOCK (1 << 20)
+// столько разных значений в распределении few-unique
+#define FEW_UNIQUE_VALUES 16
+// число рангов и показатель распределения Ципфа
+#define ZIPF_RANKS (1 << 16)
+#define ZIPF_EXPONENT 1.0
+// в nearly-sorted одна перестановка пары приходится на столько чисел
+#define NEARLY_SORTED_SWAP_EVERY 100
+// narrow равномерно заполняет [0, NARROW_RANGE), как generator.py -m
+#define NARROW_RANGE (1 << 16)
+
+enum Distribution
+{
+    DIST_UNIFORM,       ///< равномерно по всем int
+    DIST_SORTED,        ///< по возрастанию
+    DIST_REVERSE,       ///< по убыванию
+    DIST_FEW_UNIQUE,    ///< FEW_UNIQUE_VALUES разных значений
+    DIST_ZIPF,          ///< ранги по закону Ципфа, перемешанные по всем int
+    DIST_NEARLY_SORTED, ///< по возрастанию, но часть пар переставлена
+    DIST_NARROW         ///< равномерно по узкому диапазону
+};
+
+static const char* distributionNames[] = {"uniform", "sorted", "reverse", "few-unique", "zipf", "nearly-sorted", "narrow"};
+
+static bool parseDistribution(const char* name, enum Distribution* distribution)
+{
+    for(unsigned i = 0; i < sizeof(distributionNames) / sizeof(distributionNames[0]); i++)
+        if(!strcmp(name, distributionNames[i]))
+        {
+            *distribution = (enum Distribution)i;
+            return true;
+        }
+    return false;
+}
+
+/// набор файлов, который генерируют несколько потоков, забирая файлы по одному
+struct Dataset
+{
+    enum Distribution distribution;
+    const char* prefix;         ///< файлы называются PREFIX<номер>.txt
+    int nFiles;
+    size_t count;               ///< чисел во всех файлах вместе
+    uint64_t seed;
+    atomic_int nextFile;
+    atomic_bool isFailed;
+    int fewUnique[FEW_UNIQUE_VALUES];
+    double* zipfCdf;            ///< функция распределения рангов, только для DIST_ZIPF
+};
+
+/// состояние генерации одного файла
+struct FileGenerator
+{
+    const struct Dataset* dataset;
+    uint64_t random;
+    int64_t last;               ///< последнее число монотонных распределений
+    uint64_t twiceStep;         ///< удвоенный средний шаг монотонных распределений
+};
+
+/**
+    \brief  Функция генерирует очередные count чисел файла.
+    \note   Монотонные распределения идут от INT_MIN вверх (или от
+            INT_MAX вниз) случайными шагами, так что файл занимает
+            около половины диапазона int, а сортировать блоки не нужно.
+            В nearly-sorted пары переставляются внутри блока.
+*/
+static void generateBlock(struct FileGenerator* generator, int* block, size_t count)
+{
+    const struct Dataset* dataset = generator->dataset;
+    for(size_t i = 0; i < count; i++)
+    {
+        uint32_t random = nextRandomFrom(&generator->random);
+        switch(dataset->distribution)
+        {
+            case DIST_UNIFORM:
+                block[i] = (int)random;
+                break;
+            case DIST_NARROW:
+                block[i] = (int)(random % NARROW_RANGE);
+                break;
+            case DIST_FEW_UNIQUE:
+                block[i] = dataset->fewUnique[random % FEW_UNIQUE_VALUES];
+                break;
+            case DIST_ZIPF:
+            {
+                double u = random / 4294967296.0;
+                size_t low = 0;
+                size_t high = ZIPF_RANKS - 1;
+                while(low < high)
+                {
+                    size_t middle = (low + high) / 2;
+                    if(dataset->zipfCdf[middle] < u)
+                        low = middle + 1;
+                    else
+                        high = middle;
+                }
+                // умножение на нечетное число переставляет значения, не склеивая их
+                block[i] = (int)((uint32_t)low * 2654435761u);
+                break;
+            }
+            default:
+            {
+                int64_t step = (uint64_t)random * generator->twiceStep >> 32;
+                if(dataset->distribution == DIST_REVERSE)
+                    generator->last = generator->last - step < INT_MIN ? INT_MIN : generator->last - step;
+                else
+                    generator->last = generator->last + step > INT_MAX ? INT_MAX : generator->last + step;
+                block[i] = (int)generator->last;
+                break;
+            }
+        }
+    }
+    if(dataset->distribution == DIST_NEARLY_SORTED)
+        for(size_t i = 0; i < count / NEARLY_SORTED_SWAP_EVERY; i++)
+        {
+            size_t a = nextRandomFrom(&generator->random) % count;
+            size_t b = nextRandomFrom(&generator->random) % count;
+            int swap = block[a];
+            block[a] = block[b];
+            block[b] = swap;
+        }
+}
+
+/**
+    \brief  Функция генерирует один файл набора.
+    \return true в случае успеха, false иначе.
+*/
+static bool generateFile(struct Dataset* dataset, int file, int* block, char* text)
+{
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "%s%d.txt", dataset->prefix, file);
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd == -1)
+    {
+        printf("Error: cant write file `%s`\n", name);
+        return false;
+    }
+
+    size_t count = dataset->count / dataset->nFiles + (file < (int)(dataset->count % dataset->nFiles));
+    struct FileGenerator generator;
+    generator.dataset = dataset;
+    generator.random = (dataset->seed ^ (uint64_t)(file + 1) * 0x9E3779B97F4A7C15ULL) | 1;
+    generator.last = dataset->distribution == DIST_REVERSE ? INT_MAX : INT_MIN;
+    generator.twiceStep = count ? (1ULL << 32) / count : 0;
+
+    bool isOk = true;
+    for(size_t done = 0; done < count && isOk; )
+    {
+        size_t n = count - done < GENERATE_BLOCK ? count - done : GENERATE_BLOCK;
+        generateBlock(&generator, block, n);
+        char* end = text;
+        for(size_t i = 0; i < n; i++)
+            end = formatInt(end, block[i]);
+        for(char* begin = text; begin < end && isOk; )
+        {
+            ssize_t nWritten = write(fd, begin, end - begin);
+            isOk = nWritten > 0;
+            begin += isOk ? nWritten : 0;
+        }
+        done += n;
+    }
+    if(close(fd) == -1 || !isOk)
+    {
+        printf("Error: cant write file `%s`\n", name);
+        return false;
+    }
+    return true;
+}
+
+static void* generateFiles(void* arg)
+{
+    struct Dataset* dataset = (struct Dataset*)arg;
+    int* block = (int*)malloc(GENERATE_BLOCK * sizeof(int));
+    char* text = (char*)malloc(GENERATE_BLOCK * WRITER_MAX_INT_TEXT);
+    if(!block || !text)
+        handle_error_rude("Cant allocate memory for generation.");
+    int file;
+    while((file = atomic_fetch_add(&dataset->nextFile, 1)) < dataset->nFiles)
+        if(!generateFile(dataset, file, block, text))
+            atomic_store(&dataset->isFailed, true);
+    free(block);
+    free(text);
+    return NULL;
+}
+
+/**
+    \brief  Функция генерирует набор файлов на nThreads потоках.
+    \return Время генерации в секундах или -1, если какой-то файл
+            записать не удалось.
+    \note   Числа файла зависят только от seed и номера файла, поэтому
+            набор не зависит от числа потоков.
+*/
+static double generateDataset(enum Distribution distribution, const char* prefix, int nFiles,
+                              size_t count, int nThreads, uint64_t seed)
+{
+    struct Dataset dataset;
+    memset(&dataset, 0, sizeof(dataset));
+    dataset.distribution = distribution;
+    dataset.prefix = prefix;
+    dataset.nFiles = nFiles;
+    dataset.count = count;
+    dataset.seed = seed;
+    atomic_init(&dataset.nextFile, 0);
+    atomic_init(&dataset.isFailed, false);
+
+    uint64_t random = seed | 1;
+    for(int i = 0; i < FEW_UNIQUE_VALUES; i++)
+        dataset.fewUnique[i] = (int)nextRandomFrom(&random);
+    if(distribution == DIST_ZIPF)
+    {
+        dataset.zipfCdf = (double*)malloc(ZIPF_RANKS * sizeof(double));
+        if(!dataset.zipfCdf)
+            handle_error_rude("Cant allocate memory for generation.");
+        double sum = 0;
+        for(size_t rank = 0; rank < ZIPF_RANKS; rank++)
+            dataset.zipfCdf[rank] = sum += 1.0 / pow(rank + 1, ZIPF_EXPONENT);
+        for(size_t rank = 0; rank < ZIPF_RANKS; rank++)
+            dataset.zipfCdf[rank] /= sum;
+    }
+
+    double start = nowSeconds();
+    pthread_t* threads = (pthread_t*)calloc(nThreads, sizeof(pthread_t));
+    if(!threads)
+        handle_error_rude("Cant allocate memory for threads.");
+    for(int i = 1; i < nThreads; i++)
+        if(pthread_create(&threads[i], NULL, generateFiles, &dataset))
+            handle_error_rude("pthread_create");
+    generateFiles(&dataset);
+    for(int i = 1; i < nThreads; i++)
+        pthread_join(threads[i], NULL);
+    double seconds = nowSeconds() - start;
+
+    free(threads);
+    free(dataset.zipfCdf);
+    return atomic_load(&dataset.isFailed) ? -1 : seconds;
+}
+
+static int defaultThreads()
+{
+    long nProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+    return nProcessors > 0 ? nProcessors : 1;
+}
+
+static int benchGenerate(int argc, char* argv[])
+{
+    size_t count = 10 * 1000 * 1000;
+    int nFiles = 1;
+    int nThreads = defaultThreads();
+    const char* prefix = "data";
+    enum Distribution distribution = DIST_UNIFORM;
+    bool hasDistribution = false;
+    int opt;
+    while((opt = getopt(argc, argv, "d:n:f:o:t:s:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'd':
+                hasDistribution = parseDistribution(optarg, &distribution);
+                if(!hasDistribution)
+                    printf("Error: unknown distribution `%s`\n", optarg);
+                break;
+            case 'n': count = strtoull(optarg, NULL, 10); break;
+            case 'f': nFiles = atoi(optarg); break;
+            case 'o': prefix = optarg; break;
+            case 't': nThreads = atoi(optarg); break;
+            case 's': randomState = strtoull(optarg, NULL, 10) | 1; break;
+            default:
+                hasDistribution = false;
+                break;
+        }
+    }
+    if(!hasDistribution || nFiles <= 0 || nThreads <= 0)
+    {
+        printf("Usage: %s generate -d uniform|sorted|reverse|few-unique|zipf|nearly-sorted|narrow\n"
+               "          [-n COUNT] [-f FILES] [-o PREFIX] [-t THREADS] [-s SEED]\n"
+               "  COUNT ints in total are written to PREFIX0.txt ... PREFIX<FILES-1>.txt\n", argv[0]);
+        return 1;
+    }
+
+    double seconds = generateDataset(distribution, prefix, nFiles, count, nThreads, randomState);
+    if(seconds < 0)
+        return 1;
+    printf("generate: %zu %s ints in %d files, %d threads  %8.4lf s  %8.2lf Mkeys/s\n",
+        count, distributionNames[distribution], nFiles, nThreads, seconds,
+        seconds > 0 ? count / seconds / 1e6 : 0.0);
+    return 0;
+}
+
+
+
+//==================================================================================================
+
+//                               режим pipeline: этапы сортировщика
+
+//==================================================================================================
+
+/**
+    \brief  Бенчмарк проводит наборы файлов через те же этапы, что и
+            сортировщик, и меряет каждый этап отдельно.
+    \details Для каждого распределения генерируется набор файлов, и
+             каждый файл читается loadArrayFromFile(): время разбора
+             она меряет сама, а остальное время считается чтением.
+             Затем под каждым алгоритмом копии массивов сортируются по
+             одному, а результаты сливаются деревом проигравших.
+             Этапы идут на одном потоке, чтобы время не зависело от
+             числа процессоров.
+*/
+static int benchPipeline(int argc, char* argv[])
+{
+    size_t count = 10 * 1000 * 1000;
+    int nFiles = 8;
+    int nThreads = defaultThreads();
+    const char* directory = "/tmp";
+    char distributions[256] = "uniform,sorted,reverse,few-unique,zipf,nearly-sorted,narrow";
+    char algorithms[256] = "heap,merge,radix,adaptive,auto";
+    struct SortConfig config = { READ_MMAP, 4 * 1024 * 1024, SORT_HEAP, 0, 0, NULL };
+    int opt;
+    while((opt = getopt(argc, argv, "d:n:f:a:r:o:t:s:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'd': snprintf(distributions, sizeof(distributions), "%s", optarg); break;
+            case 'n': count = strtoull(optarg, NULL, 10); break;
+            case 'f': nFiles = atoi(optarg); break;
+            case 'a': snprintf(algorithms, sizeof(algorithms), "%s", optarg); break;
+            case 'r':
+                config.readMode = !strcmp(optarg, "aio") ? READ_AIO :
+                                  !strcmp(optarg, "stream") ? READ_STREAM : READ_MMAP;
+                break;
+            case 'o': directory = optarg; break;
+            case 't': nThreads = atoi(optarg); break;
+            case 's': randomState = strtoull(optarg, NULL, 10) | 1; break;
+            default:
+                nFiles = 0;
+                break;
+        }
+    }
+    if(nFiles <= 0 || nThreads <= 0)
+    {
+        printf("Usage: %s pipeline [-d uniform,sorted,...] [-n COUNT] [-f FILES]\n"
+               "          [-a heap,merge,radix,adaptive,auto] [-r mmap|aio|stream] [-o DIR] [-t THREADS] [-s SEED]\n"
+               "  THREADS - threads generating the files, the stages run on one thread\n", argv[0]);
+        return 1;
+    }
+
+    struct Array* arrays = (struct Array*)calloc(nFiles, sizeof(struct Array));
+    struct SortedRun* runs = (struct SortedRun*)calloc(nFiles, sizeof(struct SortedRun));
+    int* sorted = (int*)malloc((count ? count : 1) * sizeof(int));
+    int* merged = (int*)malloc((count ? count : 1) * sizeof(int));
+    if(!arrays || !runs || !sorted || !merged)
+        handle_error_rude("Cant allocate memory for arrays.");
+
+    printf("pipeline: %zu ints in %d files\n", count, nFiles);
+    printf("%-14s %-8s %10s %10s %10s %10s %10s\n", "distribution", "algo", "read s", "parse s", "sort s", "merge s", "Mkeys/s");
+    for(char* dist = strtok(distributions, ","); dist; dist = strtok(NULL, ","))
+    {
+        enum Distribution distribution;
+        if(!parseDistribution(dist, &distribution))
+        {
+            printf("Error: unknown distribution `%s`\n", dist);
+            continue;
+        }
+        char prefix[PATH_MAX];
+        snprintf(prefix, sizeof(prefix), "%s/bench-%s-", directory, dist);
+        if(generateDataset(distribution, prefix, nFiles, count, nThreads, randomState) < 0)
+            continue;
+
+        //чтение и разбор
+        double readTime = 0;
+        double parseTime = 0;
+        size_t total = 0;
+        for(int i = 0; i < nFiles; i++)
+        {
+            char name[PATH_MAX + 16];
+            snprintf(name, sizeof(name), "%s%d.txt", prefix, i);
+            double start = nowSeconds();
+            arrays[i] = loadArrayFromFile(name, &config);
+            readTime += nowSeconds() - start - arrays[i].parseTime;
+            parseTime += arrays[i].parseTime;
+            unlink(name);
+            if(!arrays[i].data || total + arrays[i].size > count)
+                handle_error_rude("Cant read generated file.");
+            total += arrays[i].size;
+        }
+
+        //сортировка и слияние под каждым алгоритмом
+        char list[256];
+        snprintf(list, sizeof(list), "%s", algorithms);
+        char* save = NULL;
+        for(char* name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save))
+        {
+            enum SortAlgorithm algorithm;
+            if(!parseSortAlgorithm(name, &algorithm))
+            {
+                printf("Error: unknown sort algorithm `%s`\n", name);
+                continue;
+            }
+            double sortTime = 0;
+            size_t offset = 0;
+            for(int i = 0; i < nFiles; i++)
+            {
+                memcpy(sorted + offset, arrays[i].data, arrays[i].size * sizeof(int));
+                sortTime += timeSort(sorted + offset, arrays[i].size, algorithm);
+                runs[i].data = sorted + offset;
+                runs[i].size = arrays[i].size;
+                offset += arrays[i].size;
+            }
+            double start = nowSeconds();
+            size_t nMerged = mergeSortedRuns(runs, nFiles, merged);
+            double mergeTime = nowSeconds() - start;
+
+            double totalTime = readTime + parseTime + sortTime + mergeTime;
+            printf("%-14s %-8s %10.4lf %10.4lf %10.4lf %10.4lf %10.2lf  %s\n", dist, name,
+                readTime, parseTime, sortTime, mergeTime, totalTime > 0 ? total / totalTime / 1e6 : 0.0,
+                nMerged == total && isSorted(merged, total) ? "ok" : "NOT SORTED");
+            if(algorithm == SORT_AUTO && nFiles > 0)
+            {
+                struct SortPlan plan;
+                planSort(arrays[0].data, arrays[0].size, &plan);
+                printf("%-14s %-8s planned %s: %s\n", "", "", sortAlgorithmName(plan.algorithm), plan.reason);
+            }
+        }
+        for(int i = 0; i < nFiles; i++)
+            free(arrays[i].data);
+    }
+
+    free(arrays);
+    free(runs);
+    free(sorted);
+    free(merged);
+    return 0;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if(argc >= 2 && !strcmp(argv[1], "sort"))
+        return benchSort(argc - 1, argv + 1);
+    if(argc >= 2 && !strcmp(argv[1], "merge"))
+        return benchMerge(argc - 1, argv + 1);
+    if(argc >= 2 && !strcmp(argv[1], "kernels"))
+        return benchKernels(argc - 1, argv + 1);
+    if(argc >= 2 && !strcmp(argv[1], "switch"))
+        return benchSwitch(argc - 1, argv + 1);
+    if(argc >= 2 && !strcmp(argv[1], "schedule"))
+        return benchSchedule(argc - 1, argv + 1);
+    if(argc >= 2 && !strcmp(argv[1], "channel"))
+        return benchChannel(argc - 1, argv + 1);
+    if(argc >= 2 && !strcmp(argv[1], "generate"))
+        return benchGenerate(argc - 1, argv + 1);
+    if(argc >= 2 && !strcmp(argv[1], "pipeline"))
+        return benchPipeline(argc - 1, argv + 1);
+
+    printf("Usage: %s sort|merge|kernels|switch|schedule|channel|generate|pipeline [options]\n", argv[0]);
+    return 1;
+}
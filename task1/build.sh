@@ -1 +1,2 @@
-gcc -g main.c StrLib.c Array.c -o sorter.out -Wno-incompatible-pointer-types -lrt
+gcc -g -O2 -fstack-clash-protection main.c Coroutine.c StrLib.c Array.c Sort.c SimdSort.c IntParser.c Merge.c Writer.c External.c RunFile.c Context.c Metrics.c Trace.c -o sorter.out -Wno-incompatible-pointer-types -lrt -lpthread -lm
+gcc -g -O2 bench.c Sort.c SimdSort.c Merge.c Context.c Coroutine.c Trace.c Array.c StrLib.c IntParser.c RunFile.c -o bench.out -lrt -lpthread -lm
@@ -1,29 +1,34 @@
 #include <stdlib.h>
 #include <stdio.h>
-#include <signal.h>
 #include <unistd.h>
-#include <ucontext.h>
 #include <limits.h>
 #include <time.h>
 #include <sys/types.h>
-#include <sys/time.h>
+#include <sys/stat.h>
 #include <assert.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
 
 #include "Array.h"
 #include "StrLib.h"
-
-// время в микросекундах, через которое будет вызываться планировщик 
-#define TIME_LEGACY 2000 
-
-#define KB * 1024
-#define MB * 1024 KB
-#define STACK_SIZE 1 MB
+#include "IntParser.h"
+#include "Coroutine.h"
+#include "Merge.h"
+#include "Writer.h"
+#include "External.h"
+#include "RunFile.h"
+#include "Metrics.h"
+#include "Trace.h"
 
 #define handle_error_rude(msg) \
     do { perror(msg); exit(EXIT_FAILURE); } while (0)
 #define say_error_and_return(msg) \
     do{printf("%s\n", msg); return;} while(0)
 
+// меньше этого числа элементов на поток финальное слияние не делится
+#define MIN_MERGE_PART (256 * 1024)
+
 #if DEBUG
     #define DEBUG_OUTPUT(code) code
 #else
@@ -32,410 +37,849 @@
 
 //==================================================================================================
 
-//                               функции для работы с корутинами
+//                               задачи, исполняемые корутинами
 
 //==================================================================================================
 
 
-struct SchedulerInfo
-{
-    size_t swapTimes;
-    size_t totalWakingTime;
-};
-
-static ucontext_t uctx_main;
 static int nContexts = 0;
-static int currentContextIndex = 0;
-
-static ucontext_t* myContexts = NULL;
 static struct Array* sortedArrays = NULL;
-static struct SchedulerInfo* contextTimeInfo = NULL;
-static clock_t currentClock = 0;
-
 
-static ucontext_t signal_context;
-static void *signal_stack; 
+static struct SortConfig sortConfig = { READ_MMAP, 4 * 1024 * 1024, SORT_HEAP, 64 * 1024 * 1024, 0, NULL };
+// число потоков-исполнителей корутин, 0 - по числу процессоров
+static int nThreads = 0;
+// способ записи результата
+static enum WriteMode writeMode = WRITE_BUFFERED;
+// формат результата
+static enum RunFormat outputFormat = RUN_FORMAT_TEXT;
+// режим преобразования файлов в outputFormat без сортировки
+static bool isConvertMode = false;
+// порядок, в котором исполнители берут задачи
+static enum SchedulingPolicy schedulingPolicy = SCHEDULE_ROUND_ROBIN;
+// список файлов для режима манифеста, "-" - стандартный ввод
+static const char* manifestName = NULL;
+// в режиме манифеста больше корутин одновременно не работает; память
+// этим ограничена только вместе с --memory, иначе каждая корутина
+// держит в памяти все числа своих файлов
+static int maxLiveCoroutines = 64;
+// куда записать отчет в формате JSON, NULL - не записывать
+static const char* metricsName = NULL;
+// куда записать трассу в формате Chrome trace event, NULL - не трассировать
+static const char* traceName = NULL;
+
+/// задача одной корутины: диапазон одного из входных файлов
+struct SortTask
+{
+    const char* filename;
+    struct FileRange range;
+    size_t size;        ///< размер диапазона в байтах, 0 если неизвестен
+    int priority;       ///< номер файла в командной строке
+};
 
-#define CLOCK_DELAY ( clock() - currentClock ); currentClock = clock()
+static struct SortTask* tasks = NULL;
+// сколько корутин еще не закончили сортировку
+static struct WaitGroup sortsPending;
 
 /**
-    \brief  Функция проверяет, все ли массивы отсортированны.
-    \return true, в случае, когда все массивы отсортированы
-            false иначе.
-    \note   Если указатель sortedArrays содержит NULL, то
-            возвращается true.
+    \brief  Функция выполняется на корутинах и выполняет сортировку
+            указанного диапазона файла.
+    \param  [in]  id    номер корутины
+    \param  [in]  task  указатель на struct SortTask
+    \note   После завершения сортирвки поле isSorted выставляется в
+            true, а sortsPending уменьшается.
 */
-static bool isAllArraySorted()
+static void doSorting(int id, void* task)
 {
-    if(!sortedArrays) return true;
-    for(int i = 0; i < nContexts; i++)
-        if(!sortedArrays[i].isSorted)
-            return false;
-    return true;
+    const struct SortTask* sortTask = (const struct SortTask*)task;
+    sortedArrays[id] = sortArrayFromFileRange(sortTask->filename, &sortTask->range, &sortConfig);
+    sortedArrays[id].isSorted = 1;
+    waitGroupDone(&sortsPending);
 }
 
 /**
-    \brief  Функция выполняется на корутинах и выполняет сортировку
-            указанного файла.
-    \param  [in]  id        номер корутины
-    \param  [in]  filename  строка, содержащая имя файла
-    \note   После завершения сортирвки поле isSorted выставляется в
-            true.
+    \brief  Функция выполняется на корутинах в режиме внешней сортировки:
+            нарезает диапазон файла на отсортированные серии на диске.
+    \param  [in]  id    номер корутины
+    \param  [in]  task  указатель на struct SortTask
+    \note   В sortedArrays[id] остается только статистика разбора.
 */
-static void doSorting(int id, const char* filename)
+static void doExternalSorting(int id, void* task)
 {
-    sortedArrays[id] = sortArrayFromFile(filename);
-    contextTimeInfo[id].totalWakingTime += CLOCK_DELAY;
+    const struct SortTask* sortTask = (const struct SortTask*)task;
+    if(!externalSortRange(sortTask->filename, &sortTask->range, &sortedArrays[id]))
+        printf("Error: Cant sort file `%s`\n", sortTask->filename);
     sortedArrays[id].isSorted = 1;
+    waitGroupDone(&sortsPending);
 }
 
 /**
-    \brief  Функция выделяет память для стека корутин.
-    \return Указатель на выделенную памать.
-    \note   Размер выделяемой для стека памяти задан
-            макросом STACK_SIZE.
+    Источник имен файлов для режима манифеста: сначала файлы из
+    командной строки, затем строки манифеста. Корутины забирают имена
+    по одному, поэтому весь список никогда не хранится в памяти.
 */
-static void* allocate_stack_sig()
+struct FileSource
 {
-    void *stack = malloc(STACK_SIZE);
-    assert(stack);
-    if(!stack)
-    {
-        handle_error_rude("Cant allocate memory for signal stack context.");
-        return NULL;
-    }
-    stack_t ss;
-    ss.ss_sp = stack;
-    ss.ss_size = STACK_SIZE;
-    ss.ss_flags = 0;
-    sigaltstack(&ss, NULL);
-    return stack;
-}
+    pthread_mutex_t lock;
+    char** names;
+    int nNames;
+    int next;
+    FILE* manifest;
+    char* line;
+    size_t lineCapacity;
+    size_t nAdmitted;   ///< сколько файлов уже выдано корутинам
+};
 
+static struct FileSource fileSource = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, NULL, NULL, 0, 0 };
 
 /**
-    \brief  Функция создает корутину с заданным id и
-            привязывает к ней файл.
-    \param  [in]  id        номер корутины
-    \param  [in]  filename  строка, содержащая имя файла 
+    \brief  Функция выдает имя следующего файла.
+    \return Копия имени, которую нужно освободить через free(), или
+            NULL, если файлы закончились.
+    \note   Пустые строки манифеста пропускаются, а перевод строки
+            (в том числе "\r\n") в имя не входит.
 */
-static void createCoroutine(int id, const char* filename)
+static char* nextSourceFile(struct FileSource* source)
 {
-    if (getcontext(&myContexts[id]) == -1)
-        handle_error_rude("getcontext");
-    myContexts[id].uc_stack.ss_sp = allocate_stack_sig();
-    myContexts[id].uc_stack.ss_size = STACK_SIZE;
-    myContexts[id].uc_stack.ss_flags = 0;
-    myContexts[id].uc_link = &uctx_main;
-    makecontext(&myContexts[id], doSorting, 2, id, filename);
+    char* name = NULL;
+    coroutinePreemptOff();
+    pthread_mutex_lock(&source->lock);
+    if(source->next < source->nNames)
+        name = strdup(source->names[source->next++]);
+    while(!name && source->manifest)
+    {
+        ssize_t length = getline(&source->line, &source->lineCapacity, source->manifest);
+        if(length == -1)
+        {
+            if(source->manifest != stdin)
+                fclose(source->manifest);
+            source->manifest = NULL;
+            break;
+        }
+        while(length && (source->line[length - 1] == '\n' || source->line[length - 1] == '\r'))
+            source->line[--length] = 0;
+        if(length)
+            name = strdup(source->line);
+    }
+    if(name)
+        source->nAdmitted++;
+    pthread_mutex_unlock(&source->lock);
+    coroutinePreemptOn();
+    return name;
 }
 
-
-#define Assert_memory_allocator(ptr)\
-    assert(ptr);\
-    if(!ptr)\
-        handle_error_rude("Cant allocate memory for coroutine.");
-
 /**
-    \brief  Функция выделяет память, которая использутеся
-            для работы планировщика и корутин.
-    \param  [in]  nCount  число корутин
-    \note   Стек планировщика имеет размер 4кБ
+    \brief  Функция выполняется на корутинах в режиме манифеста:
+            по одному забирает файлы из общего списка, пока они
+            не кончатся.
+    \param  [in]  id      номер корутины
+    \param  [in]  source  указатель на struct FileSource
+    \details Числа всех своих файлов корутина складывает в один массив
+             и сортирует его один раз в конце, так что сливать потом
+             нужно столько массивов, сколько корутин, а не файлов. В
+             режиме внешней сортировки каждый файл сразу уходит в
+             серии на диске. Открыт у корутины всегда только один файл.
+    \note   Без --memory массивы корутин растут вместе с объемом входа,
+             maxLiveCoroutines ограничивает только число открытых файлов
+             и стеков. Пиковая память не зависит от объема входа только
+             в режиме внешней сортировки.
 */
-static void allocateMemoryForCoroutine(int nCount)
+static void doManifestSorting(int id, void* source)
 {
-    static bool ifFirtsTime = true;
-    if(!ifFirtsTime) return;
-    ifFirtsTime = false;
-    myContexts = (ucontext_t*)calloc(nContexts,sizeof(ucontext_t));
-    Assert_memory_allocator(myContexts);
-    sortedArrays = (struct Array*)calloc(nContexts,sizeof(struct Array));
-    Assert_memory_allocator(sortedArrays);
-    contextTimeInfo = (struct SchedulerInfo*)calloc(nContexts, sizeof(struct SchedulerInfo));
-    Assert_memory_allocator(contextTimeInfo);
-    signal_stack = allocate_stack_sig();
-    Assert_memory_allocator(signal_stack);
+    struct Array* result = &sortedArrays[id];
+    size_t capacity = 0;
+    bool isExternal = sortConfig.memoryBudget != 0;
+    char* filename;
+    while((filename = nextSourceFile((struct FileSource*)source)))
+    {
+        struct Array array;
+        memset(&array, 0, sizeof(array));
+        if(isExternal)
+        {
+            struct FileRange wholeFile = {0, TO_END_OF_FILE};
+            if(!externalSortRange(filename, &wholeFile, &array))
+                printf("Error: Cant sort file `%s`\n", filename);
+        }
+        else
+        {
+            array = loadArrayFromFile(filename, &sortConfig);
+            if(!array.data)
+                printf("Error: Cant sort file `%s`\n", filename);
+        }
+        result->parsedBytes += array.parsedBytes;
+        result->parseTime += array.parseTime;
+        result->sortTime += array.sortTime;
+        if(isExternal)
+        {
+            result->size += array.size;
+            result->plan = array.plan;
+        }
+
+        if(array.data && result->size + array.size > capacity)
+        {
+            size_t grown = capacity ? 2 * capacity : array.size;
+            while(grown < result->size + array.size)
+                grown *= 2;
+            int* data = (int*)realloc(result->data, grown * sizeof(int));
+            if(!data)
+                handle_error_rude("Cant allocate memory for arrays.");
+            result->data = data;
+            capacity = grown;
+        }
+        if(array.data)
+        {
+            memcpy(result->data + result->size, array.data, array.size * sizeof(int));
+            result->size += array.size;
+            free(array.data);
+        }
+        free(filename);
+    }
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    traceBegin("sort");
+    if(result->data)
+        sortIntegersPlanned(result->data, result->size, sortConfig.algorithm, &result->plan);
+    traceEnd("sort");
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    result->sortTime += (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9;
+    result->isSorted = 1;
+    waitGroupDone(&sortsPending);
 }
 
 /**
-    \brief  Функция освобождает память, которая выделялась
-            для планировщика и корутин.
-    \param  [in]  nCount  число корутин
+    \brief  Функция делит входные файлы на задачи для корутин.
+    \param  [in]  filenames  имена файлов
+    \param  [in]  nFiles     число файлов
+    \return Число задач или -1, если не хватило памяти.
+    \details Работа делится на части не меньше sortConfig.splitSize и
+             не меньше доли одного исполнителя от общего объема файлов.
+             Поэтому много мелких файлов так и сортируются по одному на
+             задачу, а один огромный файл делится на столько частей,
+             сколько есть исполнителей. Отсортированные части потом
+             сливаются вместе со всеми остальными массивами.
+             Для планировщика у каждой задачи запоминается размер ее
+             диапазона, а приоритетом служит порядок файлов.
+    \note   Файлы, размер которых узнать нельзя (например, каналы),
+            никогда не делятся.
 */
-static void cleanMemoryForCoroutine(int nCount)
+static int planSortTasks(char** filenames, int nFiles)
 {
-    if(myContexts)
-    for(int i = 0; i < nCount; i++)
+    int nWorkers = nThreads > 0 ? nThreads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(nWorkers <= 0)
+        nWorkers = 1;
+
+    size_t* sizes = (size_t*)calloc(nFiles, sizeof(size_t));
+    if(!sizes)
+        return -1;
+    size_t totalSize = 0;
+    for(int i = 0; i < nFiles; i++)
+    {
+        struct stat info;
+        if(!stat(filenames[i], &info) && S_ISREG(info.st_mode))
+            sizes[i] = info.st_size;
+        totalSize += sizes[i];
+    }
+    size_t partSize = totalSize / nWorkers;
+    if(partSize < sortConfig.splitSize)
+        partSize = sortConfig.splitSize;
+    if(!partSize)
+        partSize = 1;
+
+    size_t maxTasks = 0;
+    for(int i = 0; i < nFiles; i++)
+    {
+        size_t nParts = (sizes[i] + partSize - 1) / partSize;
+        maxTasks += nParts > 1 ? (nParts < (size_t)nWorkers ? nParts : (size_t)nWorkers) : 1;
+    }
+    tasks = (struct SortTask*)calloc(maxTasks, sizeof(struct SortTask));
+    struct FileRange* ranges = (struct FileRange*)malloc(nWorkers * sizeof(struct FileRange));
+    if(!tasks || !ranges)
+    {
+        free(ranges);
+        free(sizes);
+        return -1;
+    }
+
+    int nTasks = 0;
+    for(int i = 0; i < nFiles; i++)
     {
-        if(myContexts[i].uc_stack.ss_sp) free(myContexts[i].uc_stack.ss_sp);
-        myContexts[i].uc_stack.ss_sp = NULL;
+        size_t nParts = (sizes[i] + partSize - 1) / partSize;
+        if(nParts > (size_t)nWorkers)
+            nParts = nWorkers;
+        if(nParts < 1)
+            nParts = 1;
+        size_t nRanges = splitFileIntoRanges(filenames[i], sizes[i], nParts, ranges);
+        for(size_t j = 0; j < nRanges; j++)
+        {
+            tasks[nTasks].filename = filenames[i];
+            tasks[nTasks].range = ranges[j];
+            tasks[nTasks].size = ranges[j].length != TO_END_OF_FILE ? ranges[j].length :
+                                 sizes[i] > ranges[j].offset ? sizes[i] - ranges[j].offset : 0;
+            tasks[nTasks].priority = i;
+            nTasks++;
+        }
     }
-    if(myContexts) free(myContexts);
-    
+    free(ranges);
+    free(sizes);
+    return nTasks;
+}
+
+/**
+    \brief  Функция освобождает отсортированные массивы.
+*/
+static void cleanSortedArrays()
+{
     if(sortedArrays)
-    for(int i = 0; i < nCount; i++)
+    for(int i = 0; i < nContexts; i++)
     {
         if(sortedArrays[i].data) free(sortedArrays[i].data);
         sortedArrays[i].data = NULL;
     }
     if(sortedArrays) free(sortedArrays);
-    
-    if(contextTimeInfo) free(contextTimeInfo);
-    if(signal_stack) free(signal_stack);
-    myContexts = NULL;
     sortedArrays = NULL;
-    contextTimeInfo = NULL;
-    signal_stack = NULL;
 }
 
 //==================================================================================================
 //==================================================================================================
 
 
-
-
-
-
-//==================================================================================================
-
-//                               планировщик и установка таймера
-
-//==================================================================================================
-
-
-sigset_t set; 
-struct itimerval timer;
-
-
-static void timer_off()
-{
-    timer.it_interval.tv_sec = 0;
-    timer.it_interval.tv_usec = 0;
-    timer.it_value = timer.it_interval;
-    if (setitimer(ITIMER_REAL, &timer, NULL) ) perror("setitiimer");
-}
-
-static void timer_on()
-{
-    timer.it_interval.tv_sec = 0;
-    timer.it_interval.tv_usec = TIME_LEGACY;
-    timer.it_value = timer.it_interval;
-    if (setitimer(ITIMER_REAL, &timer, NULL) ) perror("setitiimer");
-}
-
-
 /**
-    \brief    Простейший планировщих корутин.
-    \details  Планировщик вызывается по прерыванию от таймера
-              каждые TIME_LEGACY микросекнуд, при этом выбирается
-              та корутина, которая все еще сортирует свой массив.
-              То есть, если один файл является очень большим, то
-              в какой-то момент переключений между корутинами не будет.
-              А все время, отведенное программе, будет тратиться на
-              сортировку самого большого файла.
+    \brief  Функция последовательно сливает массивы деревом проигравших
+            и печатает результат через OutputWriter способом writeMode.
+    \return В случае успеха возвращается 0, иначе константа -1.
 */
-void scheduler()
+static int writeRunsSequential(const char* filename, const struct SortedRun* runs, size_t nRuns)
 {
-    timer_off();
-    int oldIndex = currentContextIndex;
-    do
+    struct OutputWriter writer;
+    if(writerOpen(&writer, filename, writeMode) == STANDART_ERROR_CODE)
+        return STANDART_ERROR_CODE;
+    struct LoserTree tree;
+    if(!loserTreeInit(&tree, runs, nRuns))
     {
-        currentContextIndex++;
-        currentContextIndex %= nContexts;
-    }while(sortedArrays[currentContextIndex].isSorted);
+        writerClose(&writer);
+        return STANDART_ERROR_CODE;
+    }
 
-    if(currentContextIndex!=oldIndex)
-        contextTimeInfo[oldIndex].swapTimes++;
-    
+    int block[MERGE_POP_BLOCK];
+    size_t count;
+    traceBegin("merge");
+    while((count = loserTreePopBlock(&tree, block, MERGE_POP_BLOCK)))
+        for(size_t i = 0, next; i < count; i = next)
+        {
+            for(next = i + 1; next < count && block[next] == block[i]; next++)
+                ;
+            writerPutInts(&writer, block[i], next - i);
+        }
+    traceEnd("merge");
 
-    timer_on();
-    setcontext(&myContexts[currentContextIndex]);
+    loserTreeDestroy(&tree);
+    return writerClose(&writer);
 }
 
-
 /**
-    \brief  Обработчик таймера, вызывающий планировщик.
-    \note   Если все массивы отсортированы, то таймер выключается.
+    \brief  Функция последовательно сливает массивы деревом проигравших
+            в двоичный файл формата outputFormat.
+    \return В случае успеха возвращается 0, иначе константа -1.
 */
-void timer_interrupt(int j, siginfo_t *si, void *old_context)
+static int writeRunsBinary(const char* filename, const struct SortedRun* runs, size_t nRuns)
 {
-    if(isAllArraySorted())
+    struct RunFileWriter writer;
+    if(runFileWriterOpen(&writer, filename, outputFormat) == STANDART_ERROR_CODE)
+        return STANDART_ERROR_CODE;
+    struct LoserTree tree;
+    if(!loserTreeInit(&tree, runs, nRuns))
     {
-        timer_off();
-        return;
+        runFileWriterClose(&writer);
+        return STANDART_ERROR_CODE;
     }
 
-    getcontext(&signal_context);
-    signal_context.uc_stack.ss_sp = signal_stack;
-    signal_context.uc_stack.ss_size = STACK_SIZE;
-    signal_context.uc_stack.ss_flags = 0;
-    sigemptyset(&signal_context.uc_sigmask);
-    makecontext(&signal_context, scheduler, 1);
-
-    contextTimeInfo[currentContextIndex].totalWakingTime+=CLOCK_DELAY;
-    swapcontext(&myContexts[currentContextIndex],&signal_context);
-}
-
-/**
-    \brief  Функция устанавливает обработчик для таймера 
-*/
-static void setup_signals(void)
-{
-    struct sigaction act;
-
-    act.sa_sigaction = timer_interrupt;
-    sigemptyset(&act.sa_mask);
-    act.sa_flags = SA_RESTART | SA_SIGINFO;
-
-    sigemptyset(&set);
-    sigaddset(&set, SIGALRM);
+    int block[MERGE_POP_BLOCK];
+    size_t count;
+    traceBegin("merge");
+    while((count = loserTreePopBlock(&tree, block, MERGE_POP_BLOCK)))
+        for(size_t i = 0, next; i < count; i = next)
+        {
+            for(next = i + 1; next < count && block[next] == block[i]; next++)
+                ;
+            runFileWriterPut(&writer, block[i], next - i);
+        }
+    traceEnd("merge");
 
-    if(sigaction(SIGALRM, &act, NULL) != 0)
-        handle_error_rude("Signal handler");
+    loserTreeDestroy(&tree);
+    return runFileWriterClose(&writer);
 }
 
-
-//==================================================================================================
-//==================================================================================================
-
-
 /**
     \brief  Функция объединяет все отсортированные массивы
             в один большой отсортированный массив, а
             результат записывается в файл.
     \param  [in]  filename  имя файла, в который будет
                             производиться запись
+    \note   Массивы сливаются деревом проигравших, то есть на каждый
+            элемент тратится O(log k) сравнений, где k - число массивов.
+            Два массива сливаются векторным ядром mergeTwoRuns(). При
+            обычной записи слияние делится между исполнителями по
+            MIN_MERGE_PART и больше чисел на каждого, а части пишутся
+            в файл параллельно через pwrite().
 */
 static void writeArraysInFile(const char* filename)
 {
     if(!filename)
         say_error_and_return("filename ptr contain null ptr.");
-    FILE* outFile = fopen(filename, "w");
-    if(!outFile)
-        say_error_and_return("Cant open file for writing.");
 
-    
-    int index[nContexts];
+    struct SortedRun* runs = (struct SortedRun*)calloc(nContexts, sizeof(struct SortedRun));
+    if(!runs)
+        say_error_and_return("Cant allocate memory for merging.");
+    size_t total = 0;
     for(int i = 0; i < nContexts; i++)
-        index[i] = 0;
+    {
+        runs[i].data = sortedArrays[i].data;
+        runs[i].size = sortedArrays[i].data ? sortedArrays[i].size : 0;
+        total += runs[i].size;
+    }
 
-    short nArraysWritedAlready = 0;
-    for(int i = 0; i < nContexts; i++)
-        if(sortedArrays[i].size == 0)
+    size_t nMergeThreads = nThreads > 0 ? nThreads : sysconf(_SC_NPROCESSORS_ONLN);
+    if(nMergeThreads > total / MIN_MERGE_PART)
+        nMergeThreads = total / MIN_MERGE_PART;
+    int ret;
+    if(outputFormat != RUN_FORMAT_TEXT)
+        ret = writeRunsBinary(filename, runs, nContexts);
+    else if(writeMode == WRITE_BUFFERED && nMergeThreads > 1)
+        ret = writeRunsParallel(filename, runs, nContexts, nMergeThreads);
+    else
+        ret = writeRunsSequential(filename, runs, nContexts);
+    if(ret == STANDART_ERROR_CODE)
+        printf("Error: cant write file `%s`\n", filename);
+    free(runs);
+}
+
+/**
+    \brief  Функция преобразует каждый файл в формат outputFormat, не
+            сортируя его. Результат пишется рядом, в файл с тем же
+            именем и расширением .txt или .bin.
+    \param  [in]  filenames  имена файлов
+    \param  [in]  nFiles     число файлов
+    \return Число файлов, которые не удалось преобразовать.
+    \note   Сжатый формат хранит только отсортированные числа, поэтому
+            неотсортированный файл в него не преобразуется.
+*/
+static int convertFiles(char** filenames, int nFiles)
+{
+    int nFailed = 0;
+    for(int i = 0; i < nFiles; i++)
+    {
+        struct Array array = loadArrayFromFile(filenames[i], &sortConfig);
+        if(!array.data)
         {
-            sortedArrays[i].isSorted = 0;
-            nArraysWritedAlready++;
+            nFailed++;
+            continue;
         }
-        
-        
-    while(nArraysWritedAlready != nContexts)
-    {
-        int min = INT_MAX;
-        int tmp = 0;
-        //поиск минимального элемента
-        for(int i = 0; i < nContexts; i++)
+        bool isSorted = true;
+        for(size_t j = 1; j < array.size && isSorted; j++)
+            isSorted = array.data[j - 1] <= array.data[j];
+        if(outputFormat == RUN_FORMAT_DELTA && !isSorted)
+        {
+            printf("Error: `%s` is not sorted, use --format=raw for it\n", filenames[i]);
+            free(array.data);
+            nFailed++;
+            continue;
+        }
+
+        size_t length = strlen(filenames[i]) + sizeof(".bin");
+        char* output = (char*)malloc(length);
+        if(!output)
+        {
+            printf("Error: Cant allocate memory for file name!\n");
+            free(array.data);
+            nFailed++;
+            continue;
+        }
+        snprintf(output, length, "%s%s", filenames[i], outputFormat == RUN_FORMAT_TEXT ? ".txt" : ".bin");
+        int ret;
+        if(outputFormat == RUN_FORMAT_TEXT)
         {
-            if(!sortedArrays[i].isSorted)
-                continue;
-            if(index[i] >= sortedArrays[i].size)
+            struct OutputWriter writer;
+            ret = writerOpen(&writer, output, writeMode);
+            if(!ret)
             {
-                sortedArrays[i].isSorted = 0;
-                nArraysWritedAlready++;
+                for(size_t j = 0; j < array.size; j++)
+                    writerPutInts(&writer, array.data[j], 1);
+                ret = writerClose(&writer);
             }
-            tmp = sortedArrays[i].data[index[i]];
-            if(min > tmp)
-                min = tmp;
         }
-        
-        if(nArraysWritedAlready == nContexts)
-            break;
-        
-        
-        //затем продвижение указателей в массивах до тех пор, пока не встретим новое число
-        tmp = 0; //будет хранить количество чисел во всех массивах, которые равны min
-        for(int i = 0; i < nContexts; i++)
-            if(sortedArrays[i].isSorted)
-            {
-                if(min != sortedArrays[i].data[index[i]])
-                    continue;
-                while(min == sortedArrays[i].data[index[i]])
+        else
+            ret = writeRunFile(output, array.data, array.size, outputFormat);
+
+        if(ret == STANDART_ERROR_CODE)
+        {
+            printf("Error: cant write file `%s`\n", output);
+            nFailed++;
+        }
+        else
+            printf("Converted `%s` (%zu numbers, %zu bytes) to `%s`\n",
+                filenames[i], array.size, array.parsedBytes, output);
+        free(output);
+        free(array.data);
+    }
+    return nFailed;
+}
+
+/**
+    \brief  Функция переводит строку вида 512, 64K, 4M или 1G в байты.
+    \return Размер в байтах или 0, если строка задана неверно.
+*/
+static size_t parseSize(const char* string)
+{
+    char* suffix = NULL;
+    unsigned long long value = strtoull(string, &suffix, 10);
+    if(suffix == string)
+        return 0;
+    switch(*suffix)
+    {
+        case 'G': case 'g': value *= 1024;  // fallthrough
+        case 'M': case 'm': value *= 1024;  // fallthrough
+        case 'K': case 'k': value *= 1024; suffix++; break;
+        case 0: break;
+        default: return 0;
+    }
+    return *suffix ? 0 : (size_t)value;
+}
+
+/**
+    \brief  Функция разбирает ключи командной строки.
+    \return Индекс первого аргумента, который является именем файла,
+            или -1, если ключи заданы неверно.
+*/
+static int parseOptions(int argc, char *argv[])
+{
+    static const struct option options[] =
+    {
+        {"read", required_argument, NULL, 'r'},
+        {"chunk-size", required_argument, NULL, 'c'},
+        {"algorithm", required_argument, NULL, 'a'},
+        {"threads", required_argument, NULL, 't'},
+        {"split-size", required_argument, NULL, 's'},
+        {"write", required_argument, NULL, 'w'},
+        {"memory", required_argument, NULL, 'm'},
+        {"temp-dir", required_argument, NULL, 'd'},
+        {"format", required_argument, NULL, 'f'},
+        {"convert", no_argument, NULL, 'C'},
+        {"policy", required_argument, NULL, 'p'},
+        {"manifest", required_argument, NULL, 'i'},
+        {"max-live", required_argument, NULL, 'l'},
+        {"metrics", required_argument, NULL, 'j'},
+        {"trace", required_argument, NULL, 'T'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while((opt = getopt_long(argc, argv, "r:c:a:t:s:w:m:d:f:Cp:i:l:j:T:", options, NULL)) != -1)
+    {
+        switch(opt)
+        {
+            case 'r':
+                if(!strcmp(optarg, "mmap"))
+                    sortConfig.readMode = READ_MMAP;
+                else if(!strcmp(optarg, "aio"))
+                    sortConfig.readMode = READ_AIO;
+                else if(!strcmp(optarg, "stream"))
+                    sortConfig.readMode = READ_STREAM;
+                else
                 {
-                    index[i]++;
-                    tmp++;
-                    if(index[i] == sortedArrays[i].size)
-                    {
-                        sortedArrays[i].isSorted = 0;
-                        nArraysWritedAlready++;
-                        break;
-                    }
+                    printf("Error: unknown read mode `%s`\n", optarg);
+                    return -1;
                 }
-            }
-        
-        //ну и печатаем в файл
-        while(tmp--)
-            fprintf(outFile, "%d ", min);
+                break;
+            case 'c':
+                sortConfig.chunkSize = parseSize(optarg);
+                if(!sortConfig.chunkSize)
+                {
+                    printf("Error: wrong chunk size `%s`\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'a':
+                if(!parseSortAlgorithm(optarg, &sortConfig.algorithm))
+                {
+                    printf("Error: unknown sort algorithm `%s`\n", optarg);
+                    return -1;
+                }
+                break;
+            case 't':
+                nThreads = atoi(optarg);
+                if(nThreads <= 0)
+                {
+                    printf("Error: wrong number of threads `%s`\n", optarg);
+                    return -1;
+                }
+                break;
+            case 's':
+                sortConfig.splitSize = parseSize(optarg);
+                if(!sortConfig.splitSize)
+                {
+                    printf("Error: wrong split size `%s`\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'w':
+                if(!parseWriteMode(optarg, &writeMode))
+                {
+                    printf("Error: unknown write mode `%s`\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'm':
+                sortConfig.memoryBudget = parseSize(optarg);
+                if(!sortConfig.memoryBudget)
+                {
+                    printf("Error: wrong memory budget `%s`\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'd':
+                sortConfig.tempDir = optarg;
+                break;
+            case 'f':
+                if(!parseRunFormat(optarg, &outputFormat))
+                {
+                    printf("Error: unknown format `%s`\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'C':
+                isConvertMode = true;
+                break;
+            case 'p':
+                if(!parseSchedulingPolicy(optarg, &schedulingPolicy))
+                {
+                    printf("Error: unknown scheduling policy `%s`\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'i':
+                manifestName = optarg;
+                break;
+            case 'l':
+                maxLiveCoroutines = atoi(optarg);
+                if(maxLiveCoroutines <= 0)
+                {
+                    printf("Error: wrong number of live coroutines `%s`\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'j':
+                metricsName = optarg;
+                break;
+            case 'T':
+                traceName = optarg;
+                break;
+            default:
+                return -1;
+        }
     }
+    return optind;
+}
 
-    fclose(outFile);
+static void printUsage(const char* programName)
+{
+    printf("Usage: %s [--read=mmap|aio|stream] [--chunk-size=SIZE]\n"
+           "          [--algorithm=heap|merge|radix|adaptive|counting|auto] [--threads=N]\n"
+           "          [--split-size=SIZE] [--write=write|direct|mmap]\n"
+           "          [--policy=rr|sff|least-time|priority]\n"
+           "          [--manifest=FILE|- [--max-live=N]]\n"
+           "          [--memory=SIZE [--temp-dir=DIR]]\n"
+           "          [--format=text|raw|delta] [--convert]\n"
+           "          [--metrics=FILE] [--trace=FILE] file...\n"
+           "--max-live bounds open files and stacks; memory is bounded only together with --memory.\n",
+           programName);
 }
 
 int main(int argc, char *argv[])
 {
+    int firstFile = parseOptions(argc, argv);
+    if(firstFile == -1)
+    {
+        printUsage(argv[0]);
+        return 0;
+    }
+
     //чекаем количество переденных файлов
-    if(argc == 1)
+    if(firstFile == argc && !manifestName)
     {
         printf("You should select at least one file for sorting.\n");
+        printUsage(argv[0]);
         return 0;
     }
 
 
-    nContexts = argc - 1;
+    int nFiles = argc - firstFile;
+    char** filenames = argv + firstFile;
     //проверяем, что все файлы, которые нам указали, доступны
-    for(int i = 0; i < nContexts; i++)
-        if(access( argv[i+1], F_OK ))
+    for(int i = 0; i < nFiles; i++)
+        if(access( filenames[i], F_OK ))
         {
-            printf("Error: file `%s` does not exist!\n",argv[i+1]);
+            printf("Error: file `%s` does not exist!\n",filenames[i]);
             return 0;
         }
 
+    //в режиме преобразования ничего не сортируем
+    if(isConvertMode)
+        return convertFiles(filenames, nFiles) ? EXIT_FAILURE : 0;
+
+    if(manifestName)
+    {
+        //файлы читаются из манифеста, работает не больше maxLiveCoroutines корутин
+        fileSource.names = filenames;
+        fileSource.nNames = nFiles;
+        fileSource.manifest = strcmp(manifestName, "-") ? fopen(manifestName, "r") : stdin;
+        if(!fileSource.manifest)
+        {
+            printf("Error: cant open manifest `%s`\n", manifestName);
+            return 0;
+        }
+        nContexts = maxLiveCoroutines;
+    }
+    else
+    {
+        //большие файлы делим на части, каждую сортирует своя корутина
+        nContexts = planSortTasks(filenames, nFiles);
+        if(nContexts == -1)
+            handle_error_rude("Cant allocate memory for tasks.");
+    }
+
     //выделяем память
+    sortedArrays = (struct Array*)calloc(nContexts,sizeof(struct Array));
+    if(!sortedArrays)
+        handle_error_rude("Cant allocate memory for arrays.");
+    //с бюджетом памяти сортируем через временные файлы
+    bool isExternal = sortConfig.memoryBudget != 0;
+    if(isExternal && !externalSortBegin(&sortConfig, nContexts))
+        handle_error_rude("Cant start external sort.");
     allocateMemoryForCoroutine(nContexts);
+    waitGroupInit(&sortsPending, nContexts);
     for(int i = 0; i < nContexts; i++)
-        createCoroutine(i, argv[i+1]);
+    {
+        if(manifestName)
+        {
+            createCoroutine(i, doManifestSorting, &fileSource);
+            continue;
+        }
+        createCoroutine(i, isExternal ? doExternalSorting : doSorting, &tasks[i]);
+        setCoroutineHints(i, tasks[i].size, tasks[i].priority);
+    }
 
-    ///устанавливаем таймер
-    setup_signals();
-    timer_on();
-    currentClock = clock();
-    
     //запускаем сортировку
-    swapcontext(&uctx_main, &myContexts[0]);
+    if(traceName)
+    {
+        traceStart();
+        traceThreadName("main", -1);
+    }
+    setSchedulingPolicy(schedulingPolicy);
+    startCoroutines(nThreads);
 
-    //ждем, пока все закончат сортировать
-    while(!isAllArraySorted()){;;}
-    timer_off();
-    
+    //ждем, пока все закончат сортировать; поток спит на futex
+    waitGroupWait(&sortsPending);
+    joinCoroutines();
+    waitGroupDestroy(&sortsPending);
 
     //выводим инфу о том, сколько работали корутины
     for(int i = 0; i<nContexts; i++)
     {
-        printf("cour[%d]: swap_times: %04ld, total working time %05ld us\n",
-            i, contextTimeInfo[i].swapTimes,
-            contextTimeInfo[i].totalWakingTime
+        printf("cour[%d]: swap_times: %04ld, migrations: %04ld, total working time %05ld us, stack %zu KB\n",
+            i, getSchedulerInfo(i)->swapTimes,
+            getSchedulerInfo(i)->migrations,
+            getSchedulerInfo(i)->totalWakingTime,
+            getSchedulerInfo(i)->stackHighWater / 1024
         );
     }
 
+    //накладные расходы планировщика
+    const struct RuntimeInfo* runtime = getRuntimeInfo();
+    size_t overheadTime = runtime->workerCpuTime - runtime->coroutineCpuTime;
+    printf("Scheduler: %d workers, %zu us CPU, overhead %zu us (%.2lf%%), %zu preemptions from %zu ticks\n",
+        runtime->nWorkers, runtime->workerCpuTime, overheadTime,
+        runtime->workerCpuTime ? 100.0 * overheadTime / runtime->workerCpuTime : 0.0,
+        runtime->nPreemptions, runtime->nTicks
+    );
+    printf("Policy %s: first result after %zu us, all sorted after %zu us\n",
+        schedulingPolicyName(schedulingPolicy), runtime->firstResultTime, runtime->makespan);
+    printf("Stacks: at most %d mapped at once for %d coroutines\n", runtime->peakStacks, nContexts);
+    if(manifestName)
+        printf("Manifest: %zu files sorted by at most %d live coroutines\n", fileSource.nAdmitted, nContexts);
+
+    //и скорость разбора текста
+    size_t totalParsedBytes = 0;
+    double totalParseTime = 0;
+    double totalSortTime = 0;
+    for(int i = 0; i<nContexts; i++)
+    {
+        double time = sortedArrays[i].parseTime;
+        printf("cour[%d]: parsed %zu bytes in %lf s (%.3lf GB/s)\n",
+            i, sortedArrays[i].parsedBytes, time,
+            time > 0 ? sortedArrays[i].parsedBytes / time / 1e9 : 0.0
+        );
+        const struct SortPlan* plan = &sortedArrays[i].plan;
+        if(sortConfig.algorithm == SORT_AUTO && plan->reason)
+            printf("cour[%d]: %s sort of %zu ints, %s (range [%d, %d], ~%zu distinct, ~%zu runs)\n",
+                i, sortAlgorithmName(plan->algorithm), plan->size, plan->reason,
+                plan->min, plan->max, plan->distinctEstimate, plan->nRuns);
+        else if(plan->reason && plan->size > 1 && plan->algorithm != sortConfig.algorithm)
+            printf("cour[%d]: %s sort instead of %s, %s\n", i, sortAlgorithmName(plan->algorithm),
+                sortAlgorithmName(sortConfig.algorithm), plan->reason);
+        totalParsedBytes += sortedArrays[i].parsedBytes;
+        totalParseTime += time;
+        totalSortTime += sortedArrays[i].sortTime;
+    }
+    printf("Parsing (%s): %zu bytes in %lf s (%.3lf GB/s)\n",
+        intParserName(), totalParsedBytes, totalParseTime,
+        totalParseTime > 0 ? totalParsedBytes / totalParseTime / 1e9 : 0.0
+    );
+    printf("Sorting (%s): %lf s\n", sortAlgorithmName(sortConfig.algorithm), totalSortTime);
+
     printf("Finally files have been sorted, but now we will start create another file!\n");
 
-    clock_t start = clock();
+    //слияние идет на нескольких потоках, поэтому меряем не clock(), а реальное время
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
     //производим конкатенацию всех файлов
-    writeArraysInFile("sorted.txt");
-    clock_t end = clock();
-    clock_t uSeconds = end-start;
-    double seconds = (double)uSeconds/CLOCKS_PER_SEC;
+    const char* outputName = outputFormat == RUN_FORMAT_TEXT ? "sorted.txt" : "sorted.bin";
+    if(!isExternal)
+        writeArraysInFile(outputName);
+    else if(externalSortFinish(outputName, writeMode, outputFormat) == STANDART_ERROR_CODE)
+        printf("Error: cant write file `%s`\n", outputName);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    long uSeconds = seconds * 1e6;
     printf("Writing to the file took %04ld us (%04lf s)\n", uSeconds, seconds);
-    
+    if(isExternal)
+        printf("External sort: %zu runs spilled, %zu merge passes with fan-in %zu, %zu bytes of temporary files\n",
+            getExternalSortInfo()->nSpilledRuns, getExternalSortInfo()->nMergePasses,
+            getExternalSortInfo()->fanIn, getExternalSortInfo()->spilledBytes);
+
+    //отчет пишется, пока статистика корутин еще не освобождена
+    if(metricsName)
+    {
+        const char** sources = (const char**)calloc(nContexts, sizeof(char*));
+        if(!sources)
+            handle_error_rude("Cant allocate memory for metrics.");
+        for(int i = 0; i < nContexts; i++)
+            sources[i] = manifestName ? manifestName : tasks[i].filename;
+        if(writeMetricsJson(metricsName, &sortConfig, sources, sortedArrays, nContexts, seconds) == STANDART_ERROR_CODE)
+            printf("Error: cant write file `%s`\n", metricsName);
+        free(sources);
+    }
+    if(traceName)
+    {
+        long nEvents = traceDump(traceName);
+        if(nEvents == STANDART_ERROR_CODE)
+            printf("Error: cant write file `%s`\n", traceName);
+        else
+            printf("Trace: %ld events written to `%s`\n", nEvents, traceName);
+    }
+
     //и чистим память
     cleanMemoryForCoroutine(nContexts);
+    cleanSortedArrays();
+    free(tasks);
+    free(fileSource.line);
     return 0;
 }
\ No newline at end of file